@@ -0,0 +1,222 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "bufferTracker.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if (defined(_WIN32) || defined(__WIN32__))
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct LiveBuffer
+{
+    BufferTag * tag;
+    std::size_t bytes;
+    int rows;
+    int cols;
+};
+
+//Everything in here is only touched with the mutex held.
+struct Registry
+{
+    std::mutex mutex;
+    std::map<std::pair<std::string, std::string>, BufferTag*> tags;
+    std::unordered_map<const void*, LiveBuffer> buffers;
+};
+
+Registry& registry()
+{
+    static Registry * reg = new Registry;//leaked on purpose; matrices outlive statics
+    return *reg;
+}
+
+std::atomic<std::size_t> totalLive(0);
+std::atomic<std::size_t> totalPeak(0);
+
+thread_local BufferTag * threadTag = nullptr;
+
+void raisePeak(std::atomic<std::size_t> &peak, const std::size_t value)
+{
+    std::size_t old = peak.load();
+    while (value > old && !peak.compare_exchange_weak(old, value)) {}
+}
+
+std::string toMiB(const std::size_t bytes)
+{
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << bytes/(1024.0*1024.0) << " MiB";
+    return text.str();
+}
+
+}
+
+BufferTag::BufferTag(const std::string &ownerIn, const std::string &stageIn)
+    : owner(ownerIn), stage(stageIn), live(0), peak(0)
+{
+}
+
+BufferTag * BufferTag::get(const std::string &owner, const std::string &stage)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    BufferTag *& tag = reg.tags[std::make_pair(owner, stage)];
+    if (tag == nullptr)
+    {
+        tag = new BufferTag(owner, stage);
+    }
+    return tag;
+}
+
+BufferTag * BufferTag::untagged()
+{
+    static BufferTag * tag = BufferTag::get("untagged", "");
+    return tag;
+}
+
+void BufferTag::allocated(const void * buffer, const std::size_t bytes, const int rows, const int cols)
+{
+    raisePeak(peak, live += bytes);
+    raisePeak(totalPeak, totalLive += bytes);
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.buffers[buffer] = LiveBuffer{this, bytes, rows, cols};
+}
+
+void BufferTag::released(const void * buffer, const std::size_t bytes)
+{
+    live -= bytes;
+    totalLive -= bytes;
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.buffers.erase(buffer);
+}
+
+BufferTagScope::BufferTagScope(const std::string &owner, const std::string &stage)
+    : BufferTagScope(BufferTag::get(owner, stage))
+{
+}
+
+BufferTagScope::BufferTagScope(BufferTag * tag)
+{
+    previous = threadTag;
+    threadTag = tag;
+}
+
+BufferTagScope::~BufferTagScope()
+{
+    threadTag = previous;
+}
+
+BufferTag * currentBufferTag()
+{
+    return threadTag ? threadTag : BufferTag::untagged();
+}
+
+std::size_t liveBufferBytes()
+{
+    return totalLive.load();
+}
+
+std::size_t peakBufferBytes()
+{
+    return totalPeak.load();
+}
+
+std::size_t physicalMemoryBytes()
+{
+#if (defined(_WIN32) || defined(__WIN32__))
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+    {
+        return std::size_t(status.ullTotalPhys);
+    }
+    return 0;
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || pageSize <= 0)
+    {
+        return 0;
+    }
+    return std::size_t(pages)*std::size_t(pageSize);
+#endif
+}
+
+void dumpBufferUsage(std::ostream &out)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    out << "Image buffer memory: " << toMiB(totalLive.load()) << " live, "
+        << toMiB(totalPeak.load()) << " peak" << std::endl;
+    for (auto &entry : reg.tags)
+    {
+        const BufferTag * tag = entry.second;
+        if (tag->peakBytes() == 0)
+        {
+            continue;
+        }
+        out << "  " << tag->owner << " / " << tag->stage << ": "
+            << toMiB(tag->liveBytes()) << " live, "
+            << toMiB(tag->peakBytes()) << " peak" << std::endl;
+    }
+}
+
+void dumpLargestBuffers(std::ostream &out, const std::string &owner, const int count)
+{
+    std::vector<LiveBuffer> largest;
+    {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (auto &entry : reg.buffers)
+        {
+            if (owner.empty() || entry.second.tag->owner == owner)
+            {
+                largest.push_back(entry.second);
+            }
+        }
+    }
+    std::sort(largest.begin(), largest.end(),
+              [](const LiveBuffer &a, const LiveBuffer &b) {return a.bytes > b.bytes;});
+    if (int(largest.size()) > count)
+    {
+        largest.resize(count);
+    }
+
+    out << "Largest buffers" << (owner.empty() ? "" : " of " + owner) << ":" << std::endl;
+    for (auto &buffer : largest)
+    {
+        out << "  " << toMiB(buffer.bytes) << "  " << buffer.rows << "x" << buffer.cols
+            << "  " << buffer.tag->owner << " / " << buffer.tag->stage << std::endl;
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef BUFFERTRACKER_H
+#define BUFFERTRACKER_H
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+//Accounting for the memory held by image buffers.
+//Every matrix allocation is charged to a tag naming its owner (usually a pipeline)
+// and the stage that allocated it. Tags keep live and peak bytes, and the
+// individual live buffers are kept too so that the biggest ones can be listed.
+
+class BufferTag
+{
+public:
+    //Returns the tag for this owner and stage, creating it if needed.
+    //Tags are never freed, so the pointer stays good for the life of the program.
+    static BufferTag * get(const std::string &owner, const std::string &stage);
+
+    //The tag for anything allocated outside of a BufferTagScope.
+    static BufferTag * untagged();
+
+    const std::string owner;
+    const std::string stage;
+
+    std::size_t liveBytes() const {return live.load();}
+    std::size_t peakBytes() const {return peak.load();}
+
+    //Called by matrix when it gets or gives back memory.
+    void allocated(const void * buffer, const std::size_t bytes, const int rows, const int cols);
+    void released(const void * buffer, const std::size_t bytes);
+
+private:
+    BufferTag(const std::string &ownerIn, const std::string &stageIn);
+    std::atomic<std::size_t> live;
+    std::atomic<std::size_t> peak;
+};
+
+//While one of these is in scope, matrices allocated on this thread are charged
+// to the given owner and stage. Scopes nest; the previous tag comes back on exit.
+//The tag is per thread: work handed to another thread has to take its tag along
+// (as ImagePipeline::runAside does), and matrices allocated inside OpenMP parallel
+// regions are charged to "untagged", so kernels should size their outputs beforehand.
+class BufferTagScope
+{
+public:
+    BufferTagScope(const std::string &owner, const std::string &stage);
+    explicit BufferTagScope(BufferTag * tag);
+    ~BufferTagScope();
+private:
+    BufferTag * previous;
+};
+
+//The tag new matrices on this thread get charged to.
+BufferTag * currentBufferTag();
+
+//Bytes held by all image buffers right now, and the most ever held at once.
+std::size_t liveBufferBytes();
+std::size_t peakBufferBytes();
+
+//Installed RAM, or 0 if it can't be determined.
+std::size_t physicalMemoryBytes();
+
+//Prints live and peak bytes for every tag with anything to report.
+void dumpBufferUsage(std::ostream &out);
+
+//Prints the largest live buffers, only those of one owner if it's not empty.
+void dumpLargestBuffers(std::ostream &out, const std::string &owner, const int count);
+
+#endif // BUFFERTRACKER_H
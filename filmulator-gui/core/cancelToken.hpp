@@ -0,0 +1,53 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef CANCELTOKEN_H
+#define CANCELTOKEN_H
+
+#include <atomic>
+
+//Lets long-running kernels notice that their result is no longer wanted, so that a
+// slider nudge doesn't have to wait for stale work on a huge image to finish.
+//Whoever owns the parameters trips the token; kernels poll it once per row (or block of
+// rows) and skip the rest of their work when it's set. Their outputs are then garbage,
+// so whoever called them has to check the token and throw the result away.
+class CancelToken
+{
+public:
+    void cancel() {flag.store(true, std::memory_order_relaxed);}
+    void reset() {flag.store(false, std::memory_order_relaxed);}
+    bool cancelled() const {return flag.load(std::memory_order_relaxed);}
+private:
+    std::atomic<bool> flag{false};
+};
+
+//While one of these is in scope, currentCancelToken() on this thread returns the given token.
+class CancelScope
+{
+public:
+    explicit CancelScope(const CancelToken * token);
+    ~CancelScope();
+private:
+    const CancelToken * previous;
+};
+
+//The token for work on this thread; one that's never tripped outside of a CancelScope.
+//OpenMP workers don't see the scope, so kernels fetch this before their parallel region.
+const CancelToken& currentCancelToken();
+
+#endif // CANCELTOKEN_H
@@ -1,5 +1,8 @@
 #include "filmSim.hpp"
 #include "lut.hpp"
+#include <cstring>
+#include <cstdint>
+#include <vector>
 
 //Constants for conversion to and from L*a*b*
 #define LAB_EPSILON (216.0/24389.0)
@@ -75,6 +78,49 @@ float sRGB_forward_gamma(float c)
     }
 }
 
+//Table-based sRGB_inverse_gamma for 16-bit input.
+//It's built once on first use and shared by every caller afterwards.
+static const float* sRGB_inverse_gamma_table()
+{
+    static const std::vector<float> table = []
+    {
+        std::vector<float> t(65536);
+        for (int i = 0; i < 65536; i++)
+        {
+            t[i] = sRGB_inverse_gamma(i / 65535.0f);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+//2^(5e/12) for the exponents e = -9 to 0 that the forward gamma curve sees
+// above its linear segment (0.0031308 is just over 2^-9).
+static const float sRGB_exponent_table[10] = {
+    7.432544469e-02f, 9.921256575e-02f, 1.324328868e-01f, 1.767766953e-01f,
+    2.359685782e-01f, 3.149802625e-01f, 4.204482076e-01f, 5.612310242e-01f,
+    7.491535384e-01f, 1.000000000e+00f};
+
+//Fast, branchless version of sRGB_forward_gamma.
+//We split c into mantissa m in [1,2) and exponent e, so that c^(1/2.4) = m^(5/12) * 2^(5e/12).
+//The mantissa term is a degree 5 polynomial fit in (m-1) with relative error under 2e-6,
+// which is well below one 16-bit code value; the exponent term comes from the table above.
+static inline float sRGB_forward_gamma_fast(float c)
+{
+    const float x = min(max(c, 0.0031308f), 1.0f);
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    const int e = int(bits >> 23) - 127;
+    const uint32_t mbits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    memcpy(&m, &mbits, sizeof(m));
+    const float t = m - 1.0f;
+    const float mPow = 1.000001767f + t*(0.4165380931f + t*(-0.1199465989f + t*(0.05661427386f + t*(-0.02351015063f + t*0.005143488096f))));
+    const float curved = 1.055f*mPow*sRGB_exponent_table[e + 9] - 0.055f;
+    const float linear = max(c, 0.0f)*12.92f;
+    return (c <= 0.0031308f) ? linear : min(curved, 1.0f);
+}
+
 //Linearize L* curved XYZ (coming from L*a*b*)
 //Reference: http://www.brucelindbloom.com/index.html?Eqn_Lab_to_XYZ.html
 float Lab_inverse_gamma(float c)
@@ -151,6 +197,8 @@ void sRGB_to_Lab_s(matrix<unsigned short> &in,
 
     Lab.set_size(nRows, nCols);
 
+    const float * invgamma = sRGB_inverse_gamma_table();
+
 #pragma omp parallel shared(in, Lab) firstprivate(nRows, nCols)
     {
 #pragma omp for schedule(dynamic) nowait
@@ -159,9 +207,9 @@ void sRGB_to_Lab_s(matrix<unsigned short> &in,
             for (int j = 0; j < nCols; j += 3)
             {
                 //First, linearize the sRGB.
-                float r = sRGB_inverse_gamma(float(in(i, j  ))/65535.0);
-                float g = sRGB_inverse_gamma(float(in(i, j+1))/65535.0);
-                float b = sRGB_inverse_gamma(float(in(i, j+2))/65535.0);
+                float r = invgamma[in(i, j  )];
+                float g = invgamma[in(i, j+1)];
+                float b = invgamma[in(i, j+2)];
 
                 //Next, convert to XYZ.
                 float x, y, z;
@@ -194,27 +242,72 @@ void sRGB_linearize(matrix<unsigned short> &in,
     int nRows = in.nr();
     int nCols = in.nc();
 
-    // build lookup table
-    float invgamma[65536];
-    for (int i = 0; i < 65536; i++)
+    const float * invgamma = sRGB_inverse_gamma_table();
+
+    out.set_size(nRows, nCols);
+
+#pragma omp parallel for shared(in, out) firstprivate(nRows, nCols)
+    for (int i = 0; i < nRows; i++)
     {
-        invgamma[i] = sRGB_inverse_gamma(i / 65535.0f);
+        const unsigned short * inRow = in[i];
+        float * outRow = out[i];
+        for (int j = 0; j < nCols; j++)
+        {
+            outRow[j] = invgamma[inRow[j]];
+        }
     }
+}
 
-    out.set_size(nRows, nCols);
+//Converts gamma-curved sRGB D50 to linear while box-averaging factor x factor blocks.
+//Averaging happens in linear light, and partial blocks at the edges are averaged over
+// only the pixels they contain. This lets us shrink big images without ever holding
+// a full-size float copy.
+void sRGB_linearize_downscale(matrix<unsigned short> &in,
+                              matrix<float> &out,
+                              const int factor)
+{
+    const int nRows = in.nr();
+    const int nCols = in.nc()/3;
+    const int outRows = (nRows + factor - 1)/factor;
+    const int outCols = (nCols + factor - 1)/factor;
+
+    const float * invgamma = sRGB_inverse_gamma_table();
 
-#pragma omp parallel shared(in, out) firstprivate(nRows, nCols)
+    out.set_size(outRows, outCols*3);
+
+#pragma omp parallel for
+    for (int i = 0; i < outRows; i++)
     {
-#pragma omp for schedule(dynamic) nowait
-        for (int i = 0; i < nRows; i++)
+        const int rowStart = i*factor;
+        const int rowEnd = min(nRows, rowStart + factor);
+        float * outRow = out[i];
+        for (int j = 0; j < outCols*3; j++)
         {
-            for (int j = 0; j < nCols; j += 3)
+            outRow[j] = 0.0f;
+        }
+        for (int r = rowStart; r < rowEnd; r++)
+        {
+            const unsigned short * inRow = in[r];
+            for (int j = 0; j < outCols; j++)
             {
-                out(i, j  ) = invgamma[in(i, j  )];
-                out(i, j+1) = invgamma[in(i, j+1)];
-                out(i, j+2) = invgamma[in(i, j+2)];
+                const int colEnd = min(nCols, (j+1)*factor);
+                for (int c = j*factor; c < colEnd; c++)
+                {
+                    outRow[3*j  ] += invgamma[inRow[3*c  ]];
+                    outRow[3*j+1] += invgamma[inRow[3*c+1]];
+                    outRow[3*j+2] += invgamma[inRow[3*c+2]];
+                }
             }
         }
+        const int blockHeight = rowEnd - rowStart;
+        for (int j = 0; j < outCols; j++)
+        {
+            const int blockWidth = min(nCols, (j+1)*factor) - j*factor;
+            const float norm = 1.0f/float(blockHeight*blockWidth);
+            outRow[3*j  ] *= norm;
+            outRow[3*j+1] *= norm;
+            outRow[3*j+2] *= norm;
+        }
     }
 }
 
@@ -228,18 +321,15 @@ void sRGB_gammacurve(matrix<float> &in,
 
     out.set_size(nRows,nCols);
 
-#pragma omp parallel shared(in, out) firstprivate(nRows, nCols)
+#pragma omp parallel for shared(in, out) firstprivate(nRows, nCols)
+    for (int i = 0; i < nRows; i++)
     {
-#pragma omp for schedule(dynamic) nowait
-        for (int i = 0; i < nRows; i++)
+        const float * inRow = in[i];
+        unsigned short * outRow = out[i];
+#pragma omp simd
+        for (int j = 0; j < nCols; j++)
         {
-            for (int j = 0; j < nCols; j += 3)
-            {
-                //First, linearize the sRGB.
-                out(i, j  ) = (unsigned short)(65535*sRGB_forward_gamma(in(i, j  )));
-                out(i, j+1) = (unsigned short)(65535*sRGB_forward_gamma(in(i, j+1)));
-                out(i, j+2) = (unsigned short)(65535*sRGB_forward_gamma(in(i, j+2)));
-            }
+            outRow[j] = (unsigned short)(65535*sRGB_forward_gamma_fast(inRow[j]));
         }
     }
 }
@@ -140,11 +140,16 @@ void film_like_curve(matrix<unsigned short> &input,
     int ysize = input.nr();
     output.set_size(ysize, xsize);
 
+    const CancelToken &cancel = currentCancelToken();
 #pragma omp parallel shared(lookup, input, output, xsize, ysize)
     {
 #pragma omp for schedule(dynamic) nowait
     for (int i = 0; i < ysize; i++)
     {
+        if (cancel.cancelled())
+        {
+            continue;
+        }
         for (int j = 0; j < xsize; j = j + 3)
         {
             unsigned short r = input(i, j  );
@@ -0,0 +1,60 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef DECODEDIMAGE_H
+#define DECODEDIMAGE_H
+
+#include "matrix.hpp"
+#include <exiv2/exiv2.hpp>
+#include <memory>
+#include <string>
+
+//What the load stage learns about an image besides its pixels.
+struct ImageInfo
+{
+    std::string source;//the image's hash, or its filename if it has none
+    unsigned cfa[2][2];
+    unsigned xtrans[6][6];
+    int maxXtrans = 0;
+    int raw_width = 0;
+    int raw_height = 0;
+    float camToRGB[3][3];
+    float camToRGB4[3][4];
+    float rCamMul, gCamMul, bCamMul;//wb used on the image
+    float rPreMul, gPreMul, bPreMul;//"daylight" wb according to libraw
+    float maxValue;
+    bool isSraw = false;//Actually we should set this for all full-color raws (including X-Transformer)
+    bool isNikonSraw = false;
+    bool isMonochrome = false;
+    bool isCR3 = false;
+    Exiv2::ExifData exifData;
+};
+
+//A full-size demosaiced image, before highlight recovery, along with its metadata.
+//The quick pipelines make these and the full pipeline starts from them, so it can skip
+// loading and demosaicing. They're shared read-only: holding a reference keeps one
+// alive, and nobody writes to one after it's made.
+struct DecodedImage
+{
+    ImageInfo info;
+    matrix<float> image;
+    //The source image and the demosaic parameters it was made with.
+    std::string key;
+};
+
+#endif // DECODEDIMAGE_H
@@ -51,6 +51,7 @@ void develop( matrix<float> &crystalRad,
     //These are the column indices for red, green, and blue.
     int row, col, colr, colg, colb;
 
+    const CancelToken &cancel = currentCancelToken();
 #pragma omp parallel shared( develConcentration, silverSaltDensity,\
         crystalRad, activeCrystalsPerPixel, cgc, dcc, sscc )\
         private( row, col,\
@@ -62,6 +63,10 @@ void develop( matrix<float> &crystalRad,
 #pragma omp for schedule( dynamic ) nowait
         for ( row = 0; row < height; row++ )
         {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             for ( col = 0; col < width; col++ )
             {
                 colr = col * 3;
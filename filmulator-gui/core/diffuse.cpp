@@ -88,6 +88,7 @@ void diffuse_x(matrix<float> &developer_concentration, int convlength,
 {
     const int length = developer_concentration.nr();
     const int width = developer_concentration.nc();
+    const CancelToken &cancel = currentCancelToken();
 
 #pragma omp parallel shared(developer_concentration,convlength,convrad,order,\
         paddedwidth,pad,swell_factor)
@@ -97,6 +98,10 @@ void diffuse_x(matrix<float> &developer_concentration, int convlength,
 #pragma omp for schedule(dynamic) nowait
         for (int row = 0; row<length;row++)
         {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             //Mirror the start of padded from the row.
             for (int col = 0; col < pad; col++)
             {
@@ -154,6 +159,7 @@ void diffuse_y(matrix<float> &developer_concentration, int convlength,
 {
     const int length = developer_concentration.nr();
     const int width = developer_concentration.nc();
+    const CancelToken &cancel = currentCancelToken();
 
 #pragma omp parallel shared(developer_concentration,convlength,convrad,order,\
         paddedlength,pad,swell_factor)
@@ -164,6 +170,10 @@ void diffuse_y(matrix<float> &developer_concentration, int convlength,
         #pragma omp for nowait
         for (int col = 0; col < width - (numcols - 1); col += numcols)
         {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             //Mirror the start of padded from the row.
             for (int row = 0; row < pad; row++)
             {
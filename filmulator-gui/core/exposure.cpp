@@ -30,10 +30,15 @@ void exposure(matrix<float> &input_image, float crystals_per_pixel,
     const float crystal_headroom = max_crystals - rolloff_boundary;
     //Magic number mostly for historical reasons
     crystals_per_pixel *= 0.00015387105f;
+    const CancelToken &cancel = currentCancelToken();
 #pragma omp parallel
     {
         #pragma omp for schedule(dynamic) nowait
         for(int row = 0; row < nrows; row++) {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             for(int col = 0; col<ncols; col++) {
                 float input = max(0.0f,input_image(row,col));
                 input = max(0.0f, input - toe_boundary + (toe_boundary*toe_boundary)/(input + toe_boundary+1/65535.0f));
@@ -31,6 +31,7 @@
 #include "lut.hpp"
 #include <libraw/libraw.h>
 #include "matrix.hpp"
+#include "cancelToken.hpp"
 #include <sys/time.h>
 #include "interface.h"
 
@@ -210,13 +211,37 @@ void whitepoint_blackpoint(matrix<float> &input, matrix<unsigned short> &output,
 void colorCurves(matrix<unsigned short> &input, matrix<unsigned short> &output,
                 LUT<unsigned short> &lutR, LUT<unsigned short> &lutG, LUT<unsigned short> &lutB);
 
+//Packs three color planes into one interleaved RGB matrix.
+void interleave(const matrix_view<const float> &red, const matrix_view<const float> &green,
+                const matrix_view<const float> &blue, matrix<float> &output);
+
+//Splits an interleaved RGB matrix into three color planes.
+void deinterleave(const matrix_view<const float> &input, matrix<float> &red,
+                  matrix<float> &green, matrix<float> &blue);
+
 void rotate_image(matrix<float> &input, matrix<float> &output,
                   int rotation);
 
+//Rotates by quarter turns and crops in one pass; the crop is in rotated coordinates.
+void rotate_and_crop(const matrix_view<const float> &input, matrix<float> &output,
+                     const int rotation,
+                     const int startX, const int startY,
+                     const int width, const int height);
+
 //Uses Nelder-Mead method to find the WB parameters that yield (1,1,1) RGB multipliers.
 void optimizeWBMults( std::string inputFilename,
                       float &temperature, float &tint );
 
+//Same, but reads the camera matrix and multipliers from an already-open raw.
+void optimizeWBMults( LibRaw * libraw,
+                      float &temperature, float &tint );
+
+//Same, but works purely from the camera matrix and normalized multipliers.
+void optimizeWBMults( float camToRGB[3][3],
+                      float rCamMul, float gCamMul, float bCamMul,
+                      float rPreMul, float gPreMul, float bPreMul,
+                      float &temperature, float &tint );
+
 //Applies the desired temperature and tint adjustments to the image.
 void whiteBalance(matrix<float> &input, matrix<float> &output,
                   float temperature, float tint, float cam2rgb[3][3],
@@ -224,6 +249,16 @@ void whiteBalance(matrix<float> &input, matrix<float> &output,
                   float rPreMul, float gPreMul, float bPreMul,
                   float maxValue, float factor = 1.f);
 
+//Folds white balance, the camera matrix, and exposure into one 3x3 transform.
+void whiteBalanceMatrix(float temperature, float tint, float cam2rgb[3][3],
+                        float rCamMul, float gCamMul, float bCamMul,
+                        float rPreMul, float gPreMul, float bPreMul,
+                        float factor, float (&transform)[3][3]);
+
+//Applies a 3x3 color matrix to every pixel in one pass, clipping negatives to zero.
+void colorTransform(const matrix_view<const float> &input, matrix<float> &output,
+                    const float transform[3][3]);
+
 void vibrance_saturation(const matrix<unsigned short> &input,
                          matrix<unsigned short> &output,
                          float vibrance, float saturation);
@@ -232,7 +267,8 @@ void monochrome_convert(const matrix<unsigned short> &input,
                         matrix<unsigned short> &output,
                         float rmult, float gmult, float bmult);
 
-void downscale_and_crop(const matrix<float> &input,
+//Scales the input to fit within the output size limits after cropping; crop-only is a row copy.
+void downscale_and_crop(const matrix_view<const float> &input,
                         matrix<float> &output,
                         const int inputStartX,
                         const int inputStartY,
@@ -269,10 +305,22 @@ void XYZ_to_Lab(float fx, float fy, float fz,
 void Lab_to_XYZ(float   L, float   a, float   b,
                  float &fx, float &fy, float &fz);
 
+//Packs a float image into half floats, scaled by a power of two to fit; returns the scale.
+float pack_half(const matrix<float> &input, matrix<unsigned short> &output);
+
+//Unpacks half floats from pack_half into a float image, undoing the scale.
+void unpack_half(const matrix<unsigned short> &input, matrix<float> &output,
+                 const float scale);
+
 //Converts gamma-curved sRGB to linear, short int to float.
 void sRGB_linearize(matrix<unsigned short> &RGB,
                     matrix<float> &out);
 
+//Converts gamma-curved sRGB to linear while box-downscaling by an integer factor.
+void sRGB_linearize_downscale(matrix<unsigned short> &RGB,
+                              matrix<float> &linear,
+                              const int factor);
+
 //Converts linear SRGB to gamma-curved, float to short int.
 void sRGB_gammacurve(matrix<float> &RGB,
                      matrix<unsigned short> &out);
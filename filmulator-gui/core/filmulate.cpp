@@ -36,6 +36,34 @@ bool ImagePipeline::filmulate(matrix<float> &input_image,
         return true;
     }
 
+    //This result may still be held from an earlier setting, or be in the disk cache
+    // if the image was edited in an earlier session.
+    const std::string key = prefilmKey.empty() ? std::string() : StageKey(prefilmKey)
+            .add(filmParam.initialDeveloperConcentration)
+            .add(filmParam.reservoirThickness)
+            .add(filmParam.activeLayerThickness)
+            .add(filmParam.crystalsPerPixel)
+            .add(filmParam.initialCrystalRadius)
+            .add(filmParam.initialSilverSaltDensity)
+            .add(filmParam.developerConsumptionConst)
+            .add(filmParam.crystalGrowthConst)
+            .add(filmParam.silverSaltConsumptionConst)
+            .add(filmParam.totalDevelopmentTime)
+            .add(filmParam.agitateCount)
+            .add(filmParam.developmentSteps)
+            .add(filmParam.filmArea)
+            .add(filmParam.sigmaConst)
+            .add(filmParam.layerMixConst)
+            .add(filmParam.layerTimeDivisor)
+            .add(filmParam.rolloffBoundary)
+            .add(filmParam.toeBoundary).str();
+    if (recallStage(Valid::filmulation, filmKey, key, output_density) ||
+        (diskCacheable && StageCache::load(key, output_density)))
+    {
+        filmKey = key;
+        return false;
+    }
+
     //Extract parameters from struct
     float initial_developer_concentration = filmParam.initialDeveloperConcentration;
     float reservoir_thickness = filmParam.reservoirThickness;
@@ -77,12 +105,13 @@ bool ImagePipeline::filmulate(matrix<float> &input_image,
 
     //All layers share developer, so we only make it the original image size.
     matrix<float> developer_concentration;
-    developer_concentration.set_size(nrows,ncols);
+    //These stay inside filmulate, so they can use padded rows.
+    developer_concentration.set_size(nrows,ncols,MatrixLayout::padded);
     developer_concentration = initial_developer_concentration;
 
     //Each layer gets its own silver salt which will feed crystal growth.
     matrix<float> silver_salt_density;
-    silver_salt_density.set_size(nrows,ncols*3);
+    silver_salt_density.set_size(nrows,ncols*3,MatrixLayout::padded);
     silver_salt_density = initial_silver_salt_density;
 
     //Now, we set up the reservoir.
@@ -232,6 +261,20 @@ bool ImagePipeline::filmulate(matrix<float> &input_image,
 #ifdef DOUT
     debug_out.close();
 #endif
+    //The kernels above stop early if this run went stale.
+    if (currentCancelToken().cancelled())
+    {
+        return true;
+    }
+    if (diskCacheable)
+    {
+        //The cache copies the image, which can overlap the stages after this one.
+        runAside([key, &output_density]()
+        {
+            StageCache::store(key, output_density);
+        });
+    }
+    filmKey = key;
     return false;
 }
 
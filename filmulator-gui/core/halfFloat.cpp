@@ -0,0 +1,140 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "filmSim.hpp"
+#include <cstdint>
+#include <cstring>
+
+//IEEE half floats: 1 sign bit, 5 exponent bits, 10 mantissa bits.
+//Rounds to nearest even; anything too big becomes infinity.
+static inline unsigned short float_to_half(const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const unsigned short sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    if (bits >= 0x47800000)//too big for a half, or inf or nan
+    {
+        return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (bits < 0x38800000)//subnormal half or zero
+    {
+        //Adding 0.5 lines the half's subnormal step up with the float's last mantissa bit,
+        // and the float add does the rounding.
+        float shifted;
+        std::memcpy(&shifted, &bits, sizeof(shifted));
+        shifted += 0.5f;
+        std::memcpy(&bits, &shifted, sizeof(bits));
+        return sign | (bits - 0x3f000000);
+    }
+    //Rebias the exponent from 127 to 15 and round off the bottom 13 mantissa bits.
+    const uint32_t mantissaOdd = (bits >> 13) & 1;
+    bits += 0xc8000fff + mantissaOdd;
+    return sign | (bits >> 13);
+}
+
+static inline float half_to_float(const unsigned short half)
+{
+    uint32_t bits = (uint32_t(half) & 0x7fff) << 13;
+    const uint32_t exponent = bits & 0x0f800000;
+    bits += 0x38000000;//rebias the exponent from 15 to 127
+    float value;
+    if (exponent == 0x0f800000)//inf or nan
+    {
+        bits += 0x38000000;
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+    else if (exponent == 0)//subnormal or zero: renormalize with a float subtract
+    {
+        bits += 0x00800000;
+        std::memcpy(&value, &bits, sizeof(value));
+        value -= 6.103515625e-05f;//2^-14
+    }
+    else
+    {
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+//We build with -ffast-math, which lets the compiler assume std::isfinite is always true,
+// so this looks at the exponent bits instead.
+static inline bool finite_bits(const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x7f800000) != 0x7f800000;
+}
+
+//Packs a float image into half floats at half the memory.
+//The image is first scaled by a power of two so its largest magnitude lands near 2^15,
+// which keeps it under the half float maximum of 65504 and uses the full exponent range.
+//The return value is that scale, to be handed back to unpack_half.
+float pack_half(const matrix<float> &input, matrix<unsigned short> &output)
+{
+    const int nRows = input.nr();
+    const int nCols = input.nc();
+
+    output.set_size(nRows, nCols);
+    if (nRows == 0 || nCols == 0)
+    {
+        return 1.0f;
+    }
+
+    const float largest = std::max(std::abs(input.max()), std::abs(input.min()));
+    float scale = 1.0f;
+    if (largest > 0.0f && finite_bits(largest))
+    {
+        scale = std::exp2(std::floor(std::log2(32768.0f/largest)));
+    }
+
+    #pragma omp parallel for
+    for (int row = 0; row < nRows; row++)
+    {
+        const float * __restrict inRow = input[row];
+        unsigned short * __restrict outRow = output[row];
+        for (int col = 0; col < nCols; col++)
+        {
+            outRow[col] = float_to_half(inRow[col]*scale);
+        }
+    }
+    return scale;
+}
+
+//Turns half floats from pack_half back into a float image, undoing its scale.
+void unpack_half(const matrix<unsigned short> &input, matrix<float> &output,
+                 const float scale)
+{
+    const int nRows = input.nr();
+    const int nCols = input.nc();
+    const float inverse = 1.0f/scale;
+
+    output.set_size(nRows, nCols);
+
+    #pragma omp parallel for
+    for (int row = 0; row < nRows; row++)
+    {
+        const unsigned short * __restrict inRow = input[row];
+        float * __restrict outRow = output[row];
+        for (int col = 0; col < nCols; col++)
+        {
+            outRow[col] = half_to_float(inRow[col])*inverse;
+        }
+    }
+}
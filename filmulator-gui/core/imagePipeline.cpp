@@ -1,15 +1,24 @@
 #include "imagePipeline.h"
 #include "../database/exifFunctions.h"
 #include "../database/camconst.h"
+#include <QCoreApplication>
 #include <QDir>
 #include <QStandardPaths>
 
-ImagePipeline::ImagePipeline(Cache cacheIn, Histo histoIn, QuickQuality qualityIn)
+QMutex ImagePipeline::budgetMutex;
+std::vector<ImagePipeline*> ImagePipeline::allPipelines;
+std::size_t ImagePipeline::memoryBudget = physicalMemoryBytes()/2;
+bool ImagePipeline::compactStages = true;
+
+ImagePipeline::ImagePipeline(Cache cacheIn, Histo histoIn, QuickQuality qualityIn, std::string nameIn)
 {
+    name = nameIn;
     cache = cacheIn;
     histo = histoIn;
     quality = qualityIn;
     valid = Valid::none;
+    workClass = (HighQuality == quality) ? WorkClass::fullRender :
+                (PreviewQuality == quality) ? WorkClass::interactive : WorkClass::background;
 
     completionTimes.resize(Valid::count);
     completionTimes[Valid::none] = 0;
@@ -17,10 +26,24 @@ ImagePipeline::ImagePipeline(Cache cacheIn, Histo histoIn, QuickQuality qualityI
     completionTimes[Valid::demosaic] = 50;
     completionTimes[Valid::prefilmulation] = 5;
     completionTimes[Valid::filmulation] = 50;
+    completionTimes[Valid::crop] = 5;
     completionTimes[Valid::blackwhite] = 10;
     completionTimes[Valid::colorcurve] = 10;
     //completionTimes[Valid::filmlikecurve] = 10;
 
+    evicted.resize(Valid::count, false);
+    compacted.resize(Valid::count, false);
+    compactScale.resize(Valid::count, 1.0f);
+    spills.resize(Valid::count);
+
+    QMutexLocker budgetLocker(&budgetMutex);
+    allPipelines.push_back(this);
+}
+
+ImagePipeline::~ImagePipeline()
+{
+    QMutexLocker budgetLocker(&budgetMutex);
+    allPipelines.erase(std::remove(allPipelines.begin(), allPipelines.end(), this), allPipelines.end());
 }
 
 //int ImagePipeline::libraw_callback(void *data, LibRaw_progress p, int iteration, int expected)
@@ -54,20 +77,46 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
     gettimeofday(&timeRequested, nullptr);
     histoInterface = interface_in;
 
+    //Keep the memory budget from dropping buffers out from under us.
+    QMutexLocker cacheLocker(&cacheMutex);
+
+    //Take our share of the cores while this runs.
+    ThreadBudgetScope threadScope(workClass);
+
+    //Histograms may still be reading stage outputs; they have to finish before we return
+    // and let the memory budget at those outputs again, however we return.
+    class SideTaskJoin
+    {
+    public:
+        explicit SideTaskJoin(ImagePipeline * pipeIn) : pipe(pipeIn) {}
+        ~SideTaskJoin() {pipe->waitForSideTasks();}
+    private:
+        ImagePipeline * pipe;
+    } sideTaskJoin(this);
+
+    //Kernels poll this to stop early once the stage they're working on has gone stale.
+    //Whatever they leave behind is garbage, so every stage checks it before marking itself done.
+    //Anything that goes stale after this reset also lowers the validity we're about to read.
+    CancelToken &cancel = *paramManager->getCancelToken();
+    cancel.reset();
+    CancelScope cancelScope(&cancel);
+
     valid = paramManager->getValid();
     if (NoCache == cache || true == cacheEmpty)
     {
         valid = none;//we need to start fresh if nothing is going to be cached.
     }
+    valid = resumePoint(valid);
 
     LoadParams loadParam;
     DemosaicParams demosaicParam;
     PrefilmParams prefilmParam;
     //FilmParams filmParam;
+    CropParams cropParam;
     BlackWhiteParams blackWhiteParam;
     FilmlikeCurvesParams curvesParam;
 
-    isCR3 = false;
+    info.isCR3 = false;
 
     cout << "ImagePipeline::processImage valid: " << valid << endl;
 
@@ -77,6 +126,7 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
     case partload: [[fallthrough]];
     case none://Load image into buffer
     {
+        BufferTagScope bufferScope(name, "load");
         AbortStatus abort;
         //See whether to abort or not, while grabbing the latest parameters.
         std::tie(valid, abort, loadParam) = paramManager->claimLoadParams();
@@ -86,9 +136,10 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
             return emptyMatrix();
         }
 
-        isCR3 = QString::fromStdString(loadParam.fullFilename).endsWith(".cr3", Qt::CaseInsensitive);
+        info.source = loadParam.sourceHash.empty() ? loadParam.fullFilename : loadParam.sourceHash;
+        info.isCR3 = QString::fromStdString(loadParam.fullFilename).endsWith(".cr3", Qt::CaseInsensitive);
         const bool isDNG = QString::fromStdString(loadParam.fullFilename).endsWith(".dng", Qt::CaseInsensitive);
-        if (isCR3)
+        if (info.isCR3)
         {
             cout << "processImage this is a CR3!" << endl;
         }
@@ -145,10 +196,10 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
             }
 
             //get dimensions
-            raw_width  = RSIZE.width;
-            raw_height = RSIZE.height;
-            cout << "raw width:  " << raw_width << endl;
-            cout << "raw height: " << raw_height << endl;
+            info.raw_width  = RSIZE.width;
+            info.raw_height = RSIZE.height;
+            cout << "raw width:  " << info.raw_width << endl;
+            cout << "raw height: " << info.raw_height << endl;
 
             int topmargin = RSIZE.top_margin;
             int leftmargin = RSIZE.left_margin;
@@ -161,7 +212,7 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                 //cout << "camToRGB: ";
                 for (int j = 0; j < 3; j++)
                 {
-                    camToRGB[i][j] = libraw->imgdata.color.rgb_cam[i][j];
+                    info.camToRGB[i][j] = libraw->imgdata.color.rgb_cam[i][j];
                     //cout << camToRGB[i][j] << " ";
                 }
                 //cout << endl;
@@ -171,35 +222,35 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                 //cout << "camToRGB4: ";
                 for (int j = 0; j < 4; j++)
                 {
-                    camToRGB4[i][j] = libraw->imgdata.color.rgb_cam[i][j];
+                    info.camToRGB4[i][j] = libraw->imgdata.color.rgb_cam[i][j];
                     if (i==j)
                     {
-                        camToRGB4[i][j] = 1;
+                        info.camToRGB4[i][j] = 1;
                     } else {
-                        camToRGB4[i][j] = 0;
+                        info.camToRGB4[i][j] = 0;
                     }
                     if (j==3)
                     {
-                        camToRGB4[i][j] = camToRGB4[i][1];
+                        info.camToRGB4[i][j] = info.camToRGB4[i][1];
                     }
                     //cout << camToRGB4[i][j] << " ";
                 }
                 //cout << endl;
             }
-            rCamMul = libraw->imgdata.color.cam_mul[0];
-            gCamMul = libraw->imgdata.color.cam_mul[1];
-            bCamMul = libraw->imgdata.color.cam_mul[2];
-            float minMult = min(min(rCamMul, gCamMul), bCamMul);
-            rCamMul /= minMult;
-            gCamMul /= minMult;
-            bCamMul /= minMult;
-            rPreMul = libraw->imgdata.color.pre_mul[0];
-            gPreMul = libraw->imgdata.color.pre_mul[1];
-            bPreMul = libraw->imgdata.color.pre_mul[2];
-            minMult = min(min(rPreMul, gPreMul), bPreMul);
-            rPreMul /= minMult;
-            gPreMul /= minMult;
-            bPreMul /= minMult;
+            info.rCamMul = libraw->imgdata.color.cam_mul[0];
+            info.gCamMul = libraw->imgdata.color.cam_mul[1];
+            info.bCamMul = libraw->imgdata.color.cam_mul[2];
+            float minMult = min(min(info.rCamMul, info.gCamMul), info.bCamMul);
+            info.rCamMul /= minMult;
+            info.gCamMul /= minMult;
+            info.bCamMul /= minMult;
+            info.rPreMul = libraw->imgdata.color.pre_mul[0];
+            info.gPreMul = libraw->imgdata.color.pre_mul[1];
+            info.bPreMul = libraw->imgdata.color.pre_mul[2];
+            minMult = min(min(info.rPreMul, info.gPreMul), info.bPreMul);
+            info.rPreMul /= minMult;
+            info.gPreMul /= minMult;
+            info.bPreMul /= minMult;
 
             //get black subtraction values
             //for everything
@@ -264,11 +315,11 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
 
             if (camconstStatus == CAMCONST_READ_OK && !isDNG) //dngs provide their own correct whitepoint
             {
-                maxValue = whiteClippingPoint - blackpoint - maxBlockBlackpoint;
+                info.maxValue = whiteClippingPoint - blackpoint - maxBlockBlackpoint;
             } else {
-                maxValue = libraw->imgdata.color.maximum - blackpoint - maxBlockBlackpoint;
+                info.maxValue = libraw->imgdata.color.maximum - blackpoint - maxBlockBlackpoint;
             }
-            cout << "black-subtracted maximum: " << maxValue << endl;
+            cout << "black-subtracted maximum: " << info.maxValue << endl;
             cout << "fmaximum: " << libraw->imgdata.color.fmaximum << endl;
             cout << "fnorm: " << libraw->imgdata.color.fnorm << endl;
 
@@ -280,10 +331,10 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                 //cout << "bayer: ";
                 for (unsigned int j=0; j<2; j++)
                 {
-                    cfa[i][j] = unsigned(libraw->COLOR(int(i), int(j)));
-                    if (cfa[i][j] == 3) //Auto CA correct doesn't like 0123 for RGBG; we change it to 0121.
+                    info.cfa[i][j] = unsigned(libraw->COLOR(int(i), int(j)));
+                    if (info.cfa[i][j] == 3) //Auto CA correct doesn't like 0123 for RGBG; we change it to 0121.
                     {
-                        cfa[i][j] = 1;
+                        info.cfa[i][j] = 1;
                     }
                     //cout << cfa[i][j];
                 }
@@ -291,26 +342,26 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
             }
 
             //get xtrans color filter array
-            maxXtrans = 0;
+            info.maxXtrans = 0;
             for (int i=0; i<6; i++)
             {
                 //cout << "xtrans: ";
                 for (int j=0; j<6; j++)
                 {
-                    xtrans[i][j] = uint(libraw->imgdata.idata.xtrans[i][j]);
-                    maxXtrans = max(maxXtrans,int(libraw->imgdata.idata.xtrans[i][j]));
+                    info.xtrans[i][j] = uint(libraw->imgdata.idata.xtrans[i][j]);
+                    info.maxXtrans = max(info.maxXtrans,int(libraw->imgdata.idata.xtrans[i][j]));
                     //cout << xtrans[i][j];
                 }
                 //cout << endl;
             }
 
-            if (!isCR3)//we can't use exiv2 on CR3 yet
+            if (!info.isCR3)//we can't use exiv2 on CR3 yet
             {
                 cout << "processImage exiv filename: " << loadParam.fullFilename << endl;
                 auto image = Exiv2::ImageFactory::open(loadParam.fullFilename);
                 assert(image.get() != 0);
                 image->readMetadata();
-                exifData = image->exifData();
+                info.exifData = image->exifData();
             } else {
                 //We need to fabricate fresh exif data from what libraw gives us
                 Exiv2::ExifData basicExifData;
@@ -328,45 +379,45 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                 basicExifData["Exif.Photo.ISOSpeed"] = int(round(OTHER.iso_speed));
                 basicExifData["Exif.Photo.FocalLength"] = rationalAvFL(OTHER.focal_len);
 
-                exifData = basicExifData;
+                info.exifData = basicExifData;
             }
 
-            raw_image.set_size(raw_height, raw_width);
+            raw_image.set_size(info.raw_height, info.raw_width);
 
             //copy raw data
             float rawMin = std::numeric_limits<float>::max();
             float rawMax = std::numeric_limits<float>::min();
 
-            isSraw = libraw->is_sraw();
+            info.isSraw = libraw->is_sraw();
 
             //Iridient X-Transformer creates full-color files that aren't sraw
             //They have 6666 as the cfa and all 0 for xtrans
             //However, Leica M Monochrom files are exactly the same!
             //So we have to check if the white balance tag exists.
-            bool isWeird = (cfa[0][0]==6 && cfa[0][1]==6 && cfa[1][0]==6 && cfa[1][1]==6);
+            bool isWeird = (info.cfa[0][0]==6 && info.cfa[0][1]==6 && info.cfa[1][0]==6 && info.cfa[1][1]==6);
             //cout << "is weird: " << isWeird << endl;
             bool noWB = false;
-            if (!isCR3)//we can't use exiv2 on CR3 yet and no CR3 cameras are monochrome
+            if (!info.isCR3)//we can't use exiv2 on CR3 yet and no CR3 cameras are monochrome
             {
-                noWB = exifData["Exif.Photo.WhiteBalance"].toString().length()==0;
+                noWB = info.exifData["Exif.Photo.WhiteBalance"].toString().length()==0;
             }
             //cout << "white balance: " << wb << endl;
-            isMonochrome = isWeird && noWB;
+            info.isMonochrome = isWeird && noWB;
             //cout << "is monochrome: " << isMonochrome << endl;
-            isSraw = isSraw || (isWeird && !isMonochrome);
+            info.isSraw = info.isSraw || (isWeird && !info.isMonochrome);
             //cout << "is full color raw: " << isSraw << endl;
 
 
-            isNikonSraw = libraw->is_nikon_sraw();
-            if (isSraw)
+            info.isNikonSraw = libraw->is_nikon_sraw();
+            if (info.isSraw)
             {
-                raw_image.set_size(raw_height, raw_width*3);
+                raw_image.set_size(info.raw_height, info.raw_width*3);
                 #pragma omp parallel for reduction (min:rawMin) reduction(max:rawMax)
-                for (int row = 0; row < raw_height; row++)
+                for (int row = 0; row < info.raw_height; row++)
                 {
                     //IMAGE is an (width*height) by 4 array, not width by height by 4.
                     int rowoffset = (row + topmargin)*full_width;
-                    for (int col = 0; col < raw_width; col++)
+                    for (int col = 0; col < info.raw_width; col++)
                     {
                         float tempBlackpoint = blackpoint;
                         if (blackRow > 0 && blackCol > 0)
@@ -387,11 +438,11 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                 }
             } else if (libraw->is_floating_point()){//we can't even get here until libraw supports floating point raw
                 #pragma omp parallel for reduction (min:rawMin) reduction(max:rawMax)
-                for (int row = 0; row < raw_height; row++)
+                for (int row = 0; row < info.raw_height; row++)
                 {
                     //IMAGE is an (width*height) by 4 array, not width by height by 4.
                     int rowoffset = (row + topmargin)*full_width;
-                    for (int col = 0; col < raw_width; col++)
+                    for (int col = 0; col < info.raw_width; col++)
                     {
                         float tempBlackpoint = blackpoint;
                         if (blackRow > 0 && blackCol > 0)
@@ -405,11 +456,11 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                 }
             } else {
                 #pragma omp parallel for reduction (min:rawMin) reduction(max:rawMax)
-                for (int row = 0; row < raw_height; row++)
+                for (int row = 0; row < info.raw_height; row++)
                 {
                     //IMAGE is an (width*height) by 4 array, not width by height by 4.
                     int rowoffset = (row + topmargin)*full_width;
-                    for (int col = 0; col < raw_width; col++)
+                    for (int col = 0; col < info.raw_width; col++)
                     {
                         float tempBlackpoint = blackpoint;
                         if (blackRow > 0 && blackCol > 0)
@@ -424,9 +475,13 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
             }
 
             //generate raw histogram
+            //Demosaicing may fill in info again, so the histogram gets its own copy.
             if (WithHisto == histo)
             {
-                histoInterface->updateHistRaw(raw_image, maxValue, cfa, xtrans, maxXtrans, isSraw, isMonochrome);
+                runAside([this, rawInfo = info]() mutable
+                {
+                    histoInterface->updateHistRaw(raw_image, rawInfo.maxValue, rawInfo.cfa, rawInfo.xtrans, rawInfo.maxXtrans, rawInfo.isSraw, rawInfo.isMonochrome);
+                });
             }
 
             cout << "max of raw_image: " << rawMax << endl;
@@ -434,11 +489,13 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
         }
         valid = paramManager->markLoadComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::load);
         [[fallthrough]];
     }
     case partdemosaic: [[fallthrough]];
     case load://Do demosaic, or load non-raw images
     {
+        BufferTagScope bufferScope(name, "demosaic");
         AbortStatus abort;
         std::tie(valid, abort, loadParam, demosaicParam) = paramManager->claimDemosaicParams();
         if (abort == AbortStatus::restart)
@@ -447,570 +504,153 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
             return emptyMatrix();
         }
 
-        cout << "imagePipeline.cpp: Opening " << loadParam.fullFilename << endl;
-
-        //Reads in the photo.
-        cout << "load start:" << timeDiff (timeRequested) << endl;
-        struct timeval imload_time;
-        gettimeofday( &imload_time, nullptr );
-
-        matrix<float>& scaled_image = recovered_image;
-        if ((HighQuality == quality) && stealData)//only full pipelines may steal data
-        {
-            scaled_image = stealVictim->input_image;
-            exifData = stealVictim->exifData;
-            rCamMul = stealVictim->rCamMul;
-            gCamMul = stealVictim->gCamMul;
-            bCamMul = stealVictim->bCamMul;
-            rPreMul = stealVictim->rPreMul;
-            gPreMul = stealVictim->gPreMul;
-            bPreMul = stealVictim->bPreMul;
-            maxValue = stealVictim->maxValue;
-            isSraw = stealVictim->isSraw;
-            isNikonSraw = stealVictim->isNikonSraw;
-            isMonochrome = stealVictim->isMonochrome;
-            isCR3 = stealVictim->isCR3;
-            raw_width = stealVictim->raw_width;
-            raw_height = stealVictim->raw_height;
-            //copy color matrix
-            //get color matrix
-            for (int i = 0; i < 3; i++)
-            {
-                for (int j = 0; j < 3; j++)
-                {
-                    camToRGB[i][j] = stealVictim->camToRGB[i][j];
-                }
-            }
-            for (int i = 0; i < 3; i++)
-            {
-                for (int j = 0; j < 4; j++)
-                {
-                    camToRGB4[i][j] = stealVictim->camToRGB4[i][j];
-                }
-            }
-        }
-        else if (loadParam.tiffIn)
-        {
-            if (imread_tiff(loadParam.fullFilename, input_image, exifData))
-            {
-                cerr << "Could not open image " << loadParam.fullFilename << "; Exiting..." << endl;
-                return emptyMatrix();
-            }
-        }
-        else if (loadParam.jpegIn)
-        {
-            if (imread_jpeg(loadParam.fullFilename, input_image, exifData))
-            {
-                cerr << "Could not open image " << loadParam.fullFilename << "; Exiting..." << endl;
-                return emptyMatrix();
-            }
-        }
-        else if (isSraw)//already demosaiced
-        {
-            //We just need to scale to 65535, and apply camera WB
-            float inputscale = maxValue;
-            float outputscale = 65535.0;
-            float scaleFactor = outputscale / inputscale;
-            input_image.set_size(raw_height, raw_width*3);
-            if (isNikonSraw)
-            {
-                #pragma omp parallel for
-                for (int row = 0; row < raw_height; row++)
-                {
-                    for (int col = 0; col < raw_width*3; col++)
-                    {
-                        int color = col % 3;
-                        input_image(row, col) = raw_image(row, col) * scaleFactor;
-
-                    }
-                }
-            }
-            else
-            {
-                #pragma omp parallel for
-                for (int row = 0; row < raw_height; row++)
-                {
-                    for (int col = 0; col < raw_width*3; col++)
-                    {
-                        int color = col % 3;
-                        input_image(row, col) = raw_image(row, col) * scaleFactor * ((color==0) ? rCamMul : (color == 1) ? gCamMul : bCamMul);
+        const std::string source = loadParam.sourceHash.empty() ? loadParam.fullFilename : loadParam.sourceHash;
 
-                    }
-                }
-            }
-        }
-        else //raw
+        //When stealing, the victim did the loading, and its decoded image has the metadata.
+        const bool stolen = (HighQuality == quality) && stealData;//only full pipelines may steal data
+        if (stolen)
         {
-            matrix<float>   red(raw_height, raw_width);
-            matrix<float> green(raw_height, raw_width);
-            matrix<float>  blue(raw_height, raw_width);
-
-            double initialGain = 1.0;
-            float inputscale = maxValue;
-            float outputscale = 65535.0;
-            const int border = 4;//used for amaze
-            std::function<bool(double)> setProg = [](double) -> bool {return false;};
-
-            cout << "raw width:  " << raw_width << endl;
-            cout << "raw height: " << raw_height << endl;
-
-            //before demosaic, you want to apply raw white balance
-            //======================================================================
-            //TODO: If the camera white balance disagrees with some sort of AWB by a *lot*, use an awb instead
-            //======================================================================
-            matrix<float> premultiplied(raw_height, raw_width);
-
-            cout << "demosaic start" << timeDiff(timeRequested) << endl;
-            struct timeval demosaic_time;
-            gettimeofday(&demosaic_time, nullptr);
-
-            if (maxXtrans > 0)
+            //The victim may be rendering on another thread.
+            QMutexLocker victimLocker(&stealVictim->cacheMutex);
+            decoded = stealVictim->decoded;
+            //Another photo's pixels must never be shown as this one.
+            if (decoded && decoded->info.source != source)
             {
-                #pragma omp parallel for
-                for (int row = 0; row < raw_height; row++)
-                {
-                    for (int col = 0; col < raw_width; col++)
-                    {
-                        uint color = xtrans[uint(row) % 6][uint(col) % 6];
-                        premultiplied(row, col) = raw_image(row, col) * ((color==0) ? rCamMul : (color == 1) ? gCamMul : bCamMul);
-                    }
-                }
-                markesteijn_demosaic(raw_width, raw_height, premultiplied, red, green, blue, xtrans, camToRGB4, setProg, 3, true);
-                //there's no inputscale for markesteijn so we need to scale
-                float scaleFactor = outputscale / inputscale;
-                #pragma omp parallel for
-                for (int row = 0; row < red.nr(); row++)
-                {
-                    for (int col = 0; col < red.nc(); col++)
-                    {
-                        red(row, col)   = red(row, col)   * scaleFactor;
-                        green(row, col) = green(row, col) * scaleFactor;
-                        blue(row, col)  = blue(row, col)  * scaleFactor;
-                    }
-                }
+                cout << "ImagePipeline::processImage: the stolen image is of another photo" << endl;
+                decoded.reset();
             }
-            else if (isMonochrome)
+            //Without pixels we may still find the result in the cache, as long as the victim
+            // has loaded this photo's metadata.
+            if (decoded)
             {
-                float scaleFactor = outputscale / inputscale;
-                for (int row = 0; row < raw_height; row++)
-                {
-                    for (int col = 0; col < raw_width; col++)
-                    {
-                        red(row, col)   = raw_image(row, col) * scaleFactor;
-                        green(row, col) = raw_image(row, col) * scaleFactor;
-                        blue(row, col)  = raw_image(row, col) * scaleFactor;
-                    }
-                }
+                info = decoded->info;
             }
-            else
+            else if (stealVictim->info.source == source)
             {
-                #pragma omp parallel for
-                for (int row = 0; row < raw_height; row++)
-                {
-                    for (int col = 0; col < raw_width; col++)
-                    {
-                        uint color = cfa[uint(row) & 1][uint(col) & 1];
-                        premultiplied(row, col) = raw_image(row, col) * ((color==0) ? rCamMul : (color == 1) ? gCamMul : bCamMul);
-                    }
-                }
-                if (demosaicParam.caEnabled > 0)
-                {
-                    //we need to apply white balance and then remove it for Auto CA Correct to work properly
-                    double fitparams[2][2][16];
-                    CA_correct(0, 0, raw_width, raw_height, true, demosaicParam.caEnabled, 0.0, 0.0, true, premultiplied, premultiplied, cfa, setProg, fitparams, false);
-                }
-                amaze_demosaic(raw_width, raw_height, 0, 0, raw_width, raw_height, premultiplied, red, green, blue, cfa, setProg, initialGain, border, inputscale, outputscale);
-                //matrix<float> normalized_image(raw_height, raw_width);
-                //normalized_image = premultiplied * (outputscale/inputscale);
-                //lmmse_demosaic(raw_width, raw_height, normalized_image, red, green, blue, cfa, setProg, 3);//needs inputscale and output scale to be implemented
+                info = stealVictim->info;
             }
-            premultiplied.set_size(0, 0);
-            cout << "demosaic end: " << timeDiff(demosaic_time) << endl;
-
-            input_image.set_size(raw_height, raw_width*3);
-            #pragma omp parallel for
-            for (int row = 0; row < raw_height; row++)
+            else
             {
-                for (int col = 0; col < raw_width; col++)
-                {
-                    input_image(row, col*3    ) =   red(row, col);
-                    input_image(row, col*3 + 1) = green(row, col);
-                    input_image(row, col*3 + 2) =  blue(row, col);
-                }
+                cout << "ImagePipeline::processImage: nothing loaded to steal" << endl;
+                return emptyMatrix();
             }
         }
-        cout << "load time: " << timeDiff(imload_time) << endl;
-
-        cout << "ImagePipeline::processImage: Demosaic complete." << endl;
-
 
-        if (LowQuality == quality)
+        //The key covers everything the demosaiced image depends on.
+        //Earlier results for this image may still be held in memory, or if it was edited in
+        // an earlier session, on disk. The disk cache only takes raws, since non-raw images
+        // get their exif read during this stage.
+        if (source != historySource)
         {
-            cout << "scale start:" << timeDiff (timeRequested) << endl;
-            struct timeval downscale_time;
-            gettimeofday( &downscale_time, nullptr );
-            downscale_and_crop(input_image,scaled_image, 0, 0, (input_image.nc()/3)-1,input_image.nr()-1, 600, 600);
-            cout << "scale end: " << timeDiff( downscale_time ) << endl;
+            stageHistory.clear();
+            QMutexLocker speculationLocker(&speculationMutex);
+            speculated.clear();
+            historySource = source;
         }
-        else if (PreviewQuality == quality)
-        {
-            cout << "scale start:" << timeDiff (timeRequested) << endl;
-            struct timeval downscale_time;
-            gettimeofday( &downscale_time, nullptr );
-            downscale_and_crop(input_image,scaled_image, 0, 0, (input_image.nc()/3)-1,input_image.nr()-1, resolution, resolution);
-            cout << "scale end: " << timeDiff( downscale_time ) << endl;
-        }
-        else
-        {
-            if (!stealData) //If we had to compute the input image ourselves
-            {
-                scaled_image = input_image;
-                input_image.set_size(0,0);
-            }
-        }
-
-        //Recover highlights now
-        cout << "hlrecovery start:" << timeDiff (timeRequested) << endl;
-        struct timeval hlrecovery_time;
-        gettimeofday(&hlrecovery_time, nullptr);
-
-        int height = scaled_image.nr();
-        int width  = scaled_image.nc()/3;
-
-        //Now, recover highlights.
-        std::function<bool(double)> setProg = [](double) -> bool {return false;};
-        //And return it back to a single layer
-        if (demosaicParam.highlights >= 2)
+        auto demosaicKeyFor = [&](const QuickQuality keyQuality, const int keyResolution)
         {
-            recovered_image.set_size(height, width*3);
-            //For highlight recovery, we need to split up the image into three separate layers.
-            matrix<float> rChannel(height, width), gChannel(height, width), bChannel(height, width);
-
-            #pragma omp parallel for
-            for (int row = 0; row < height; row++)
-            {
-                for (int col = 0; col < width; col++)
-                {
-                    rChannel(row, col) = scaled_image(row, col*3    );
-                    gChannel(row, col) = scaled_image(row, col*3 + 1);
-                    bChannel(row, col) = scaled_image(row, col*3 + 2);
-                }
-            }
-
-            //We applied the camMul camera multipliers before applying white balance.
-            //Now we need to calculate the channel max and the raw clip levels.
-            //Channel max:
-            const float chmax[3] = {rChannel.max(), gChannel.max(), bChannel.max()};
-            //Max clip point:
-            const float clmax[3] = {65535.0f*rCamMul, 65535.0f*gCamMul, 65535.0f*bCamMul};
-
-            HLRecovery_inpaint(width, height, rChannel, gChannel, bChannel, chmax, clmax, setProg);
-            #pragma omp parallel for
-            for (int row = 0; row < height; row++)
-            {
-                for (int col = 0; col < width; col++)
-                {
-                    recovered_image(row, col*3    ) = rChannel(row, col);
-                    recovered_image(row, col*3 + 1) = gChannel(row, col);
-                    recovered_image(row, col*3 + 2) = bChannel(row, col);
-                }
-            }
-        } else if (demosaicParam.highlights == 0)
+            return StageKey("demosaic")
+                    .add(STAGE_CACHE_VERSION)
+                    .add(source)
+                    .add(int(keyQuality))
+                    .add(keyResolution)
+                    .add(demosaicParam.caEnabled)
+                    .add(demosaicParam.highlights)
+                    .add(demosaicParam.cameraName.toStdString())
+                    .add(demosaicParam.lensName.toStdString())
+                    .add(demosaicParam.lensfunCA)
+                    .add(demosaicParam.lensfunVignetting)
+                    .add(demosaicParam.lensfunDistortion)
+                    .add(demosaicParam.focalLength)
+                    .add(demosaicParam.fnumber)
+                    .add(demosaicParam.rotationAngle).str();
+        };
+        const std::string key = demosaicKeyFor(quality, PreviewQuality == quality ? resolution : 0);
+        //The full pipeline starts from the quick pipeline's decoded image, so the quick
+        // pipeline can't take an old result while its decoded image is for other settings.
+        const std::string decodeKey = StageKey("decode")
+                .add(source)
+                .add(demosaicParam.caEnabled).str();
+        const bool decodedCurrent = decoded && decoded->key == decodeKey;
+        const bool cacheableSource = diskCache && !loadParam.sourceHash.empty() &&
+                !loadParam.tiffIn && !loadParam.jpegIn;
+        diskCacheable = cacheableSource && (HighQuality == quality);
+
+        //Start from the deepest result we can find: our own history, then what the full
+        // pipeline filed on disk, and only then the raw data.
+        bool found = recallStage(Valid::demosaic, demosaicKey, (stolen || decodedCurrent) ? key : std::string(), recovered_image) ||
+                (diskCacheable && StageCache::load(key, recovered_image));
+        if (!found && cacheableSource && (PreviewQuality == quality))
         {
-            recovered_image.set_size(height, width*3);
-            #pragma omp parallel for
-            for (int row = 0; row < height; row++)
+            //Previews are too many sizes to file, but one can be shrunk from the full-size entry.
+            matrix<float> full;
+            if (StageCache::load(demosaicKeyFor(HighQuality, 0), full))
             {
-                for (int col = 0; col < width; col++)
+                downscale_and_crop(full, recovered_image, 0, 0, (full.nc()/3)-1, full.nr()-1, resolution, resolution);
+                //The full pipeline finds the same entry, so an old decoded image is only a liability.
+                if (!decodedCurrent)
                 {
-                    recovered_image(row, col*3    ) = min(scaled_image(row, col*3    ), 65535.0f);
-                    recovered_image(row, col*3 + 1) = min(scaled_image(row, col*3 + 1), 65535.0f);
-                    recovered_image(row, col*3 + 2) = min(scaled_image(row, col*3 + 2), 65535.0f);
+                    decoded.reset();
                 }
+                found = true;
             }
-        } else {
-            recovered_image = std::move(scaled_image);
-        }
-
-        //Lensfun processing
-        cout << "lensfun start" << endl;
-        lfDatabase *ldb = lf_db_create();
-        QDir dir = QDir::home();
-        QString dirstr = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-        dirstr.append("/filmulator/version_2");
-        std::string stdstring = dirstr.toStdString();
-        ldb->Load(stdstring.c_str());
-
-        std::string camName = demosaicParam.cameraName.toStdString();
-        const lfCamera * camera = NULL;
-        const lfCamera ** cameraList = ldb->FindCamerasExt(NULL,camName.c_str());
-
-        //Set up stuff for rotation.
-        //We expect rotation to be from -45 to +45
-        //But -50 will be the signal from the UI to disable it.
-        float rotationAngle = demosaicParam.rotationAngle * 3.1415926535/180;//convert degrees to radians
-        if (demosaicParam.rotationAngle <= -49) {
-            rotationAngle = 0;
         }
-        cout << "cos rotationangle: " << cos(rotationAngle) << endl;
-        cout << "sin rotationangle: " << sin(rotationAngle) << endl;
-        bool lensfunGeometryCorrectionApplied = false;
-
-        if (cameraList)
+        //A stolen image made with another CA setting means the quick pipeline hasn't caught
+        // up yet. What we make from it is shown, but never filed under this key.
+        bool stolenStale = false;
+        if (!found)
         {
-            const float cropFactor = cameraList[0]->CropFactor;
-
-            QString tempLensName = demosaicParam.lensName;
-            if (tempLensName.length() > 0)
+            if (stolen && !decoded)
             {
-                if (tempLensName.front() == "\\")
-                {
-                    //if the lens name starts with a backslash, don't filter by camera
-                    tempLensName.remove(0,1);
-                } else {
-                    //if it doesn't start with a backslash, filter by camera
-                    camera = cameraList[0];
-                }
+                cout << "ImagePipeline::processImage: nothing decoded to steal" << endl;
+                return emptyMatrix();
             }
-            std::string lensName = tempLensName.toStdString();
-            const lfLens * lens = NULL;
-            const lfLens ** lensList = NULL;
-            lensList = ldb->FindLenses(camera, NULL, lensName.c_str());
-            if (lensList)
+            stolenStale = stolen && !decodedCurrent;
+            if (stolenStale)
             {
-                lens = lensList[0];
-
-                //Now we set up the modifier itself with the lens and processing flags
-#ifdef LF_GIT
-                lfModifier * mod = new lfModifier(lens, demosaicParam.focalLength, cropFactor, width, height, LF_PF_F32);
-#else //lensfun v0.3.95
-                lfModifier * mod = new lfModifier(cropFactor, width, height, LF_PF_F32);
-#endif
-
-                int modflags = 0;
-                if (demosaicParam.lensfunCA && !isMonochrome)
-                {
-#ifdef LF_GIT
-                    modflags |= mod->EnableTCACorrection();
-#else //lensfun v0.3.95
-                    modflags |= mod->EnableTCACorrection(lens, demosaicParam.focalLength);
-#endif
-                }
-                if (demosaicParam.lensfunVignetting)
-                {
-#ifdef LF_GIT
-                    modflags |= mod->EnableVignettingCorrection(demosaicParam.fnumber, 1000.0f);
-#else //lensfun v0.3.95
-                    modflags |= mod->EnableVignettingCorrection(lens, demosaicParam.focalLength, demosaicParam.fnumber, 1000.0f);
-#endif
-                }
-                if (demosaicParam.lensfunDistortion)
-                {
-#ifdef LF_GIT
-                    modflags |= mod->EnableDistortionCorrection();
-#else //lensfun v0.3.95
-                    modflags |= mod->EnableDistortionCorrection(lens, demosaicParam.focalLength);
-#endif
-                    modflags |= mod->EnableScaling(mod->GetAutoScale(false));
-                    cout << "Auto scale factor: " << mod->GetAutoScale(false) << endl;
-                }
-
-                //Now we actually perform the required processing.
-                //First is vignetting.
-                if (demosaicParam.lensfunVignetting)
-                {
-                    bool success = true;
-                    #pragma omp parallel for
-                    for (int row = 0; row < height; row++)
-                    {
-                        success = mod->ApplyColorModification(recovered_image[row], 0.0f, row, width, 1, LF_CR_3(RED, GREEN, BLUE), width);
-                    }
-                }
-
-                //Next is CA, or distortion, or both.
-                matrix<float> new_image;
-                new_image.set_size(height, width*3);
-
-                if (demosaicParam.lensfunCA || demosaicParam.lensfunDistortion)
-                {
-                    //ApplySubpixelGeometryDistortion
-                    lensfunGeometryCorrectionApplied = true;
-                    bool success = true;
-                    int listWidth = width * 2 * 3;
-
-                    //Check how far out of bounds we go
-                    float maxOvershootDistance = 1.0f;
-                    float semiwidth = (width-1)/2.0f;
-                    float semiheight = (height-1)/2.0f;
-                    #pragma omp parallel for reduction(max:maxOvershootDistance)
-                    for (int row = 0; row < height; row++)
-                    {
-                        float positionList[listWidth];
-                        success = mod->ApplySubpixelGeometryDistortion(0.0f, row, width, 1, positionList);
-                        if (success)
-                        {
-                            for (int col = 0; col < width; col++)
-                            {
-                                int listIndex = col * 2 * 3; //list index
-                                for (int c = 0; c < 3; c++)
-                                {
-                                    float coordX = positionList[listIndex+2*c] - semiwidth;
-                                    float coordY = positionList[listIndex+2*c+1] - semiheight;
-                                    float rotatedX = coordX * cos(rotationAngle) - coordY * sin(rotationAngle);
-                                    float rotatedY = coordX * sin(rotationAngle) + coordY * cos(rotationAngle);
-
-                                    float overshoot = 1.0f;
-
-                                    if (abs(rotatedX) > semiwidth)
-                                    {
-                                        overshoot = max(abs(rotatedX)/semiwidth,overshoot);
-                                    }
-                                    if (abs(rotatedY) > semiheight)
-                                    {
-                                        overshoot = max(abs(rotatedY)/semiheight,overshoot);
-                                    }
-
-                                    if (overshoot > maxOvershootDistance)
-                                    {
-                                        maxOvershootDistance = overshoot;
-                                    }
-                                }
-                            }
-                        }
-                    }
-
-                    #pragma omp parallel for
-                    for (int row = 0; row < height; row++)
-                    {
-                        float positionList[listWidth];
-                        success = mod->ApplySubpixelGeometryDistortion(0.0f, row, width, 1, positionList);
-                        if (success)
-                        {
-                            for (int col = 0; col < width; col++)
-                            {
-                                int listIndex = col * 2 * 3; //list index
-                                for (int c = 0; c < 3; c++)
-                                {
-                                    float coordX = positionList[listIndex+2*c] - semiwidth;
-                                    float coordY = positionList[listIndex+2*c+1] - semiheight;
-                                    float rotatedX = (coordX * cos(rotationAngle) - coordY * sin(rotationAngle)) / maxOvershootDistance + semiwidth;
-                                    float rotatedY = (coordX * sin(rotationAngle) + coordY * cos(rotationAngle)) / maxOvershootDistance + semiheight;
-                                    int sX = max(0, min(width-1,  int(floor(rotatedX))))*3 + c;//startX
-                                    int eX = max(0, min(width-1,  int(ceil(rotatedX))))*3 + c; //endX
-                                    int sY = max(0, min(height-1, int(floor(rotatedY))));      //startY
-                                    int eY = max(0, min(height-1, int(ceil(rotatedY))));       //endY
-                                    float notUsed;
-                                    float eWX = modf(rotatedX, &notUsed); //end weight X
-                                    float eWY = modf(rotatedY, &notUsed); //end weight Y;
-                                    float sWX = 1 - eWX;                //start weight X
-                                    float sWY = 1 - eWY;                //start weight Y;
-                                    new_image(row, col*3 + c) = recovered_image(sY, sX) * sWY * sWX +
-                                                                recovered_image(eY, sX) * eWY * sWX +
-                                                                recovered_image(sY, eX) * sWY * eWX +
-                                                                recovered_image(eY, eX) * eWY * eWX;
-                                }
-                            }
-                        }
-                    }
-                    recovered_image = std::move(new_image);
-                }
-
-                if (mod != NULL)
-                {
-                    delete mod;
-                }
+                cout << "ImagePipeline::processImage: the stolen image was decoded with other settings" << endl;
+                diskCacheable = false;
             }
-            lf_free(lensList);
-        }
-        lf_free(cameraList);
-
-        //cleanup lensfun
-        if (ldb != NULL)
-        {
-            lf_db_destroy(ldb);
-        }
-
-        if (!lensfunGeometryCorrectionApplied)
-        {
-            //also do rotations on non-corrected images
-            float maxOvershootDistance = 1.0f;
-            float semiwidth = (width-1)/2.0f;
-            float semiheight = (height-1)/2.0f;
-
-            //check the four corners
-            for (int row = 0; row < height; row += height-1)
+            if (!demosaicImage(loadParam, demosaicParam, decodeKey) || cancel.cancelled())
             {
-                for (int col = 0; col < width; col += width-1)
-                {
-                    float coordX = col - semiwidth;
-                    float coordY = row - semiheight;
-                    float rotatedX = coordX * cos(rotationAngle) - coordY * sin(rotationAngle);
-                    float rotatedY = coordX * sin(rotationAngle) + coordY * cos(rotationAngle);
-
-                    float overshoot = 1.0f;
-
-                    if (abs(rotatedX) > semiwidth)
-                    {
-                        overshoot = max(abs(rotatedX)/semiwidth,overshoot);
-                    }
-                    if (abs(rotatedY) > semiheight)
-                    {
-                        overshoot = max(abs(rotatedY)/semiheight,overshoot);
-                    }
-
-                    if (overshoot > maxOvershootDistance)
-                    {
-                        maxOvershootDistance = overshoot;
-                    }
-                }
+                return emptyMatrix();
             }
-
-            //Apply the rotation
-            matrix<float> new_image;
-            new_image.set_size(height, width*3);
-
-            for (int row = 0; row < height; row++)
+            if (diskCacheable)
             {
-                for (int col = 0; col < width; col++)
+                //The cache copies the image, which can overlap the stages after this one.
+                runAside([this, key]()
                 {
-                    float coordX = col - semiwidth;
-                    float coordY = row - semiheight;
-                    float rotatedX = (coordX * cos(rotationAngle) - coordY * sin(rotationAngle)) / maxOvershootDistance + semiwidth;
-                    float rotatedY = (coordX * sin(rotationAngle) + coordY * cos(rotationAngle)) / maxOvershootDistance + semiheight;
-                    int sX = max(0, min(width-1,  int(floor(rotatedX))))*3;//startX
-                    int eX = max(0, min(width-1,  int(ceil(rotatedX))))*3; //endX
-                    int sY = max(0, min(height-1, int(floor(rotatedY))));  //startY
-                    int eY = max(0, min(height-1, int(ceil(rotatedY))));   //endY
-                    float notUsed;
-                    float eWX = modf(rotatedX, &notUsed); //end weight X
-                    float eWY = modf(rotatedY, &notUsed); //end weight Y;
-                    float sWX = 1 - eWX;                //start weight X
-                    float sWY = 1 - eWY;                //start weight Y;
-                    for (int c = 0; c < 3; c++)
-                    {
-                        new_image(row, col*3 + c) = recovered_image(sY, sX + c) * sWY * sWX +
-                                                    recovered_image(eY, sX + c) * eWY * sWX +
-                                                    recovered_image(sY, eX + c) * sWY * eWX +
-                                                    recovered_image(eY, eX + c) * eWY * eWX;
-                    }
-                }
+                    StageCache::store(key, recovered_image);
+                });
             }
-            recovered_image = std::move(new_image);
+        }
+        //An empty key keeps the later stages out of the history and the disk cache too.
+        demosaicKey = stolenStale ? std::string() : key;
+        if (stolen)
+        {
+            decoded.reset();//the victim keeps it for as long as it's current
         }
 
         valid = paramManager->markDemosaicComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::demosaic);
         [[fallthrough]];
     }
     case partprefilmulation: [[fallthrough]];
     case demosaic://Do pre-filmulation work.
     {
+        BufferTagScope bufferScope(name, "prefilmulation");
         AbortStatus abort;
         std::tie(valid, abort, prefilmParam) = paramManager->claimPrefilmParams();
         if (abort == AbortStatus::restart)
         {
             return emptyMatrix();
         }
+        prefilmKey.clear();
+        const std::string key = demosaicKey.empty() ? std::string() : StageKey(demosaicKey)
+                .add(prefilmParam.exposureComp)
+                .add(prefilmParam.temperature)
+                .add(prefilmParam.tint).str();
 
 
         //Here we apply the exposure compensation and white balance and color conversion matrix.
@@ -1018,10 +658,14 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                      pre_film_image,
                      prefilmParam.temperature,
                      prefilmParam.tint,
-                     camToRGB,
-                     rCamMul, gCamMul, bCamMul,//needed as a reference but not actually applied
-                     rPreMul, gPreMul, bPreMul,
+                     info.camToRGB,
+                     info.rCamMul, info.gCamMul, info.bCamMul,//needed as a reference but not actually applied
+                     info.rPreMul, info.gPreMul, info.bPreMul,
                      65535.0f, pow(2, prefilmParam.exposureComp));
+        if (cancel.cancelled())
+        {
+            return emptyMatrix();
+        }
 
         if (NoCache == cache)
         {
@@ -1035,18 +679,24 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
         if (WithHisto == histo)
         {
             //Histogram work
-            histoInterface->updateHistPreFilm(pre_film_image, 65535);
+            runAside([this]()
+            {
+                histoInterface->updateHistPreFilm(pre_film_image, 65535);
+            });
         }
 
+        prefilmKey = key;
         cout << "ImagePipeline::processImage: Prefilmulation complete." << endl;
 
         valid = paramManager->markPrefilmComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::prefilmulation);
         [[fallthrough]];
     }
     case partfilmulation: [[fallthrough]];
     case prefilmulation://Do filmulation
     {
+        BufferTagScope bufferScope(name, "filmulation");
         //We don't need to check abort status out here, because
         //the filmulate function will do so inside its loop.
         //We just check for it returning an empty matrix.
@@ -1073,102 +723,124 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
         if (WithHisto == histo)
         {
             //Histogram work
-            histoInterface->updateHistPostFilm(filmulated_image, .0025f);//TODO connect this magic number to the qml
+            runAside([this]()
+            {
+                histoInterface->updateHistPostFilm(filmulated_image, .0025f);//TODO connect this magic number to the qml
+            });
         }
 
         cout << "ImagePipeline::processImage: Filmulation complete." << endl;
 
         valid = paramManager->markFilmComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::filmulation);
         [[fallthrough]];
     }
-    case partblackwhite: [[fallthrough]];
-    case filmulation://Do whitepoint_blackpoint
+    case partcrop: [[fallthrough]];
+    case filmulation://Do rotation and cropping
     {
+        BufferTagScope bufferScope(name, "crop");
         AbortStatus abort;
-        std::tie(valid, abort, blackWhiteParam) = paramManager->claimBlackWhiteParams();
+        std::tie(valid, abort, cropParam) = paramManager->claimCropParams();
         if (abort == AbortStatus::restart)
         {
             return emptyMatrix();
         }
-        matrix<float> rotated_image;
-
-        rotate_image(filmulated_image,
-                     rotated_image,
-                     blackWhiteParam.rotation);
-
-        if (NoCache == cache)// clean up ram that's not needed anymore in order to reduce peak consumption
-        {
-            filmulated_image.set_size(0, 0);
-            cacheEmpty = true;
-        }
-        else
-        {
-            cacheEmpty = false;
-        }
-
-
-        const int imWidth  = rotated_image.nc()/3;
-        const int imHeight = rotated_image.nr();
+        //We never build the full rotated image; we just need its dimensions for the crop.
+        const bool quarterTurn = (cropParam.rotation == 1) || (cropParam.rotation == 3);
+        const int imWidth  = quarterTurn ? filmulated_image.nr()   : filmulated_image.nc()/3;
+        const int imHeight = quarterTurn ? filmulated_image.nc()/3 : filmulated_image.nr();
 
-        const float tempHeight = imHeight*max(min(1.0f,blackWhiteParam.cropHeight),0.0f);//restrict domain to 0:1
-        const float tempAspect = max(min(10000.0f,blackWhiteParam.cropAspect),0.0001f);//restrict aspect ratio
+        const float tempHeight = imHeight*max(min(1.0f,cropParam.cropHeight),0.0f);//restrict domain to 0:1
+        const float tempAspect = max(min(10000.0f,cropParam.cropAspect),0.0001f);//restrict aspect ratio
         int width  = int(round(min(tempHeight*tempAspect,float(imWidth))));
         int height = int(round(min(tempHeight, imWidth/tempAspect)));
         const float maxHoffset = (1.0f-(float(width)  / float(imWidth) ))/2.0f;
         const float maxVoffset = (1.0f-(float(height) / float(imHeight)))/2.0f;
         const float oddH = (!(int(round((imWidth  - width )/2.0))*2 == (imWidth  - width )))*0.5f;//it's 0.5 if it's odd, 0 otherwise
         const float oddV = (!(int(round((imHeight - height)/2.0))*2 == (imHeight - height)))*0.5f;//it's 0.5 if it's odd, 0 otherwise
-        const float hoffset = (round(max(min(blackWhiteParam.cropHoffset, maxHoffset), -maxHoffset) * imWidth  + oddH) - oddH)/imWidth;
-        const float voffset = (round(max(min(blackWhiteParam.cropVoffset, maxVoffset), -maxVoffset) * imHeight + oddV) - oddV)/imHeight;
+        const float hoffset = (round(max(min(cropParam.cropHoffset, maxHoffset), -maxHoffset) * imWidth  + oddH) - oddH)/imWidth;
+        const float voffset = (round(max(min(cropParam.cropVoffset, maxVoffset), -maxVoffset) * imHeight + oddV) - oddV)/imHeight;
         int startX = int(round(0.5f*(imWidth  - width ) + hoffset*imWidth));
         int startY = int(round(0.5f*(imHeight - height) + voffset*imHeight));
-        int endX = startX + width  - 1;
-        int endY = startY + height - 1;
 
-        if (blackWhiteParam.cropHeight <= 0)//it shall be turned off
+        if (cropParam.cropHeight <= 0)//it shall be turned off
         {
             startX = 0;
             startY = 0;
-            endX = imWidth  - 1;
-            endY = imHeight - 1;
             width  = imWidth;
             height = imHeight;
         }
 
 
-        matrix<float> cropped_image;
         cout << "crop start:" << timeDiff (timeRequested) << endl;
         struct timeval crop_time;
         gettimeofday(&crop_time, nullptr);
 
-        downscale_and_crop(rotated_image,
-                           cropped_image,
-                           startX,
-                           startY,
-                           endX,
-                           endY,
-                           width,
-                           height);
+        //Rotation and crop are fused so that only the cropped region gets written.
+        rotate_and_crop(filmulated_image,
+                        cropped_image,
+                        cropParam.rotation,
+                        startX,
+                        startY,
+                        width,
+                        height);
 
         cout << "crop end: " << timeDiff(crop_time) << endl;
+        if (cancel.cancelled())
+        {
+            return emptyMatrix();
+        }
 
-        rotated_image.set_size(0, 0);// clean up ram that's not needed anymore
+        if (NoCache == cache)// clean up ram that's not needed anymore in order to reduce peak consumption
+        {
+            filmulated_image.set_size(0, 0);
+            cacheEmpty = true;
+        }
+        else
+        {
+            cacheEmpty = false;
+        }
 
+        valid = paramManager->markCropComplete();
+        updateProgress(valid, 0.0f);
+        stageCompleted(Valid::crop);
+        [[fallthrough]];
+    }
+    case partblackwhite: [[fallthrough]];
+    case crop://Do whitepoint_blackpoint
+    {
+        BufferTagScope bufferScope(name, "blackwhite");
+        AbortStatus abort;
+        std::tie(valid, abort, blackWhiteParam) = paramManager->claimBlackWhiteParams();
+        if (abort == AbortStatus::restart)
+        {
+            return emptyMatrix();
+        }
 
-        whitepoint_blackpoint(cropped_image,//filmulated_image,
+        whitepoint_blackpoint(cropped_image,
                               contrast_image,
                               blackWhiteParam.whitepoint,
                               blackWhiteParam.blackpoint);
+        if (cancel.cancelled())
+        {
+            return emptyMatrix();
+        }
 
+        if (NoCache == cache)
+        {
+            cropped_image.set_size(0, 0);
+        }
 
         valid = paramManager->markBlackWhiteComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::blackwhite);
         [[fallthrough]];
     }
     case partcolorcurve: [[fallthrough]];
     case blackwhite: // Do color_curve
     {
+        BufferTagScope bufferScope(name, "colorcurve");
         //It's not gonna abort because we have no color curves yet..
         //Prepare LUT's for individual color processin.g
         lutR.setUnity();
@@ -1179,7 +851,10 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                     lutR,
                     lutG,
                     lutB);
-
+        if (cancel.cancelled())
+        {
+            return emptyMatrix();
+        }
 
         if (NoCache == cache)
         {
@@ -1192,11 +867,13 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
 
         valid = paramManager->markColorCurvesComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::colorcurve);
         [[fallthrough]];
     }
     case partfilmlikecurve: [[fallthrough]];
     case colorcurve://Do film-like curve
     {
+        BufferTagScope bufferScope(name, "filmlikecurve");
         AbortStatus abort;
         std::tie(valid, abort, curvesParam) = paramManager->claimFilmlikeCurvesParams();
         if (abort == AbortStatus::restart)
@@ -1244,12 +921,17 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
                                curvesParam.bwGmult,
                                curvesParam.bwBmult);
         }
+        if (cancel.cancelled())
+        {
+            return emptyMatrix();
+        }
 
         updateProgress(valid, 0.0f);
         [[fallthrough]];
     }
     default://output
     {
+        BufferTagScope bufferScope(name, "output");
         if (NoCache == cache)
         {
             //vibrance_saturation_image.set_size(0, 0);
@@ -1265,8 +947,11 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
         }
         valid = paramManager->markFilmLikeCurvesComplete();
         updateProgress(valid, 0.0f);
+        stageCompleted(Valid::filmlikecurve);
 
-        exifOutput = exifData;
+        exifOutput = info.exifData;
+        dumpLargestBuffers(cout, name, 5);
+        dumpHistoryStats(cout);
         return vibrance_saturation_image;
     }
     }//End task switch
@@ -1291,6 +976,10 @@ matrix<unsigned short>& ImagePipeline::processImage(ParameterManager * paramMana
 
 void ImagePipeline::updateProgress(Valid valid, float stepProgress)
 {
+    //This is called between stages and filmulation steps, which is often enough
+    // for the thread budget to follow other work starting and stopping.
+    refreshThreadBudget();
+
     double totalTime = numeric_limits<double>::epsilon();
     double totalCompletedTime = 0;
     for (ulong i = 0; i < completionTimes.size(); i++)
@@ -1307,6 +996,576 @@ void ImagePipeline::updateProgress(Valid valid, float stepProgress)
     histoInterface->setProgress(float(totalCompletedTime/totalTime));
 }
 
+//Demosaics the raw (or reads a non-raw image), recovers highlights, and applies lens
+// corrections and rotation, leaving the result in recovered_image.
+//Returns false if the image couldn't be read.
+bool ImagePipeline::demosaicImage(const LoadParams &loadParam, const DemosaicParams &demosaicParam,
+                                  const std::string &decodeKey)
+{
+    cout << "imagePipeline.cpp: Opening " << loadParam.fullFilename << endl;
+
+    //Reads in the photo.
+    cout << "load start:" << timeDiff (timeRequested) << endl;
+    struct timeval imload_time;
+    gettimeofday( &imload_time, nullptr );
+
+    matrix<float>& scaled_image = recovered_image;
+
+    //The demosaic produces separate color planes, and highlight recovery wants them that way too.
+    //When nothing else needs the interleaved full-size input_image, we keep the planes as-is
+    // and skip interleaving just to split them up again.
+    matrix<float> input_image;
+    matrix<float> red, green, blue;
+    bool planar = false;
+
+    //Highlight recovery reads the demosaiced image through this view.
+    //When stealing, it looks straight at the victim's decoded image instead of a copy.
+    const bool stolen = (HighQuality == quality) && stealData;//only full pipelines may steal data
+    //A quick pipeline only has to decode again if the image or the demosaicing changed.
+    const bool reused = !stolen && (HighQuality != quality) && decoded && (decoded->key == decodeKey);
+    matrix_view<const float> demosaiced;
+
+    if (stolen)
+    {
+        demosaiced = decoded->image;
+    }
+    else if (reused)
+    {
+        cout << "ImagePipeline::demosaicImage: reusing the decoded image" << endl;
+    }
+    else if (loadParam.tiffIn)
+    {
+        if (imread_tiff(loadParam.fullFilename, input_image, info.exifData))
+        {
+            cerr << "Could not open image " << loadParam.fullFilename << "; Exiting..." << endl;
+            return false;
+        }
+    }
+    else if (loadParam.jpegIn)
+    {
+        if (imread_jpeg(loadParam.fullFilename, input_image, info.exifData))
+        {
+            cerr << "Could not open image " << loadParam.fullFilename << "; Exiting..." << endl;
+            return false;
+        }
+    }
+    else if (info.isSraw)//already demosaiced
+    {
+        //We just need to scale to 65535, and apply camera WB
+        float inputscale = info.maxValue;
+        float outputscale = 65535.0;
+        float scaleFactor = outputscale / inputscale;
+        input_image.set_size(info.raw_height, info.raw_width*3);
+        if (info.isNikonSraw)
+        {
+            #pragma omp parallel for
+            for (int row = 0; row < info.raw_height; row++)
+            {
+                for (int col = 0; col < info.raw_width*3; col++)
+                {
+                    int color = col % 3;
+                    input_image(row, col) = raw_image(row, col) * scaleFactor;
+
+                }
+            }
+        }
+        else
+        {
+            #pragma omp parallel for
+            for (int row = 0; row < info.raw_height; row++)
+            {
+                for (int col = 0; col < info.raw_width*3; col++)
+                {
+                    int color = col % 3;
+                    input_image(row, col) = raw_image(row, col) * scaleFactor * ((color==0) ? info.rCamMul : (color == 1) ? info.gCamMul : info.bCamMul);
+
+                }
+            }
+        }
+    }
+    else //raw
+    {
+          red.set_size(info.raw_height, info.raw_width);
+        green.set_size(info.raw_height, info.raw_width);
+         blue.set_size(info.raw_height, info.raw_width);
+
+        double initialGain = 1.0;
+        float inputscale = info.maxValue;
+        float outputscale = 65535.0;
+        const int border = 4;//used for amaze
+        //librtprocess polls this; returning true asks it to stop early.
+        const CancelToken &cancel = currentCancelToken();
+        std::function<bool(double)> setProg = [&cancel](double) -> bool {return cancel.cancelled();};
+
+        cout << "raw width:  " << info.raw_width << endl;
+        cout << "raw height: " << info.raw_height << endl;
+
+        //before demosaic, you want to apply raw white balance
+        //======================================================================
+        //TODO: If the camera white balance disagrees with some sort of AWB by a *lot*, use an awb instead
+        //======================================================================
+        matrix<float> premultiplied(info.raw_height, info.raw_width);
+
+        cout << "demosaic start" << timeDiff(timeRequested) << endl;
+        struct timeval demosaic_time;
+        gettimeofday(&demosaic_time, nullptr);
+
+        if (info.maxXtrans > 0)
+        {
+            #pragma omp parallel for
+            for (int row = 0; row < info.raw_height; row++)
+            {
+                for (int col = 0; col < info.raw_width; col++)
+                {
+                    uint color = info.xtrans[uint(row) % 6][uint(col) % 6];
+                    premultiplied(row, col) = raw_image(row, col) * ((color==0) ? info.rCamMul : (color == 1) ? info.gCamMul : info.bCamMul);
+                }
+            }
+            markesteijn_demosaic(info.raw_width, info.raw_height, premultiplied, red, green, blue, info.xtrans, info.camToRGB4, setProg, 3, true);
+            //there's no inputscale for markesteijn so we need to scale
+            float scaleFactor = outputscale / inputscale;
+            #pragma omp parallel for
+            for (int row = 0; row < red.nr(); row++)
+            {
+                for (int col = 0; col < red.nc(); col++)
+                {
+                    red(row, col)   = red(row, col)   * scaleFactor;
+                    green(row, col) = green(row, col) * scaleFactor;
+                    blue(row, col)  = blue(row, col)  * scaleFactor;
+                }
+            }
+        }
+        else if (info.isMonochrome)
+        {
+            float scaleFactor = outputscale / inputscale;
+            for (int row = 0; row < info.raw_height; row++)
+            {
+                for (int col = 0; col < info.raw_width; col++)
+                {
+                    red(row, col)   = raw_image(row, col) * scaleFactor;
+                    green(row, col) = raw_image(row, col) * scaleFactor;
+                    blue(row, col)  = raw_image(row, col) * scaleFactor;
+                }
+            }
+        }
+        else
+        {
+            #pragma omp parallel for
+            for (int row = 0; row < info.raw_height; row++)
+            {
+                for (int col = 0; col < info.raw_width; col++)
+                {
+                    uint color = info.cfa[uint(row) & 1][uint(col) & 1];
+                    premultiplied(row, col) = raw_image(row, col) * ((color==0) ? info.rCamMul : (color == 1) ? info.gCamMul : info.bCamMul);
+                }
+            }
+            if (demosaicParam.caEnabled > 0)
+            {
+                //we need to apply white balance and then remove it for Auto CA Correct to work properly
+                double fitparams[2][2][16];
+                CA_correct(0, 0, info.raw_width, info.raw_height, true, demosaicParam.caEnabled, 0.0, 0.0, true, premultiplied, premultiplied, info.cfa, setProg, fitparams, false);
+            }
+            amaze_demosaic(info.raw_width, info.raw_height, 0, 0, info.raw_width, info.raw_height, premultiplied, red, green, blue, info.cfa, setProg, initialGain, border, inputscale, outputscale);
+            //matrix<float> normalized_image(raw_height, raw_width);
+            //normalized_image = premultiplied * (outputscale/inputscale);
+            //lmmse_demosaic(raw_width, raw_height, normalized_image, red, green, blue, cfa, setProg, 3);//needs inputscale and output scale to be implemented
+        }
+        premultiplied.set_size(0, 0);
+        cout << "demosaic end: " << timeDiff(demosaic_time) << endl;
+
+        //The full-quality pipeline doesn't keep input_image around, so if highlight recovery
+        // is going to want planes anyway, hand them over directly.
+        if ((HighQuality == quality) && (demosaicParam.highlights >= 2))
+        {
+            planar = true;
+        }
+        else
+        {
+            interleave(red, green, blue, input_image);
+            red.set_size(0, 0);
+            green.set_size(0, 0);
+            blue.set_size(0, 0);
+        }
+    }
+    cout << "load time: " << timeDiff(imload_time) << endl;
+
+    cout << "ImagePipeline::processImage: Demosaic complete." << endl;
+
+    //The quick pipelines keep the full-size image, shared read-only.
+    if ((HighQuality != quality) && !reused)
+    {
+        std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>();
+        image->info = info;
+        image->image = std::move(input_image);
+        image->image.retag(BufferTag::get("shared", "decoded"));
+        image->key = decodeKey;
+        decoded = image;
+    }
+
+    if (LowQuality == quality)
+    {
+        cout << "scale start:" << timeDiff (timeRequested) << endl;
+        struct timeval downscale_time;
+        gettimeofday( &downscale_time, nullptr );
+        downscale_and_crop(decoded->image, scaled_image, 0, 0, (decoded->image.nc()/3)-1, decoded->image.nr()-1, 600, 600);
+        cout << "scale end: " << timeDiff( downscale_time ) << endl;
+    }
+    else if (PreviewQuality == quality)
+    {
+        cout << "scale start:" << timeDiff (timeRequested) << endl;
+        struct timeval downscale_time;
+        gettimeofday( &downscale_time, nullptr );
+        downscale_and_crop(decoded->image, scaled_image, 0, 0, (decoded->image.nc()/3)-1, decoded->image.nr()-1, resolution, resolution);
+        cout << "scale end: " << timeDiff( downscale_time ) << endl;
+    }
+    else
+    {
+        if (!stealData && !planar) //If we had to compute the input image ourselves
+        {
+            scaled_image = std::move(input_image);
+        }
+    }
+    if (!stolen)
+    {
+        demosaiced = scaled_image;
+    }
+
+    //Recover highlights now
+    cout << "hlrecovery start:" << timeDiff (timeRequested) << endl;
+    struct timeval hlrecovery_time;
+    gettimeofday(&hlrecovery_time, nullptr);
+
+    int height = planar ? red.nr() : demosaiced.nr();
+    int width  = planar ? red.nc() : demosaiced.nc()/3;
+
+    //Now, recover highlights.
+    const CancelToken &cancel = currentCancelToken();
+    std::function<bool(double)> setProg = [&cancel](double) -> bool {return cancel.cancelled();};
+    //And return it back to a single layer
+    if (demosaicParam.highlights >= 2)
+    {
+        //For highlight recovery, we need the image as three separate layers.
+        matrix<float> rChannel, gChannel, bChannel;
+        if (planar)
+        {
+            rChannel = std::move(red);
+            gChannel = std::move(green);
+            bChannel = std::move(blue);
+        }
+        else
+        {
+            deinterleave(demosaiced, rChannel, gChannel, bChannel);
+        }
+
+        //We applied the camMul camera multipliers before applying white balance.
+        //Now we need to calculate the channel max and the raw clip levels.
+        //Channel max:
+        const float chmax[3] = {rChannel.max(), gChannel.max(), bChannel.max()};
+        //Max clip point:
+        const float clmax[3] = {65535.0f*info.rCamMul, 65535.0f*info.gCamMul, 65535.0f*info.bCamMul};
+
+        HLRecovery_inpaint(width, height, rChannel, gChannel, bChannel, chmax, clmax, setProg);
+        interleave(rChannel, gChannel, bChannel, recovered_image);
+    } else if (demosaicParam.highlights == 0)
+    {
+        //If not stolen, this is in-place, since the size is unchanged.
+        recovered_image.set_size(height, width*3);
+        #pragma omp parallel for
+        for (int row = 0; row < height; row++)
+        {
+            for (int col = 0; col < width; col++)
+            {
+                recovered_image(row, col*3    ) = min(demosaiced(row, col*3    ), 65535.0f);
+                recovered_image(row, col*3 + 1) = min(demosaiced(row, col*3 + 1), 65535.0f);
+                recovered_image(row, col*3 + 2) = min(demosaiced(row, col*3 + 2), 65535.0f);
+            }
+        }
+    } else if (stolen) {
+        recovered_image.copy_from(demosaiced);
+    } else {
+        recovered_image = std::move(scaled_image);
+    }
+
+    //Lensfun processing
+    cout << "lensfun start" << endl;
+    lfDatabase *ldb = lf_db_create();
+    QDir dir = QDir::home();
+    QString dirstr = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    dirstr.append("/filmulator/version_2");
+    std::string stdstring = dirstr.toStdString();
+    ldb->Load(stdstring.c_str());
+
+    std::string camName = demosaicParam.cameraName.toStdString();
+    const lfCamera * camera = NULL;
+    const lfCamera ** cameraList = ldb->FindCamerasExt(NULL,camName.c_str());
+
+    //Set up stuff for rotation.
+    //We expect rotation to be from -45 to +45
+    //But -50 will be the signal from the UI to disable it.
+    float rotationAngle = demosaicParam.rotationAngle * 3.1415926535/180;//convert degrees to radians
+    if (demosaicParam.rotationAngle <= -49) {
+        rotationAngle = 0;
+    }
+    cout << "cos rotationangle: " << cos(rotationAngle) << endl;
+    cout << "sin rotationangle: " << sin(rotationAngle) << endl;
+    bool lensfunGeometryCorrectionApplied = false;
+
+    if (cameraList)
+    {
+        const float cropFactor = cameraList[0]->CropFactor;
+
+        QString tempLensName = demosaicParam.lensName;
+        if (tempLensName.length() > 0)
+        {
+            if (tempLensName.front() == "\\")
+            {
+                //if the lens name starts with a backslash, don't filter by camera
+                tempLensName.remove(0,1);
+            } else {
+                //if it doesn't start with a backslash, filter by camera
+                camera = cameraList[0];
+            }
+        }
+        std::string lensName = tempLensName.toStdString();
+        const lfLens * lens = NULL;
+        const lfLens ** lensList = NULL;
+        lensList = ldb->FindLenses(camera, NULL, lensName.c_str());
+        if (lensList)
+        {
+            lens = lensList[0];
+
+            //Now we set up the modifier itself with the lens and processing flags
+#ifdef LF_GIT
+            lfModifier * mod = new lfModifier(lens, demosaicParam.focalLength, cropFactor, width, height, LF_PF_F32);
+#else //lensfun v0.3.95
+            lfModifier * mod = new lfModifier(cropFactor, width, height, LF_PF_F32);
+#endif
+
+            int modflags = 0;
+            if (demosaicParam.lensfunCA && !info.isMonochrome)
+            {
+#ifdef LF_GIT
+                modflags |= mod->EnableTCACorrection();
+#else //lensfun v0.3.95
+                modflags |= mod->EnableTCACorrection(lens, demosaicParam.focalLength);
+#endif
+            }
+            if (demosaicParam.lensfunVignetting)
+            {
+#ifdef LF_GIT
+                modflags |= mod->EnableVignettingCorrection(demosaicParam.fnumber, 1000.0f);
+#else //lensfun v0.3.95
+                modflags |= mod->EnableVignettingCorrection(lens, demosaicParam.focalLength, demosaicParam.fnumber, 1000.0f);
+#endif
+            }
+            if (demosaicParam.lensfunDistortion)
+            {
+#ifdef LF_GIT
+                modflags |= mod->EnableDistortionCorrection();
+#else //lensfun v0.3.95
+                modflags |= mod->EnableDistortionCorrection(lens, demosaicParam.focalLength);
+#endif
+                modflags |= mod->EnableScaling(mod->GetAutoScale(false));
+                cout << "Auto scale factor: " << mod->GetAutoScale(false) << endl;
+            }
+
+            //Now we actually perform the required processing.
+            //First is vignetting.
+            if (demosaicParam.lensfunVignetting)
+            {
+                bool success = true;
+                #pragma omp parallel for
+                for (int row = 0; row < height; row++)
+                {
+                    if (cancel.cancelled())
+                    {
+                        continue;
+                    }
+                    success = mod->ApplyColorModification(recovered_image[row], 0.0f, row, width, 1, LF_CR_3(RED, GREEN, BLUE), width);
+                }
+            }
+
+            //Next is CA, or distortion, or both.
+            matrix<float> new_image;
+            new_image.set_size(height, width*3);
+
+            if (demosaicParam.lensfunCA || demosaicParam.lensfunDistortion)
+            {
+                //ApplySubpixelGeometryDistortion
+                lensfunGeometryCorrectionApplied = true;
+                bool success = true;
+                int listWidth = width * 2 * 3;
+
+                //Check how far out of bounds we go
+                float maxOvershootDistance = 1.0f;
+                float semiwidth = (width-1)/2.0f;
+                float semiheight = (height-1)/2.0f;
+                #pragma omp parallel for reduction(max:maxOvershootDistance)
+                for (int row = 0; row < height; row++)
+                {
+                    if (cancel.cancelled())
+                    {
+                        continue;
+                    }
+                    float positionList[listWidth];
+                    success = mod->ApplySubpixelGeometryDistortion(0.0f, row, width, 1, positionList);
+                    if (success)
+                    {
+                        for (int col = 0; col < width; col++)
+                        {
+                            int listIndex = col * 2 * 3; //list index
+                            for (int c = 0; c < 3; c++)
+                            {
+                                float coordX = positionList[listIndex+2*c] - semiwidth;
+                                float coordY = positionList[listIndex+2*c+1] - semiheight;
+                                float rotatedX = coordX * cos(rotationAngle) - coordY * sin(rotationAngle);
+                                float rotatedY = coordX * sin(rotationAngle) + coordY * cos(rotationAngle);
+
+                                float overshoot = 1.0f;
+
+                                if (abs(rotatedX) > semiwidth)
+                                {
+                                    overshoot = max(abs(rotatedX)/semiwidth,overshoot);
+                                }
+                                if (abs(rotatedY) > semiheight)
+                                {
+                                    overshoot = max(abs(rotatedY)/semiheight,overshoot);
+                                }
+
+                                if (overshoot > maxOvershootDistance)
+                                {
+                                    maxOvershootDistance = overshoot;
+                                }
+                            }
+                        }
+                    }
+                }
+
+                #pragma omp parallel for
+                for (int row = 0; row < height; row++)
+                {
+                    if (cancel.cancelled())
+                    {
+                        continue;
+                    }
+                    float positionList[listWidth];
+                    success = mod->ApplySubpixelGeometryDistortion(0.0f, row, width, 1, positionList);
+                    if (success)
+                    {
+                        for (int col = 0; col < width; col++)
+                        {
+                            int listIndex = col * 2 * 3; //list index
+                            for (int c = 0; c < 3; c++)
+                            {
+                                float coordX = positionList[listIndex+2*c] - semiwidth;
+                                float coordY = positionList[listIndex+2*c+1] - semiheight;
+                                float rotatedX = (coordX * cos(rotationAngle) - coordY * sin(rotationAngle)) / maxOvershootDistance + semiwidth;
+                                float rotatedY = (coordX * sin(rotationAngle) + coordY * cos(rotationAngle)) / maxOvershootDistance + semiheight;
+                                int sX = max(0, min(width-1,  int(floor(rotatedX))))*3 + c;//startX
+                                int eX = max(0, min(width-1,  int(ceil(rotatedX))))*3 + c; //endX
+                                int sY = max(0, min(height-1, int(floor(rotatedY))));      //startY
+                                int eY = max(0, min(height-1, int(ceil(rotatedY))));       //endY
+                                float notUsed;
+                                float eWX = modf(rotatedX, &notUsed); //end weight X
+                                float eWY = modf(rotatedY, &notUsed); //end weight Y;
+                                float sWX = 1 - eWX;                //start weight X
+                                float sWY = 1 - eWY;                //start weight Y;
+                                new_image(row, col*3 + c) = recovered_image(sY, sX) * sWY * sWX +
+                                                            recovered_image(eY, sX) * eWY * sWX +
+                                                            recovered_image(sY, eX) * sWY * eWX +
+                                                            recovered_image(eY, eX) * eWY * eWX;
+                            }
+                        }
+                    }
+                }
+                recovered_image = std::move(new_image);
+            }
+
+            if (mod != NULL)
+            {
+                delete mod;
+            }
+        }
+        lf_free(lensList);
+    }
+    lf_free(cameraList);
+
+    //cleanup lensfun
+    if (ldb != NULL)
+    {
+        lf_db_destroy(ldb);
+    }
+
+    if (!lensfunGeometryCorrectionApplied)
+    {
+        //also do rotations on non-corrected images
+        float maxOvershootDistance = 1.0f;
+        float semiwidth = (width-1)/2.0f;
+        float semiheight = (height-1)/2.0f;
+
+        //check the four corners
+        for (int row = 0; row < height; row += height-1)
+        {
+            for (int col = 0; col < width; col += width-1)
+            {
+                float coordX = col - semiwidth;
+                float coordY = row - semiheight;
+                float rotatedX = coordX * cos(rotationAngle) - coordY * sin(rotationAngle);
+                float rotatedY = coordX * sin(rotationAngle) + coordY * cos(rotationAngle);
+
+                float overshoot = 1.0f;
+
+                if (abs(rotatedX) > semiwidth)
+                {
+                    overshoot = max(abs(rotatedX)/semiwidth,overshoot);
+                }
+                if (abs(rotatedY) > semiheight)
+                {
+                    overshoot = max(abs(rotatedY)/semiheight,overshoot);
+                }
+
+                if (overshoot > maxOvershootDistance)
+                {
+                    maxOvershootDistance = overshoot;
+                }
+            }
+        }
+
+        //Apply the rotation
+        matrix<float> new_image;
+        new_image.set_size(height, width*3);
+
+        for (int row = 0; row < height; row++)
+        {
+            for (int col = 0; col < width; col++)
+            {
+                float coordX = col - semiwidth;
+                float coordY = row - semiheight;
+                float rotatedX = (coordX * cos(rotationAngle) - coordY * sin(rotationAngle)) / maxOvershootDistance + semiwidth;
+                float rotatedY = (coordX * sin(rotationAngle) + coordY * cos(rotationAngle)) / maxOvershootDistance + semiheight;
+                int sX = max(0, min(width-1,  int(floor(rotatedX))))*3;//startX
+                int eX = max(0, min(width-1,  int(ceil(rotatedX))))*3; //endX
+                int sY = max(0, min(height-1, int(floor(rotatedY))));  //startY
+                int eY = max(0, min(height-1, int(ceil(rotatedY))));   //endY
+                float notUsed;
+                float eWX = modf(rotatedX, &notUsed); //end weight X
+                float eWY = modf(rotatedY, &notUsed); //end weight Y;
+                float sWX = 1 - eWX;                //start weight X
+                float sWY = 1 - eWY;                //start weight Y;
+                for (int c = 0; c < 3; c++)
+                {
+                    new_image(row, col*3 + c) = recovered_image(sY, sX + c) * sWY * sWX +
+                                                recovered_image(eY, sX + c) * eWY * sWX +
+                                                recovered_image(sY, eX + c) * sWY * eWX +
+                                                recovered_image(eY, eX + c) * eWY * eWX;
+                }
+            }
+        }
+        recovered_image = std::move(new_image);
+    }
+    return true;
+}
+
 //Do not call this on something that's already been used!
 void ImagePipeline::setCache(Cache cacheIn)
 {
@@ -1320,44 +1579,519 @@ void ImagePipeline::setCache(Cache cacheIn)
 //The intended use is for preloading.
 void ImagePipeline::swapPipeline(ImagePipeline * swapTarget)
 {
+    //Nobody may be reading either pipeline's buffers while they change hands.
+    //The cache mutexes go in address order so that two swaps can't deadlock.
+    QMutexLocker firstLocker(this < swapTarget ? &cacheMutex : &swapTarget->cacheMutex);
+    QMutexLocker secondLocker(this < swapTarget ? &swapTarget->cacheMutex : &cacheMutex);
+    QMutexLocker budgetLocker(&budgetMutex);
     std::swap(valid, swapTarget->valid);
+    std::swap(evicted, swapTarget->evicted);
+    std::swap(compacted, swapTarget->compacted);
+    std::swap(compactScale, swapTarget->compactScale);
+    std::swap(spills, swapTarget->spills);
+    std::swap(demosaicKey, swapTarget->demosaicKey);
+    std::swap(prefilmKey, swapTarget->prefilmKey);
+    std::swap(filmKey, swapTarget->filmKey);
+    std::swap(diskCacheable, swapTarget->diskCacheable);
+    stageHistory.swap(swapTarget->stageHistory);
+    {
+        QMutexLocker speculationLocker(&speculationMutex);
+        QMutexLocker targetLocker(&swapTarget->speculationMutex);
+        speculated.swap(swapTarget->speculated);
+    }
+    std::swap(historySource, swapTarget->historySource);
     std::swap(progress, swapTarget->progress);
 
     raw_image.swap(swapTarget->raw_image);
 
-    std::swap(cfa, swapTarget->cfa);
-    std::swap(xtrans, swapTarget->xtrans);
-    maxXtrans = swapTarget->maxXtrans;
-
-    raw_width = swapTarget->raw_width;
-    raw_height = swapTarget->raw_height;
-
-    std::swap(camToRGB, swapTarget->camToRGB);
-    std::swap(camToRGB4, swapTarget->camToRGB4);
-
-    std::swap(rCamMul, swapTarget->rCamMul);
-    std::swap(gCamMul, swapTarget->gCamMul);
-    std::swap(bCamMul, swapTarget->bCamMul);
-    std::swap(rPreMul, swapTarget->rPreMul);
-    std::swap(gPreMul, swapTarget->gPreMul);
-    std::swap(bPreMul, swapTarget->bPreMul);
-
-    std::swap(maxValue, swapTarget->maxValue);
-    std::swap(isSraw, swapTarget->isSraw);
-    std::swap(isNikonSraw, swapTarget->isNikonSraw);
-    std::swap(isMonochrome, swapTarget->isMonochrome);
-    std::swap(isCR3, swapTarget->isCR3);
-
-    std::swap(exifData, swapTarget->exifData);
+    std::swap(info, swapTarget->info);
     std::swap(basicExifData, swapTarget->basicExifData);
+    decoded.swap(swapTarget->decoded);
 
-    input_image.swap(swapTarget->input_image);
     recovered_image.swap(swapTarget->recovered_image);
     pre_film_image.swap(swapTarget->pre_film_image);
     filmulated_image.swap(swapTarget->filmulated_image);
+    cropped_image.swap(swapTarget->cropped_image);
     contrast_image.swap(swapTarget->contrast_image);
     color_curve_image.swap(swapTarget->color_curve_image);
     vibrance_saturation_image.swap(swapTarget->vibrance_saturation_image);
+    compact_recovered_image.swap(swapTarget->compact_recovered_image);
+    compact_pre_film_image.swap(swapTarget->compact_pre_film_image);
+    compact_filmulated_image.swap(swapTarget->compact_filmulated_image);
+
+    retagBuffers();
+    swapTarget->retagBuffers();
+}
+
+void ImagePipeline::retagBuffers()
+{
+    raw_image.retag(BufferTag::get(name, "load"));
+    recovered_image.retag(BufferTag::get(name, "demosaic"));
+    pre_film_image.retag(BufferTag::get(name, "prefilmulation"));
+    filmulated_image.retag(BufferTag::get(name, "filmulation"));
+    cropped_image.retag(BufferTag::get(name, "crop"));
+    contrast_image.retag(BufferTag::get(name, "blackwhite"));
+    color_curve_image.retag(BufferTag::get(name, "colorcurve"));
+    vibrance_saturation_image.retag(BufferTag::get(name, "filmlikecurve"));
+    compact_recovered_image.retag(BufferTag::get(name, "demosaic"));
+    compact_pre_film_image.retag(BufferTag::get(name, "prefilmulation"));
+    compact_filmulated_image.retag(BufferTag::get(name, "filmulation"));
+    stageHistory.retag(BufferTag::get(name, "history"));
+    {
+        QMutexLocker speculationLocker(&speculationMutex);
+        speculated.retag(BufferTag::get(name, "speculation"));
+    }
+}
+
+void ImagePipeline::setMemoryBudget(std::size_t bytes)
+{
+    QMutexLocker budgetLocker(&budgetMutex);
+    if (bytes == 0)
+    {
+        bytes = physicalMemoryBytes()/2;
+    }
+    memoryBudget = bytes;
+    cout << "ImagePipeline memory budget: " << memoryBudget/(1024*1024) << " MiB" << endl;
+}
+
+std::size_t ImagePipeline::getMemoryBudget()
+{
+    QMutexLocker budgetLocker(&budgetMutex);
+    return memoryBudget;
+}
+
+void ImagePipeline::setCompactStages(bool compact)
+{
+    QMutexLocker budgetLocker(&budgetMutex);
+    compactStages = compact;
+}
+
+void ImagePipeline::setSpillToDisk(bool spill)
+{
+    if (!spill)
+    {
+        SpillFile::setDirectory("");
+        return;
+    }
+    QString dirstr = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    dirstr.append("/filmulator/spill");
+    QDir dir(dirstr);
+    if (!dir.mkpath("."))
+    {
+        cout << "ImagePipeline::setSpillToDisk: could not create " << dirstr.toStdString() << endl;
+        SpillFile::setDirectory("");
+        return;
+    }
+
+    //The first time through, clear out whatever an earlier run left behind.
+    static bool cleaned = false;
+    if (!cleaned)
+    {
+        cleaned = true;
+        const QString ours = QString("spill-%1-").arg(QCoreApplication::applicationPid());
+        for (const QString &file : dir.entryList(QStringList() << "spill-*.bin", QDir::Files))
+        {
+            if (!file.startsWith(ours))
+            {
+                dir.remove(file);
+            }
+        }
+    }
+    SpillFile::setDirectory(dirstr.toStdString());
+}
+
+//Part-stages are odd; the stage before each one is complete.
+Valid ImagePipeline::resumePoint(Valid validIn)
+{
+    int complete = validIn - (validIn % 2);
+    bool backedOff = false;
+    while (complete > Valid::none && evicted[complete])
+    {
+        if (restoreStage(Valid(complete)))
+        {
+            break;
+        }
+        complete -= 2;
+        backedOff = true;
+    }
+
+    //Everything after the resume point gets recomputed, so packed and spilled copies of it are stale.
+    for (int stage = complete + 2; stage < Valid::count; stage += 2)
+    {
+        discardPacked(Valid(stage));
+        spills[stage].discard();
+    }
+    if (complete > Valid::none && compacted[complete])
+    {
+        unpackStage(Valid(complete));
+    }
+
+    if (backedOff)
+    {
+        cout << "ImagePipeline::resumePoint: " << name << " resuming from " << complete
+             << " instead of " << validIn << " because of the memory budget" << endl;
+        return Valid(complete);
+    }
+    return validIn;
+}
+
+//Only completed stages with an output worth keeping are candidates.
+//The final output is never dropped, since processImage hands out a reference to it,
+// and neither is the decoded image, which the full pipeline may be sharing.
+std::size_t ImagePipeline::stageBytes(Valid stage)
+{
+    if (compacted[stage])
+    {
+        return compactStage(stage)->bytes();
+    }
+    switch (stage)
+    {
+    case Valid::load:           return raw_image.bytes();
+    case Valid::demosaic:       return recovered_image.bytes();
+    case Valid::prefilmulation: return pre_film_image.bytes();
+    case Valid::filmulation:    return filmulated_image.bytes();
+    case Valid::crop:           return cropped_image.bytes();
+    case Valid::blackwhite:     return contrast_image.bytes();
+    case Valid::colorcurve:     return color_curve_image.bytes();
+    default:                    return 0;
+    }
+}
+
+//If spilling is on, the buffer goes to a scratch file first.
+//A packed stage isn't spilled; if it was spilled before, that copy is still good.
+void ImagePipeline::evictStage(Valid stage)
+{
+    const std::size_t bytes = stageBytes(stage);
+    switch (stage)
+    {
+    case Valid::load:           spills[stage].spill(raw_image); break;
+    case Valid::demosaic:       spills[stage].spill(recovered_image); break;
+    case Valid::prefilmulation: spills[stage].spill(pre_film_image); break;
+    case Valid::filmulation:    spills[stage].spill(filmulated_image); break;
+    case Valid::crop:           spills[stage].spill(cropped_image); break;
+    case Valid::blackwhite:     spills[stage].spill(contrast_image); break;
+    case Valid::colorcurve:     spills[stage].spill(color_curve_image); break;
+    default:                    return;
+    }
+    discardPacked(stage);
+    evicted[stage] = true;
+    cout << "ImagePipeline::evictStage: " << name << " dropping stage " << stage
+         << " (" << bytes/(1024*1024) << " MiB)"
+         << (spills[stage].held() ? ", kept on disk" : "") << endl;
+}
+
+bool ImagePipeline::restoreStage(Valid stage)
+{
+    bool restored = false;
+    switch (stage)
+    {
+    case Valid::load:           restored = spills[stage].restore(raw_image); break;
+    case Valid::demosaic:       restored = spills[stage].restore(recovered_image); break;
+    case Valid::prefilmulation: restored = spills[stage].restore(pre_film_image); break;
+    case Valid::filmulation:    restored = spills[stage].restore(filmulated_image); break;
+    case Valid::crop:           restored = spills[stage].restore(cropped_image); break;
+    case Valid::blackwhite:     restored = spills[stage].restore(contrast_image); break;
+    case Valid::colorcurve:     restored = spills[stage].restore(color_curve_image); break;
+    default:                    break;
+    }
+    if (restored)
+    {
+        cout << "ImagePipeline::restoreStage: " << name << " read stage " << stage << " back from disk" << endl;
+        evicted[stage] = false;
+        retagBuffers();
+    }
+    return restored;
+}
+
+matrix<float> * ImagePipeline::floatStage(Valid stage)
+{
+    switch (stage)
+    {
+    case Valid::demosaic:       return &recovered_image;
+    case Valid::prefilmulation: return &pre_film_image;
+    case Valid::filmulation:    return &filmulated_image;
+    default:                    return nullptr;
+    }
+}
+
+matrix<unsigned short> * ImagePipeline::compactStage(Valid stage)
+{
+    switch (stage)
+    {
+    case Valid::demosaic:       return &compact_recovered_image;
+    case Valid::prefilmulation: return &compact_pre_film_image;
+    case Valid::filmulation:    return &compact_filmulated_image;
+    default:                    return nullptr;
+    }
+}
+
+//Packing costs a little precision: about three significant digits are kept.
+//That's well below what's visible after the rest of the pipeline, and far cheaper than
+// re-demosaicing or re-filmulating.
+void ImagePipeline::packStage(Valid stage)
+{
+    matrix<float> * image = floatStage(stage);
+    cout << "ImagePipeline::packStage: " << name << " packing stage " << stage
+         << " (" << image->bytes()/(1024*1024) << " MiB)" << endl;
+    compactScale[stage] = pack_half(*image, *compactStage(stage));
+    image->free();
+    compacted[stage] = true;
+    retagBuffers();
+}
+
+void ImagePipeline::unpackStage(Valid stage)
+{
+    cout << "ImagePipeline::unpackStage: " << name << " unpacking stage " << stage << endl;
+    unpack_half(*compactStage(stage), *floatStage(stage), compactScale[stage]);
+    compactStage(stage)->free();
+    compacted[stage] = false;
+    retagBuffers();
+}
+
+void ImagePipeline::discardPacked(Valid stage)
+{
+    if (compacted[stage])
+    {
+        compactStage(stage)->free();
+        compacted[stage] = false;
+    }
+}
+
+double ImagePipeline::recomputeCost(Valid stage)
+{
+    //A stage beyond what's valid is stale and will be recomputed anyway.
+    if (stage > valid)
+    {
+        return 0;
+    }
+    double cost = completionTimes[stage];
+    for (int earlier = stage - 2; earlier > Valid::none && evicted[earlier] && !spills[earlier].held(); earlier -= 2)
+    {
+        cost += completionTimes[earlier];
+    }
+    return cost*evictionWeight;
+}
+
+void ImagePipeline::runAside(std::function<void()> task)
+{
+    if (NoCache == cache)
+    {
+        task();
+        return;
+    }
+    //Buffer tags are per thread, so the task's thread gets the stage's tag too.
+    BufferTag * tag = currentBufferTag();
+    sideTasks.push_back(std::async(std::launch::async, [task, tag]()
+    {
+        //Side work is off the critical path, so it only gets the cores nothing else wants.
+        ThreadBudgetScope threadScope(WorkClass::background);
+        BufferTagScope bufferScope(tag);
+        task();
+    }));
+}
+
+void ImagePipeline::waitForSideTasks()
+{
+    for (auto &task : sideTasks)
+    {
+        task.wait();
+    }
+    sideTasks.clear();
+}
+
+//Drops stage buffers, the cheapest to recompute per byte first, until all image buffers
+// fit in the budget.
+//This pipeline can only give up stages before the one it just finished.
+//Other pipelines are skipped while they're processing.
+void ImagePipeline::stageCompleted(Valid stage)
+{
+    evicted[stage] = false;
+    discardPacked(stage);//a leftover from before this stage was rerun
+    spills[stage].discard();
+
+    //Buffers on their way to disk are as good as gone.
+    auto heldBytes = []()
+    {
+        const std::size_t live = liveBufferBytes();
+        const std::size_t leaving = SpillFile::writebackBytes();
+        return live > leaving ? live - leaving : 0;
+    };
+
+    QMutexLocker budgetLocker(&budgetMutex);
+    if (heldBytes() <= memoryBudget)
+    {
+        return;
+    }
+
+    //We may be about to drop one of our own stages that a histogram is still reading.
+    waitForSideTasks();
+
+    std::vector<ImagePipeline*> idle;
+    for (auto pipe : allPipelines)
+    {
+        if (pipe != this && pipe->cacheMutex.tryLock())
+        {
+            idle.push_back(pipe);
+        }
+    }
+
+    //Outputs kept from earlier settings are only there on speculation, so they go first,
+    // least recently used first.
+    while (heldBytes() > memoryBudget)
+    {
+        StageHistory * oldest = nullptr;
+        uint64_t oldestUse = numeric_limits<uint64_t>::max();
+        auto considerHistory = [&](ImagePipeline * pipe)
+        {
+            const uint64_t lastUse = pipe->stageHistory.oldestUse();
+            if (lastUse != 0 && lastUse < oldestUse)
+            {
+                oldestUse = lastUse;
+                oldest = &pipe->stageHistory;
+            }
+        };
+        considerHistory(this);
+        for (auto pipe : idle)
+        {
+            considerHistory(pipe);
+        }
+        if (oldest == nullptr)
+        {
+            break;
+        }
+        oldest->dropOldest();
+    }
+
+    while (heldBytes() > memoryBudget)
+    {
+        ImagePipeline * bestPipe = nullptr;
+        Valid bestStage = Valid::none;
+        bool bestIsPack = false;
+        double bestScore = numeric_limits<double>::max();
+        //The raw input isn't a candidate: without it, even a pipeline whose decoded
+        // image is current would have to reopen the file.
+        auto consider = [&](ImagePipeline * pipe, const Valid limit)
+        {
+            for (int candidate = Valid::demosaic; candidate < limit; candidate += 2)
+            {
+                const Valid stage = Valid(candidate);
+                const std::size_t bytes = pipe->stageBytes(stage);
+                if (bytes == 0)
+                {
+                    continue;
+                }
+                const double score = pipe->recomputeCost(stage)/double(bytes);
+                if (score < bestScore)
+                {
+                    bestScore = score;
+                    bestPipe = pipe;
+                    bestStage = stage;
+                    bestIsPack = false;
+                }
+                //Packing frees half the bytes, and unpacking is cheap next to rerunning any stage.
+                if (compactStages && !pipe->compacted[stage] && pipe->floatStage(stage) && stage <= pipe->valid)
+                {
+                    const double packScore = pipe->evictionWeight/(bytes/2.0);
+                    if (packScore < bestScore)
+                    {
+                        bestScore = packScore;
+                        bestPipe = pipe;
+                        bestStage = stage;
+                        bestIsPack = true;
+                    }
+                }
+            }
+        };
+        consider(this, stage);
+        for (auto pipe : idle)
+        {
+            consider(pipe, Valid::filmlikecurve);
+        }
+        if (bestPipe == nullptr)
+        {
+            break;//nothing left that we're allowed to drop
+        }
+        if (bestIsPack)
+        {
+            bestPipe->packStage(bestStage);
+        }
+        else
+        {
+            bestPipe->evictStage(bestStage);
+        }
+    }
+
+    for (auto pipe : idle)
+    {
+        pipe->cacheMutex.unlock();
+    }
+}
+
+bool ImagePipeline::recallStage(Valid stage, std::string &heldKey, const std::string &key, matrix<float> &image)
+{
+    const std::string previous = heldKey;
+    heldKey.clear();
+    //A pipeline that doesn't keep its own stages around doesn't keep old ones either.
+    if (NoCache == cache)
+    {
+        return false;
+    }
+    if (stageHistory.exchange(stage, previous, key, image))
+    {
+        return true;
+    }
+    //Speculative results are only ever taken out here, so nothing is set aside.
+    //Only looking when there are some keeps the hit rate about speculation alone.
+    QMutexLocker speculationLocker(&speculationMutex);
+    return speculated.bytes() > 0 && speculated.exchange(stage, "", key, image);
+}
+
+bool ImagePipeline::speculateFilmulation(ImagePipeline * target, ParameterManager * params, Interface * interface)
+{
+    QMutexLocker cacheLocker(&cacheMutex);
+    //Borrow the target's pre-film image, unless we already have this one.
+    if (!target->cacheMutex.tryLock())
+    {
+        return false;
+    }
+    if (target->prefilmKey != prefilmKey || pre_film_image.nr() == 0)
+    {
+        BufferTagScope bufferScope(name, "prefilmulation");
+        pre_film_image = target->pre_film_image;
+        prefilmKey = target->prefilmKey;
+    }
+    target->cacheMutex.unlock();
+    if (pre_film_image.nr() == 0 || prefilmKey.empty())
+    {
+        return false;
+    }
+
+    histoInterface = interface;
+    ThreadBudgetScope threadScope(WorkClass::background);
+    //The token is reset when filmulate() claims its params, which catches a pause that
+    // lands before then; resetting it here too could wipe one out.
+    CancelScope cancelScope(params->getCancelToken());
+    BufferTagScope bufferScope(name, "filmulation");
+    if (filmulate(pre_film_image, filmulated_image, params, this))
+    {
+        return false;
+    }
+
+    QMutexLocker speculationLocker(&target->speculationMutex);
+    target->speculated.exchange(Valid::filmulation, filmKey, "", filmulated_image);
+    return true;
+}
+
+void ImagePipeline::dumpHistoryStats(std::ostream &out) const
+{
+    out << "Stage history of " << name << ": "
+        << stageHistory.bytes()/(1024*1024) << " MiB held; demosaic "
+        << stageHistory.hits(Valid::demosaic) << " hits, "
+        << stageHistory.misses(Valid::demosaic) << " misses; filmulation "
+        << stageHistory.hits(Valid::filmulation) << " hits, "
+        << stageHistory.misses(Valid::filmulation) << " misses; speculation "
+        << speculated.hits(Valid::filmulation) << " hits, "
+        << speculated.misses(Valid::filmulation) << " misses" << endl;
 }
 
 //This is used to copy only images from one pipeline to another,
@@ -1366,30 +2100,131 @@ void ImagePipeline::swapPipeline(ImagePipeline * swapTarget)
 // in the case of distortion correction or leveling.
 void ImagePipeline::copyAndDownsampleImages(ImagePipeline * copySource)
 {
+    //This runs alongside other work, so it keeps readers of our buffers out like processing does,
+    // and the source from changing under it. The source is the full pipeline, which takes our
+    // lock while holding its own when it steals, so its lock goes first here too.
+    QMutexLocker sourceLocker(&copySource->cacheMutex);
+    QMutexLocker locker(&cacheMutex);
+    QMutexLocker budgetLocker(&budgetMutex);
+    //This may run on a thread of its own; retagBuffers below sorts the copies into their stages.
+    BufferTagScope bufferScope(name, "refresh");
+    //The copies are made from the source's parameters, so they're keyed from the source's keys.
+    auto downsampledKey = [this](const std::string &sourceKey)
+    {
+        return sourceKey.empty() ? sourceKey : StageKey(sourceKey).add(std::string("downsampled")).add(resolution).str();
+    };
     //We only want to copy stuff starting with recovered image.
-    downscale_and_crop(copySource->recovered_image, recovered_image, 0, 0, ((copySource->recovered_image.nc())/3)-1, copySource->recovered_image.nr()-1, resolution, resolution);
-    downscale_and_crop(copySource->pre_film_image, pre_film_image, 0, 0, ((copySource->pre_film_image.nc())/3)-1, copySource->pre_film_image.nr()-1, resolution, resolution);
-    downscale_and_crop(copySource->filmulated_image, filmulated_image, 0, 0, ((copySource->filmulated_image.nc())/3)-1, copySource->filmulated_image.nr()-1, resolution, resolution);
+    //The memory budget may have dropped some of the source's stages; keep ours for those.
+    if (copySource->recovered_image.nr() > 0)
+    {
+        downscale_and_crop(copySource->recovered_image, recovered_image, 0, 0, ((copySource->recovered_image.nc())/3)-1, copySource->recovered_image.nr()-1, resolution, resolution);
+        evicted[Valid::demosaic] = false;
+        discardPacked(Valid::demosaic);
+        spills[Valid::demosaic].discard();
+        demosaicKey = downsampledKey(copySource->demosaicKey);
+    }
+    if (copySource->pre_film_image.nr() > 0)
+    {
+        downscale_and_crop(copySource->pre_film_image, pre_film_image, 0, 0, ((copySource->pre_film_image.nc())/3)-1, copySource->pre_film_image.nr()-1, resolution, resolution);
+        evicted[Valid::prefilmulation] = false;
+        discardPacked(Valid::prefilmulation);
+        spills[Valid::prefilmulation].discard();
+        prefilmKey = downsampledKey(copySource->prefilmKey);
+    }
+    if (copySource->filmulated_image.nr() > 0)
+    {
+        downscale_and_crop(copySource->filmulated_image, filmulated_image, 0, 0, ((copySource->filmulated_image.nc())/3)-1, copySource->filmulated_image.nr()-1, resolution, resolution);
+        evicted[Valid::filmulation] = false;
+        discardPacked(Valid::filmulation);
+        spills[Valid::filmulation].discard();
+        filmKey = downsampledKey(copySource->filmKey);
+    }
+    retagBuffers();
     //The stuff after filmulated_image is type <unsigned short> and so
     // we don't have a routine to scale them. But that's okay, I think.
     //Anything except tweaking saturation will pull from the higher res
     // data.
 }
 
+void ImagePipeline::reduceResolution(int resolutionIn)
+{
+    //This replaces buffers and keys that other threads may be reading,
+    // so it holds the cache mutex like processing does.
+    QMutexLocker cacheLocker(&cacheMutex);
+    QMutexLocker budgetLocker(&budgetMutex);
+    if (resolutionIn >= resolution)
+    {
+        return;
+    }
+    resolution = resolutionIn;
+    //Packed, dropped, and spilled stages are left alone; whatever gets computed from them
+    // is at their resolution, which is still consistent.
+    auto downsample = [this](Valid stage, matrix<float> &image, std::string &key)
+    {
+        if (image.nr() == 0 || max(image.nr(), image.nc()/3) <= resolution)
+        {
+            return;
+        }
+        matrix<float> smaller;
+        downscale_and_crop(image, smaller, 0, 0, (image.nc()/3)-1, image.nr()-1, resolution, resolution);
+        image = std::move(smaller);
+        discardPacked(stage);
+        spills[stage].discard();
+        key = key.empty() ? key : StageKey(key).add(std::string("downsampled")).add(resolution).str();
+    };
+    downsample(Valid::demosaic, recovered_image, demosaicKey);
+    downsample(Valid::prefilmulation, pre_film_image, prefilmKey);
+    downsample(Valid::filmulation, filmulated_image, filmKey);
+    retagBuffers();
+}
+
+bool ImagePipeline::raiseResolution(int resolutionIn)
+{
+    QMutexLocker cacheLocker(&cacheMutex);
+    QMutexLocker budgetLocker(&budgetMutex);
+    if (resolutionIn <= resolution)
+    {
+        return false;
+    }
+    resolution = resolutionIn;
+    //What we hold is at the lower resolution, and can't be scaled back up.
+    //Marking it dropped makes the next run back off to a stage that's still good.
+    auto drop = [this](Valid stage, matrix<float> &image, std::string &key)
+    {
+        image.set_size(0, 0);
+        discardPacked(stage);
+        spills[stage].discard();
+        evicted[stage] = true;
+        key.clear();
+    };
+    drop(Valid::demosaic, recovered_image, demosaicKey);
+    drop(Valid::prefilmulation, pre_film_image, prefilmKey);
+    drop(Valid::filmulation, filmulated_image, filmKey);
+    return true;
+}
+
 //This is used to update the histograms once data is copied on an image change
 void ImagePipeline::rerunHistograms()
 {
     if (WithHisto == histo)
     {
-        if (valid >= Valid::load)
+        //Keep the memory budget from dropping buffers while we read them.
+        QMutexLocker cacheLocker(&cacheMutex);
+        //Dropped and packed stages have nothing to show; those histograms come back
+        // when the stage is next computed.
+        auto held = [this](Valid stage)
+        {
+            return valid >= stage && !evicted[stage] && !compacted[stage];
+        };
+        if (held(Valid::load))
         {
-            histoInterface->updateHistRaw(raw_image, maxValue, cfa, xtrans, maxXtrans, isSraw, isMonochrome);
+            histoInterface->updateHistRaw(raw_image, info.maxValue, info.cfa, info.xtrans, info.maxXtrans, info.isSraw, info.isMonochrome);
         }
-        if (valid >= Valid::prefilmulation)
+        if (held(Valid::prefilmulation))
         {
             histoInterface->updateHistPreFilm(pre_film_image, 65535);
         }
-        if (valid >= Valid::filmulation)
+        if (held(Valid::filmulation))
         {
             histoInterface->updateHistPostFilm(filmulated_image, .0025f);
         }
@@ -2,9 +2,16 @@
 #define IMAGEPIPELINE_H
 #include "filmSim.hpp"
 #include "interface.h"
+#include "decodedImage.hpp"
+#include "spillFile.hpp"
+#include "stageCache.hpp"
+#include "stageHistory.hpp"
+#include "threadBudget.hpp"
 #include "../ui/parameterManager.h"
 #include <QMutex>
 #include <QMutexLocker>
+#include <functional>
+#include <future>
 #include <rtprocess/librtprocess.h>
 
 enum Cache {WithCache, NoCache};
@@ -14,7 +21,9 @@ enum QuickQuality { LowQuality, PreviewQuality, HighQuality };
 class ImagePipeline
 {
 public:
-    ImagePipeline(Cache, Histo, QuickQuality);
+    //The name is what this pipeline's image buffers get charged to in memory accounting.
+    ImagePipeline(Cache, Histo, QuickQuality, std::string nameIn = "pipeline");
+    ~ImagePipeline();
 
     //Loads and processes an image according to the 'params' structure, monitoring 'aborted' for cancellation.
     matrix<unsigned short>& processImage(ParameterManager * paramManager,
@@ -32,6 +41,7 @@ public:
     void setCache(Cache cacheIn);
 
     //Variable relating to stealing the demosaiced data from another imagepipeline
+    //The full pipeline then starts from the victim's decoded image, metadata included.
     bool stealData = false;
     ImagePipeline * stealVictim;
 
@@ -46,6 +56,16 @@ public:
     //Only used for pipelines that already are based on the same image.
     void copyAndDownsampleImages(ImagePipeline * copySource);
 
+    //Lowers a quick pipeline's resolution, downsampling the float stages it holds so that
+    // an edit can resume from them. Later stages aren't resampled, so the caller has to
+    // drop validity back to filmulation at most.
+    void reduceResolution(int resolutionIn);
+
+    //Raises a quick pipeline's resolution again, dropping the float stages held at the
+    // lower one. Returns whether it changed, in which case the caller has to drop validity
+    // back to filmulation at most.
+    bool raiseResolution(int resolutionIn);
+
     //This is related to the above; if the image changes but the pipeline is
     // preloaded, we need to refresh the histograms
     void rerunHistograms();
@@ -53,6 +73,49 @@ public:
     //The resolution of a quick preview
     int resolution;
 
+    //Used for memory accounting and reports.
+    std::string name;
+
+    //Caps the image buffer memory of all pipelines together; 0 picks half the installed RAM.
+    //When over budget, idle stage buffers are dropped, cheapest to recompute per byte first,
+    // and the pipeline that owned them restarts from an earlier stage next time.
+    static void setMemoryBudget(std::size_t bytes);
+    static std::size_t getMemoryBudget();
+
+    //When on, idle float stages are first packed into half floats before being dropped outright.
+    //They're unpacked when the pipeline resumes from them.
+    static void setCompactStages(bool compact);
+
+    //When on, dropped stages are written to scratch files and read back when resumed from,
+    // instead of being recomputed.
+    static void setSpillToDisk(bool spill);
+
+    //Lets this pipeline use the on-disk stage cache. Only full-quality pipelines write
+    // to it, since that's where demosaicing and filmulation are slow; preview pipelines
+    // start from a shrunken copy of a full-quality demosaic entry.
+    void setDiskCache(bool use) {diskCache = use;}
+
+    //Prints how often this pipeline's stage history had what was asked for.
+    void dumpHistoryStats(std::ostream &out) const;
+
+    //Scales how costly this pipeline's stages are to drop; preload pipelines can use less than 1.
+    void setEvictionWeight(double weight) {evictionWeight = weight;}
+
+    //How urgent this pipeline's work is when dividing up cores.
+    //By default quick previews are interactive, full quality is a full render, and
+    // low quality (thumbnails) is background work.
+    void setWorkClass(WorkClass workClassIn) {workClass = workClassIn;}
+
+    //Filmulates the target's pre-film image with the given params, which are set up to be
+    // valid through prefilmulation, and keeps the result in the target's speculative
+    // history. When an edit then asks the target for those params, it's an instant hit.
+    //Gives up without waiting if the target is busy; returns false if nothing was kept.
+    bool speculateFilmulation(ImagePipeline * target, ParameterManager * params, Interface * interface);
+
+    //Blocks until the side tasks started by processImage are done.
+    //processImage does this itself before it returns.
+    void waitForSideTasks();
+
 protected:
     matrix<unsigned short>& emptyMatrix(){return empty;}
 
@@ -61,6 +124,7 @@ protected:
     bool hasStartedProcessing = false;
     Histo histo;
     QuickQuality quality;
+    WorkClass workClass;
     Interface * histoInterface;
 
     Valid valid;
@@ -74,26 +138,17 @@ protected:
     //raw stuff
     matrix<float> raw_image;
     matrix<unsigned short> empty;
-    unsigned cfa[2][2];
-    unsigned xtrans[6][6];
-    int maxXtrans;
-    int raw_width, raw_height;
-    float camToRGB[3][3];
-    float camToRGB4[3][4];
-    float rCamMul, gCamMul, bCamMul;//wb used on the image
-    float rPreMul, gPreMul, bPreMul;//"daylight" wb according to libraw
-    float maxValue;
-    bool isSraw;//Actually we should set this for all full-color raws (including X-Transformer)
-    bool isNikonSraw;
-    bool isMonochrome;
-    bool isCR3;
-
-    matrix<float> input_image;
+    ImageInfo info;
+
+    //The full-size demosaiced image; only the quick pipelines make one.
+    //When stealing, this is the victim's.
+    std::shared_ptr<const DecodedImage> decoded;
+
     matrix<float> recovered_image;
     matrix<float> pre_film_image;
-    Exiv2::ExifData exifData;
     Exiv2::ExifData basicExifData;//for tiff writing
     matrix<float> filmulated_image;
+    matrix<float> cropped_image;//rotated and cropped
     matrix<unsigned short> contrast_image;
     matrix<unsigned short> color_curve_image;
     matrix<unsigned short> vibrance_saturation_image;
@@ -102,12 +157,85 @@ protected:
     vector<double> completionTimes;
     void updateProgress(Valid valid, float CurrFractionCompleted);
 
+    //The heavy part of the demosaic stage; it leaves its result in recovered_image.
+    //decodeKey identifies the source and demosaicing for the decoded image.
+    bool demosaicImage(const LoadParams &loadParam, const DemosaicParams &demosaicParam,
+                       const std::string &decodeKey);
+
+    //Keys for what the stages' outputs were made from; empty while a stage's output
+    // is incomplete or not something that can be looked up again.
+    std::string demosaicKey;
+    std::string prefilmKey;
+    std::string filmKey;
+    //Whether the current image's keys may be used with the disk cache.
+    bool diskCache = false;
+    bool diskCacheable = false;
+
+    //Earlier outputs of the demosaic and filmulation stages, all for the same source image.
+    StageHistory stageHistory;
+    std::string historySource;
+    //Filmulation outputs for params nobody has asked for yet, from speculateFilmulation.
+    //That runs on another thread, so this has its own mutex.
+    StageHistory speculated{2};
+    QMutex speculationMutex;
+    //Checks the history before a stage is recomputed; see StageHistory::exchange.
+    //heldKey is cleared, to be set again once the stage's output is complete.
+    bool recallStage(Valid stage, std::string &heldKey, const std::string &key, matrix<float> &image);
+
     //The core filmulation. It needs to access ProcessingParameters, so it's here.
     bool filmulate(matrix<float> &scaled_image,
                    matrix<float> &output_density,
                    ParameterManager * paramManager,
                    ImagePipeline * pipeline);
 
+    //Memory budget bookkeeping.
+    //The budget mutex guards the pipeline list and serializes evictions against swaps.
+    //Each pipeline holds its cache mutex while processing or replacing its buffers,
+    // so others leave them alone; anything reading another pipeline's buffers takes it too.
+    //A stealing pipeline takes its victim's while holding its own, never the other way round.
+    static QMutex budgetMutex;
+    static std::vector<ImagePipeline*> allPipelines;
+    static std::size_t memoryBudget;
+    QMutex cacheMutex;
+    static bool compactStages;
+    std::vector<bool> evicted;//stages whose output buffer was dropped
+    std::vector<bool> compacted;//stages whose output is packed as half floats
+    std::vector<float> compactScale;//what pack_half scaled each packed stage by
+    matrix<unsigned short> compact_recovered_image;
+    matrix<unsigned short> compact_pre_film_image;
+    matrix<unsigned short> compact_filmulated_image;
+    std::vector<SpillFile> spills;//disk copies of dropped stages
+    double evictionWeight = 1.0;
+
+    //Backs off from validIn to the latest completed stage whose output is still held.
+    Valid resumePoint(Valid validIn);
+    //The output buffer size of a completed stage, and dropping it.
+    std::size_t stageBytes(Valid stage);
+    void evictStage(Valid stage);
+    //Only the float stages can be packed; these return null for the others.
+    matrix<float> * floatStage(Valid stage);
+    matrix<unsigned short> * compactStage(Valid stage);
+    void packStage(Valid stage);
+    void unpackStage(Valid stage);
+    void discardPacked(Valid stage);
+    //Reads a dropped stage back from its spill file; false if there's none.
+    bool restoreStage(Valid stage);
+    //Relative time to rebuild a stage's output from the nearest earlier stage still held.
+    double recomputeCost(Valid stage);
+    //Marks a stage's output as held again and brings all pipelines back within budget.
+    void stageCompleted(Valid stage);
+
+    //Charges each stage buffer to this pipeline under its stage's name.
+    //Needed after buffers move in from another pipeline.
+    void retagBuffers();
+
+    //Work that only reads a finished stage's output, like its histogram, runs alongside
+    // the stages after it instead of holding them up. Nothing may drop or rewrite that
+    // output until waitForSideTasks() says it's done.
+    //Pipelines that don't cache free their outputs right away, so theirs run inline.
+    std::vector<std::future<void>> sideTasks;
+    void runAside(std::function<void()> task);
+
     //Callback for LibRaw cancellation
     static int libraw_callback(void *data, enum LibRaw_progress p, int iteration, int expected);
 };
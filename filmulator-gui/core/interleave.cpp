@@ -0,0 +1,73 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "filmSim.hpp"
+
+//Packs three color planes into one RGBRGB... matrix.
+void interleave(const matrix_view<const float> &red, const matrix_view<const float> &green,
+                const matrix_view<const float> &blue, matrix<float> &output)
+{
+    assert(red.contiguous_rows() && green.contiguous_rows() && blue.contiguous_rows());
+    const int nRows = red.nr();
+    const int nCols = red.nc();
+
+    output.set_size(nRows, nCols*3);
+
+    #pragma omp parallel for
+    for (int row = 0; row < nRows; row++)
+    {
+        const float * __restrict rRow = red[row];
+        const float * __restrict gRow = green[row];
+        const float * __restrict bRow = blue[row];
+        float * __restrict outRow = output[row];
+        for (int col = 0; col < nCols; col++)
+        {
+            outRow[col*3    ] = rRow[col];
+            outRow[col*3 + 1] = gRow[col];
+            outRow[col*3 + 2] = bRow[col];
+        }
+    }
+}
+
+//Splits an RGBRGB... matrix into three color planes.
+void deinterleave(const matrix_view<const float> &input, matrix<float> &red,
+                  matrix<float> &green, matrix<float> &blue)
+{
+    assert(input.contiguous_rows());
+    const int nRows = input.nr();
+    const int nCols = input.nc()/3;
+
+    red.set_size(nRows, nCols);
+    green.set_size(nRows, nCols);
+    blue.set_size(nRows, nCols);
+
+    #pragma omp parallel for
+    for (int row = 0; row < nRows; row++)
+    {
+        const float * __restrict inRow = input[row];
+        float * __restrict rRow = red[row];
+        float * __restrict gRow = green[row];
+        float * __restrict bRow = blue[row];
+        for (int col = 0; col < nCols; col++)
+        {
+            rRow[col] = inRow[col*3    ];
+            gRow[col] = inRow[col*3 + 1];
+            bRow[col] = inRow[col*3 + 2];
+        }
+    }
+}
@@ -48,12 +48,17 @@ void layer_mix(matrix<float> &developer_concentration,
     double sum = 0;
 
     //Here we add developer to the layer.
+    const CancelToken &cancel = currentCancelToken();
 #pragma omp parallel shared(developer_concentration) \
         firstprivate(layer_mix, reservoir_portion) reduction(+:sum)
     {
 #pragma omp for schedule(dynamic) nowait
         for(int row=0; row<length; row++)
         {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             float temp;
             for(int col=0; col<width; col++)
             {
@@ -27,6 +27,17 @@
 #include <iostream>
 #include <memory>
 #include <omp.h>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include "bufferTracker.hpp"
+#include <string>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef DOUT
 #define dout cout
@@ -39,15 +50,41 @@
 
 #include "assert.h" //Included later so NDEBUG has an effect
 
+//Rows and the start of the data are aligned to this many bytes (one cache line).
+#define MATRIX_ALIGNMENT 64
+//Allocations at least this big are mmapped so that they can be backed by huge pages.
+#define MATRIX_MMAP_THRESHOLD (4*1024*1024)
+#define MATRIX_PAGE_SIZE 4096
+
+//Row layout.
+//Dense rows are back to back, so the data can be used as one flat array.
+//Padded rows each start on a cache line, and the stride is chosen so that
+// consecutive rows never sit a multiple of 4K apart (which aliases in L1).
+enum class MatrixLayout {dense, padded};
+
+template <class T>
+class matrix_view;
+
+template <class E>
+class matrix_expr;
+
 template <class T>
 class matrix
 {
     private:
         T** ptr;
         T* data;
-        T* ua_data;//unaligned
+        T* ua_data;//unaligned; null if the memory was mmapped
+        std::size_t mapped_bytes;//nonzero if the memory was mmapped
+        BufferTag * tag;//who the memory is charged to
+        std::size_t tracked_bytes;
         int num_rows;
         int num_cols;
+        int stride;//distance between rows, in elements
+        MatrixLayout layout;
+        void allocate(const int nrows, const int ncols, const MatrixLayout newLayout);
+        void release();
+        static int stride_for(const int ncols, const MatrixLayout newLayout);
         inline void slow_transpose_to(const matrix<T> &target) const;
 #ifdef __SSE2__
         inline void fast_transpose_to(const matrix<T> &target) const;
@@ -65,13 +102,30 @@ class matrix
                                            const int ldb,
                                            const int block_size) const;
     public:
-        matrix(const int nrows = 0, const int ncols = 0);
+        matrix(const int nrows = 0, const int ncols = 0,
+               const MatrixLayout layoutIn = MatrixLayout::dense);
         matrix(const matrix<T> &toCopy);
+        //Evaluates an element-wise expression such as a*k + b.
+        template <class E>
+        matrix(const matrix_expr<E> &expr);
         ~matrix();
         void set_size(const int nrows, const int ncols);
+        void set_size(const int nrows, const int ncols, const MatrixLayout layoutIn);
         void free();
         int nr() const;
         int nc() const;
+        int row_stride() const {return stride;}
+        MatrixLayout get_layout() const {return layout;}
+        //Bytes of image data held, and who they're charged to.
+        std::size_t bytes() const {return tracked_bytes;}
+        BufferTag * get_tag() const {return tag;}
+        //Charges this matrix's memory to another owner, e.g. after a swap between pipelines.
+        void retag(BufferTag * newTag);
+        //Replaces the contents with a private copy-on-write mapping of a file holding
+        // the raw rows (stride included), so pages are only read in as they're touched.
+        //Returns false where that isn't supported or the file can't be mapped.
+        bool map_file(const std::string &path, const int nrows, const int ncols,
+                      const MatrixLayout layoutIn);
         T& operator()(const int row, const int col) const;
 
         void swap(matrix<T> &swapTarget);
@@ -85,7 +139,7 @@ class matrix
         {
             return ptr;
         }
-        operator T*()// pointer to data
+        operator T*()// pointer to data; only one flat array if the layout is dense
         {
             return data;
         }
@@ -93,8 +147,14 @@ class matrix
         //template <class U> //Never gets called if use matrix<U>
         matrix<T>& operator=(const matrix<T> &toCopy);
         matrix<T>& operator=(matrix<T> &&toMove);
+        //Deep-copies whatever a view points at into this matrix.
         template <class U>
+        void copy_from(const matrix_view<U> &source);
+        template <class E>
+        matrix<T>& operator=(const matrix_expr<E> &expr);
+        template <class U, class = typename std::enable_if<std::is_arithmetic<U>::value>::type>
         matrix<T>& operator=(const U value);
+        //These evaluate right away; the operators below are lazy.
         template <class U>
         const matrix<T> add (const matrix<U> &rhs) const;
         template <class U>
@@ -114,11 +174,11 @@ class matrix
         template <class U>
         const matrix<T> divide (const U value) const;
         inline void transpose_to(const matrix<T> &target) const;
-        double sum();
-        T max();
-        T min();
-        double mean();
-        double variance();
+        double sum() const;
+        T max() const;
+        T min() const;
+        double mean() const;
+        double variance() const;
 };
 
 template <class T>
@@ -136,131 +196,410 @@ double mean(matrix<T> &mat);
 template <class T>
 double variance(matrix<T> &mat);
 
-template <class T, class U>
-const matrix<T> operator+(const matrix<T> &mat1, const matrix<U> &mat2);
+//Lazily evaluated element-wise arithmetic.
+//The operators below don't compute anything; they build a small tree of expression nodes.
+//Assigning the tree to a matrix evaluates it in one parallel, vectorizable pass over the rows,
+// with no temporary matrices in between.
+//Nodes hold matrices by reference, so don't keep an expression (e.g. in an auto) beyond
+// the statement that built it.
+//Each node can bind to a row, giving something cheap that is indexable by column.
+template <class E>
+class matrix_expr
+{
+    public:
+        const E& self() const {return static_cast<const E&>(*this);}
+};
+
+template <class T>
+class matrix_leaf : public matrix_expr<matrix_leaf<T>>
+{
+    private:
+        const matrix<T> &mat;
+    public:
+        explicit matrix_leaf(const matrix<T> &matIn) : mat(matIn) {}
+        int nr() const {return mat.nr();}
+        int nc() const {return mat.nc();}
+        const T* row(const int r) const {return mat[r];}
+};
+
+//A scalar broadcast to any size; it reports its size as -1.
+template <class S>
+class matrix_scalar : public matrix_expr<matrix_scalar<S>>
+{
+    private:
+        S value;
+    public:
+        struct row_type
+        {
+            S value;
+            S operator[](const int) const {return value;}
+        };
+        explicit matrix_scalar(const S valueIn) : value(valueIn) {}
+        int nr() const {return -1;}
+        int nc() const {return -1;}
+        row_type row(const int) const {return row_type{value};}
+};
+
+struct matrix_op_add {template <class A, class B> static auto apply(A a, B b) -> decltype(a + b) {return a + b;}};
+struct matrix_op_sub {template <class A, class B> static auto apply(A a, B b) -> decltype(a - b) {return a - b;}};
+struct matrix_op_mul {template <class A, class B> static auto apply(A a, B b) -> decltype(a * b) {return a * b;}};
+struct matrix_op_div {template <class A, class B> static auto apply(A a, B b) -> decltype(a / b) {return a / b;}};
+
+template <class Op, class L, class R>
+class matrix_binary : public matrix_expr<matrix_binary<Op, L, R>>
+{
+    private:
+        L lhs;
+        R rhs;
+    public:
+        typedef decltype(std::declval<L>().row(0)) lhs_row;
+        typedef decltype(std::declval<R>().row(0)) rhs_row;
+        struct row_type
+        {
+            lhs_row l;
+            rhs_row r;
+            auto operator[](const int col) const -> decltype(Op::apply(l[col], r[col]))
+            {
+                return Op::apply(l[col], r[col]);
+            }
+        };
+        matrix_binary(const L &lhsIn, const R &rhsIn) : lhs(lhsIn), rhs(rhsIn)
+        {
+            assert(lhs.nr() < 0 || rhs.nr() < 0 || (lhs.nr() == rhs.nr() && lhs.nc() == rhs.nc()));
+        }
+        int nr() const {return lhs.nr() >= 0 ? lhs.nr() : rhs.nr();}
+        int nc() const {return lhs.nc() >= 0 ? lhs.nc() : rhs.nc();}
+        row_type row(const int r) const {return row_type{lhs.row(r), rhs.row(r)};}
+};
+
+//Turns each kind of operand into an expression node.
+template <class T>
+matrix_leaf<T> as_matrix_expr(const matrix<T> &mat) {return matrix_leaf<T>(mat);}
+template <class E>
+E as_matrix_expr(const matrix_expr<E> &expr) {return expr.self();}
+template <class S, class = typename std::enable_if<std::is_arithmetic<S>::value>::type>
+matrix_scalar<S> as_matrix_expr(const S value) {return matrix_scalar<S>(value);}
+
+template <class X>
+struct is_matrix_operand
+{
+    private:
+        template <class T> static std::true_type test(const matrix<T>*);
+        template <class E> static std::true_type test(const matrix_expr<E>*);
+        static std::false_type test(...);
+    public:
+        static const bool value = decltype(test(std::declval<const X*>()))::value;
+};
 
-template <class T, class U>
-const matrix<T> operator+(const U value, const matrix<T> &mat);
+template <class X>
+struct is_matrix_or_scalar
+{
+    static const bool value = is_matrix_operand<X>::value || std::is_arithmetic<X>::value;
+};
 
-template <class T, class U>
-const matrix<T> operator+(const matrix<T> &mat, const U value);
+template <class Op, class A, class B>
+using matrix_binary_of = matrix_binary<Op,
+        decltype(as_matrix_expr(std::declval<const A&>())),
+        decltype(as_matrix_expr(std::declval<const B&>()))>;
 
-template <class T, class U>
-const matrix<T> operator+=(matrix<T> &mat, const U value);
+//Element-wise +: matrices and expressions with each other or with scalars.
+template <class A, class B, class = typename std::enable_if<
+          (is_matrix_operand<A>::value && is_matrix_or_scalar<B>::value) ||
+          (is_matrix_or_scalar<A>::value && is_matrix_operand<B>::value)>::type>
+matrix_binary_of<matrix_op_add, A, B> operator+(const A &a, const B &b)
+{
+    return matrix_binary_of<matrix_op_add, A, B>(as_matrix_expr(a), as_matrix_expr(b));
+}
 
-template <class T, class U>
-const matrix<T> operator-(const matrix<T> &mat1, const matrix<U> &mat2);
+//Element-wise -, with the same operands as +.
+template <class A, class B, class = typename std::enable_if<
+          (is_matrix_operand<A>::value && is_matrix_or_scalar<B>::value) ||
+          (is_matrix_or_scalar<A>::value && is_matrix_operand<B>::value)>::type>
+matrix_binary_of<matrix_op_sub, A, B> operator-(const A &a, const B &b)
+{
+    return matrix_binary_of<matrix_op_sub, A, B>(as_matrix_expr(a), as_matrix_expr(b));
+}
 
-template <class T, class U>
-const matrix<T> operator-(const matrix<T> &mat, const U value);
+//Element-wise product of two matrices or expressions.
+template <class A, class B, class = typename std::enable_if<
+          is_matrix_operand<A>::value && is_matrix_operand<B>::value>::type>
+matrix_binary_of<matrix_op_mul, A, B> operator%(const A &a, const B &b)
+{
+    return matrix_binary_of<matrix_op_mul, A, B>(as_matrix_expr(a), as_matrix_expr(b));
+}
 
-template <class T, class U>
-const matrix<T> operator%(const matrix<T> &mat1, const matrix<U> &mat2);
+//Scaling by a scalar on either side.
+template <class A, class B, class = typename std::enable_if<
+          (is_matrix_operand<A>::value && std::is_arithmetic<B>::value) ||
+          (std::is_arithmetic<A>::value && is_matrix_operand<B>::value)>::type>
+matrix_binary_of<matrix_op_mul, A, B> operator*(const A &a, const B &b)
+{
+    return matrix_binary_of<matrix_op_mul, A, B>(as_matrix_expr(a), as_matrix_expr(b));
+}
 
-template <class T, class U>
-const matrix<T> operator*(const U value, const matrix<T> &mat);
+//Dividing by a scalar.
+template <class A, class B, class = typename std::enable_if<
+          is_matrix_operand<A>::value && std::is_arithmetic<B>::value>::type>
+matrix_binary_of<matrix_op_div, A, B> operator/(const A &a, const B &b)
+{
+    return matrix_binary_of<matrix_op_div, A, B>(as_matrix_expr(a), as_matrix_expr(b));
+}
 
-template <class T, class U>
-const matrix<T> operator*(const matrix<T> &mat, const U value);
+//In-place updates; these read and write each element in the same step, so aliasing is fine.
+template <class T, class U, class = typename std::enable_if<is_matrix_or_scalar<U>::value>::type>
+matrix<T>& operator+=(matrix<T> &mat, const U &value)
+{
+    return mat = mat + value;
+}
 
-template <class T, class U>
-const matrix<T> operator*=(matrix<T> &mat, const U value);
+template <class T, class U, class = typename std::enable_if<is_matrix_or_scalar<U>::value>::type>
+matrix<T>& operator-=(matrix<T> &mat, const U &value)
+{
+    return mat = mat - value;
+}
 
-template <class T, class U>
-const matrix<T> operator/(const matrix<T> &mat1, const U value);
+template <class T, class U, class = typename std::enable_if<std::is_arithmetic<U>::value>::type>
+matrix<T>& operator*=(matrix<T> &mat, const U value)
+{
+    return mat = mat * value;
+}
 
 // IMPLEMENTATION:
 
 template <class T>
-matrix<T>::matrix(const int nrows, const int ncols)
+int matrix<T>::stride_for(const int ncols, const MatrixLayout newLayout)
+{
+    if (newLayout == MatrixLayout::dense)
+    {
+        return ncols;
+    }
+    //Round each row up to a whole number of cache lines...
+    const int lineElements = std::max(1, int(MATRIX_ALIGNMENT/sizeof(T)));
+    int newStride = ((ncols + lineElements - 1)/lineElements)*lineElements;
+    //...and if that puts rows an exact multiple of 4K apart, skew by one more line.
+    if ((newStride*sizeof(T)) % MATRIX_PAGE_SIZE == 0)
+    {
+        newStride += lineElements;
+    }
+    return newStride;
+}
+
+//Gets aligned memory for the given size, leaving ptr, data, and the sizes set.
+//Big allocations come straight from mmap, with huge pages requested where available.
+//Their pages are first touched in parallel, row by row, with the same static split as
+// the "omp parallel for" loops that process them, so that on NUMA systems each
+// thread's rows end up in its own node's memory.
+template <class T>
+void matrix<T>::allocate(const int nrows, const int ncols, const MatrixLayout newLayout)
 {
-    assert(nrows >= 0 && ncols >= 0);
     num_rows = nrows;
     num_cols = ncols;
+    layout = newLayout;
+    stride = stride_for(ncols, newLayout);
+    ptr = nullptr;
+    data = nullptr;
+    ua_data = nullptr;
+    mapped_bytes = 0;
+    tag = nullptr;
+    tracked_bytes = 0;
     if (nrows == 0 || ncols == 0)
     {
-        ptr = nullptr;
-        data = nullptr;
-        ua_data = nullptr;
+        return;
     }
-    else
+
+    const std::size_t bytes = std::size_t(nrows)*std::size_t(stride)*sizeof(T);
+#if defined(__linux__)
+    if (bytes >= MATRIX_MMAP_THRESHOLD)
     {
-        std::size_t ua_num_elements = num_rows*num_cols + 16;
-        ua_data = new T[ua_num_elements];
+        void * mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+#ifdef MADV_HUGEPAGE
+            madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+            mapped_bytes = bytes;
+            data = static_cast<T*>(mem);//mmap is page-aligned, which is plenty
+
+            char * bytePtr = static_cast<char*>(mem);
+            const std::size_t rowBytes = std::size_t(stride)*sizeof(T);
+#pragma omp parallel for schedule(static)
+            for (int row = 0; row < nrows; row++)
+            {
+                char * rowStart = bytePtr + row*rowBytes;
+                for (std::size_t offset = 0; offset < rowBytes; offset += MATRIX_PAGE_SIZE)
+                {
+                    rowStart[offset] = 0;
+                }
+            }
+        }
+    }
+#endif
+    if (data == nullptr)
+    {
+        std::size_t ua_num_elements = std::size_t(nrows)*std::size_t(stride) + MATRIX_ALIGNMENT/sizeof(T) + 1;
+        ua_data = new (std::nothrow) T[ua_num_elements];
+        if (ua_data == nullptr)
+        {
+            std::cout << "matrix::set_size memory could not be alloc'd" << std::endl;
+            num_rows = 0;
+            num_cols = 0;
+            return;
+        }
+        std::size_t space = ua_num_elements*sizeof(T);
         void * buffer = ua_data;
-        void * aligned_ptr = std::align(16, sizeof(T), buffer, ua_num_elements);
-        data = static_cast<T*>(aligned_ptr);
-        //data = new T[nrows*ncols];
-        ptr = new T*[nrows];
-        for(int row = 0; row < nrows; row++)
-            ptr[row] = data + row*num_cols;
+        data = static_cast<T*>(std::align(MATRIX_ALIGNMENT, sizeof(T), buffer, space));
     }
+
+    ptr = new (std::nothrow) T*[nrows];
+    for(int row = 0; row < nrows; row++)
+        ptr[row] = data + std::size_t(row)*stride;
+
+    tag = currentBufferTag();
+    tracked_bytes = bytes;
+    tag->allocated(data, tracked_bytes, nrows, ncols);
 }
 
 template <class T>
-matrix<T>::matrix(const matrix<T> &toCopy)
+void matrix<T>::retag(BufferTag * newTag)
 {
-    if(this == &toCopy)
+    if (tag == nullptr || newTag == tag)
         return;
+    tag->released(data, tracked_bytes);
+    tag = newTag;
+    tag->allocated(data, tracked_bytes, num_rows, num_cols);
+}
+
+template <class T>
+bool matrix<T>::map_file(const std::string &path, const int nrows, const int ncols,
+                         const MatrixLayout layoutIn)
+{
+#if defined(__linux__)
+    const std::size_t bytes = std::size_t(nrows)*std::size_t(stride_for(ncols, layoutIn))*sizeof(T);
+    if (bytes == 0)
+        return false;
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    //Reading a mapping past the end of a file is a SIGBUS, so a short file is refused here.
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || std::size_t(fileStat.st_size) < bytes)
+    {
+        close(fd);
+        return false;
+    }
+    void * mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);//the mapping keeps the file alive
+    if (mem == MAP_FAILED)
+        return false;
+
+    release();
+    num_rows = nrows;
+    num_cols = ncols;
+    layout = layoutIn;
+    stride = stride_for(ncols, layoutIn);
+    mapped_bytes = bytes;
+    data = static_cast<T*>(mem);
+    ptr = new (std::nothrow) T*[nrows];
+    for(int row = 0; row < nrows; row++)
+        ptr[row] = data + std::size_t(row)*stride;
 
-    num_rows = toCopy.num_rows;
-    num_cols = toCopy.num_cols;
+    tag = currentBufferTag();
+    tracked_bytes = bytes;
+    tag->allocated(data, tracked_bytes, nrows, ncols);
+    return true;
+#else
+    (void)path; (void)nrows; (void)ncols; (void)layoutIn;
+    return false;
+#endif
+}
 
-    std::size_t ua_num_elements = num_rows*num_cols + 16;
-    ua_data = new T[ua_num_elements];
-    void * buffer = ua_data;
-    void * aligned_ptr = std::align(16, sizeof(T), buffer, ua_num_elements);
-    data = static_cast<T*>(aligned_ptr);
-    //data = new T[num_rows*num_cols];
+template <class T>
+void matrix<T>::release()
+{
+    if (tag)
+        tag->released(data, tracked_bytes);
+    tag = nullptr;
+    tracked_bytes = 0;
+#if defined(__linux__)
+    if (mapped_bytes)
+        munmap(data, mapped_bytes);
+#endif
+    if(ua_data)
+        delete [] ua_data;
+    if(ptr)
+        delete [] ptr;
+    ptr = nullptr;
+    data = nullptr;
+    ua_data = nullptr;
+    mapped_bytes = 0;
+}
 
-    ptr = new T*[num_rows];
+template <class T>
+matrix<T>::matrix(const int nrows, const int ncols, const MatrixLayout layoutIn)
+{
+    assert(nrows >= 0 && ncols >= 0);
+    allocate(nrows, ncols, layoutIn);
+}
+
+template <class T>
+matrix<T>::matrix(const matrix<T> &toCopy)
+{
+    allocate(toCopy.num_rows, toCopy.num_cols, toCopy.layout);
+
+#pragma omp parallel for
     for(int row = 0; row < num_rows; row++)
-        ptr[row] = data + row*num_cols;
+        for(int col = 0; col < num_cols; col++)
+            ptr[row][col] = toCopy.ptr[row][col];
+}
+
+template <class T> template <class E>
+matrix<T>::matrix(const matrix_expr<E> &expr)
+{
+    allocate(expr.self().nr(), expr.self().nc(), MatrixLayout::dense);
+    *this = expr;
+}
+
+template <class T> template <class E>
+matrix<T>& matrix<T>::operator=(const matrix_expr<E> &expr)
+{
+    const E &e = expr.self();
+    //If the expression refers to this matrix, the size already matches, so nothing moves.
+    set_size(e.nr(), e.nc());
 
 #pragma omp parallel for
     for(int row = 0; row < num_rows; row++)
+    {
+        const auto in = e.row(row);
+        T* out = ptr[row];
+#pragma omp simd
         for(int col = 0; col < num_cols; col++)
-            data[row*num_cols + col] =
-                toCopy.data[row*num_cols + col];
+            out[col] = static_cast<T>(in[col]);
+    }
+    return *this;
 }
 
 template <class T>
 matrix<T>::~matrix()
 {
-    if(ua_data)
-        delete [] ua_data;
-    if(ptr)
-        delete [] ptr;
+    release();
 }
 
 template <class T>
 void matrix<T>::set_size(const int nrows, const int ncols)
+{
+    set_size(nrows, ncols, layout);
+}
+
+template <class T>
+void matrix<T>::set_size(const int nrows, const int ncols, const MatrixLayout layoutIn)
 {
     assert(nrows >= 0 && ncols >= 0);
-    if (num_rows == nrows && num_cols == ncols) {
+    if (num_rows == nrows && num_cols == ncols && layout == layoutIn) {
         return;
     }
 
-    num_rows = nrows;
-    num_cols = ncols;
-    if(ua_data)
-        delete [] ua_data;
-    if(ptr)
-        delete [] ptr;
-    std::size_t ua_num_elements = num_rows*num_cols + 16;
-    ua_data = new (std::nothrow) T[ua_num_elements];
-    if (ua_data == nullptr)
-        std::cout << "matrix::set_size memory could not be alloc'd" << std::endl;
-    void * buffer = ua_data;
-    void * aligned_ptr = std::align(16, sizeof(T), buffer, ua_num_elements);
-    data = static_cast<T*>(aligned_ptr);
-    //data = new (std::nothrow) T[nrows*ncols];
-    //if (data == nullptr)
-    //    std::cout << "matrix::set_size memory could not be alloc'd" << std::endl;
-
-    ptr = new (std::nothrow) T*[nrows];
-    for(int row = 0; row < nrows; row++)
-        ptr[row] = data + row*num_cols;
+    release();
+    allocate(nrows, ncols, layoutIn);
 }
 
 template <class T>
@@ -285,7 +624,7 @@ template <class T>
 T& matrix<T>::operator()(const int row, const int col) const
 {
     assert(row < num_rows && col < num_cols);
-    return data[row*num_cols + col];
+    return data[std::size_t(row)*stride + col];
 }
 
 template <class T> //template<class U>
@@ -294,13 +633,12 @@ matrix<T>& matrix<T>::operator=(const matrix<T> &toCopy)
     if(this == &toCopy)
         return *this;
 
-    set_size(toCopy.nr(),toCopy.nc());
+    set_size(toCopy.nr(),toCopy.nc(),toCopy.layout);
 
 #pragma omp parallel for shared(toCopy)
     for(int row = 0; row < num_rows; row++)
         for(int col = 0; col < num_cols; col++)
-            data[row*num_cols + col] =
-                toCopy.data[row*num_cols + col];
+            ptr[row][col] = toCopy.ptr[row][col];
     return *this;
 }
 
@@ -308,18 +646,26 @@ template <class T> //template<class U>
 matrix<T>& matrix<T>::operator=(matrix<T> &&toMove)
 {
     if(this != &toMove) {
-        delete [] ua_data;
+        release();
         ua_data = toMove.ua_data;
         toMove.ua_data = nullptr;
         data = toMove.data;
         toMove.data = nullptr;
-        delete [] ptr;
+        mapped_bytes = toMove.mapped_bytes;
+        toMove.mapped_bytes = 0;
+        tag = toMove.tag;
+        toMove.tag = nullptr;
+        tracked_bytes = toMove.tracked_bytes;
+        toMove.tracked_bytes = 0;
         ptr = toMove.ptr;
         toMove.ptr = nullptr;
         num_rows = toMove.num_rows;
         toMove.num_rows = 0;
         num_cols = toMove.num_cols;
         toMove.num_cols = 0;
+        stride = toMove.stride;
+        toMove.stride = 0;
+        layout = toMove.layout;
     }
     return *this;
 }
@@ -343,149 +689,77 @@ void matrix<T>::swap(matrix<T> &swapTarget)
         auto temp_nc = num_cols;
         num_cols = swapTarget.num_cols;
         swapTarget.num_cols = temp_nc;
+        std::swap(mapped_bytes, swapTarget.mapped_bytes);
+        std::swap(tag, swapTarget.tag);
+        std::swap(tracked_bytes, swapTarget.tracked_bytes);
+        std::swap(stride, swapTarget.stride);
+        std::swap(layout, swapTarget.layout);
     }
 }
 
-template <class T> template<class U>
+template <class T> template<class U, class>
 matrix<T>& matrix<T>::operator=(const U value)
 {
 
 #pragma omp parallel for
     for(int row = 0; row < num_rows; row++)
         for(int col = 0; col < num_cols; col++)
-            data[row*num_cols + col] = value;
+            ptr[row][col] = value;
     return *this;
 }
 
 template <class T> template<class U>
 const matrix<T> matrix<T>::add(const matrix<U> &rhs) const
 {
-    assert(num_rows == rhs.num_rows && num_cols == rhs.num_cols);
-    matrix<T> result(num_rows,num_cols);
-
-    T* pdata = data;
-    int pnum_cols = num_cols;
-#pragma omp parallel for shared(pdata,pnum_cols,result,rhs)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] +
-                rhs.data[row*num_cols + col];
-    return result;
+    return matrix<T>(*this + rhs);
 }
 
 template <class T> template<class U>
 const matrix<T> matrix<T>::add(const U value) const
 {
-    matrix<T> result(num_rows,num_cols);
-
-    T* pdata = data;
-    int pnum_cols = num_cols;
-#pragma omp parallel for shared(pdata,pnum_cols)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] +
-                value;
-    return result;
+    return matrix<T>(*this + value);
 }
 
 template <class T> template<class U>
 const matrix<T>& matrix<T>::add_this(const U value)
 {
-    T* pdata = data;
-    int pnum_cols = num_cols;
-#pragma omp parallel for shared(pdata,pnum_cols)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            data[row*num_cols + col] += value;
-    return *this;
+    return *this = *this + value;
 }
 
 template <class T> template<class U>
 const matrix<T> matrix<T>::subtract(const matrix<U> &rhs) const
 {
-    assert(num_rows == rhs.num_rows && num_cols == rhs.num_cols);
-    matrix<T> result(num_rows,num_cols);
-
-    T* pdata = data;
-    int pnum_cols = num_cols;
-#pragma omp parallel for shared(pdata,pnum_cols,result,rhs)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] -
-                rhs.data[row*num_cols + col];
-    return result;
+    return matrix<T>(*this - rhs);
 }
 
 template <class T> template<class U>
 const matrix<T> matrix<T>::subtract(const U value) const
 {
-    matrix<T> result(num_rows,num_cols);
-
-    T* pdata = data;
-    int pnum_cols = num_cols;
-#pragma omp parallel for shared(pdata,pnum_cols,result)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] +
-                value;
-    return result;
+    return matrix<T>(*this - value);
 }
 
 template <class T> template <class U>
 const matrix<T> matrix<T>::pointmult(const matrix<U> &rhs) const
 {
-    matrix<T> result(num_rows,num_cols);
-
-#pragma omp parallel for shared(result,rhs)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] *
-                rhs.data[row*num_cols + col];
-    return result;
+    return matrix<T>(*this % rhs);
 }
 
 template <class T> template<class U>
 const matrix<T> matrix<T>::mult(const U value) const
 {
-    matrix<T> result(num_rows,num_cols);
-
-#pragma omp parallel for shared(result)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] *
-                value;
-    return result;
+    return matrix<T>(*this * value);
 }
 
 template <class T> template<class U>
 const matrix<T>& matrix<T>::mult_this(const U value)
 {
-
-#pragma omp parallel for
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            data[row*num_cols + col] *= value;
-    return *this;
+    return *this = *this * value;
 }
 
 template <class T> template<class U>
 const matrix<T> matrix<T>::divide(const U value) const
 {
-    matrix<T> result(num_rows,num_cols);
-
-#pragma omp parallel for shared(result)
-    for(int row = 0; row < num_rows; row++)
-        for(int col = 0; col < num_cols; col++)
-            result.data[row*num_cols + col] =
-                data[row*num_cols + col] /
-                value;
-    return result;
+    return matrix<T>(*this / value);
 }
 
 template <class T>
@@ -496,8 +770,8 @@ inline void matrix<T>::slow_transpose_to (const matrix<T> &target) const
 #pragma omp parallel for shared(target)
     for(int row = 0; row < num_rows; row++)
         for(int col = 0; col < num_cols; col++)
-            target.data[col*num_rows + row] =
-                data[row*num_cols + col];
+            target.ptr[col][row] =
+                ptr[row][col];
 }
 
 #ifdef __SSE2__
@@ -507,7 +781,7 @@ inline void matrix<float>::fast_transpose_to (const matrix<float> &target) const
     assert(target.num_rows == num_cols && target.num_cols == num_rows);
 
     transpose_block_SSE4x4(data,target.data,num_rows,num_cols,
-                           num_cols,num_rows, 16);
+                           stride,target.stride, 16);
 }
 
 //There is no fast transpose in the general case
@@ -594,62 +868,90 @@ inline void matrix<T>::transpose_block(float *A, float *B, const int n, const in
     }
 }
 
+//The reductions split rows across threads and vectorize along each row.
 template <class T>
-double matrix<T>::sum()
+double matrix<T>::sum() const
 {
     double sum = 0;
 
 #pragma omp parallel for reduction(+:sum)
     for(int row = 0; row < num_rows; row++)
+    {
+        const T* in = ptr[row];
+        double rowSum = 0;
+#pragma omp simd reduction(+:rowSum)
         for(int col = 0; col < num_cols; col++)
-            sum += data[row*num_cols + col];
+            rowSum += in[col];
+        sum += rowSum;
+    }
     return sum;
 }
 
 template <class T>
-T matrix<T>::max()
+T matrix<T>::max() const
 {
-    T max = std::numeric_limits<T>::min();
+    T max = std::numeric_limits<T>::lowest();
 
-    #pragma omp parallel for reduction(max:max) schedule(dynamic,16)
+    #pragma omp parallel for reduction(max:max)
     for(int row = 0; row < num_rows; row++)
+    {
+        const T* in = ptr[row];
+        T rowMax = std::numeric_limits<T>::lowest();
+#pragma omp simd reduction(max:rowMax)
         for(int col = 0; col < num_cols; col++)
-            max = std::max(data[row*num_cols + col],max);
+            rowMax = in[col] > rowMax ? in[col] : rowMax;
+        max = std::max(rowMax, max);
+    }
     return max;
 }
 
 
 template <class T>
-T matrix<T>::min()
+T matrix<T>::min() const
 {
     T min = std::numeric_limits<T>::max();
 
-    #pragma omp parallel for reduction(min:min) schedule(dynamic,16)
+    #pragma omp parallel for reduction(min:min)
     for(int row = 0; row < num_rows; row++)
+    {
+        const T* in = ptr[row];
+        T rowMin = std::numeric_limits<T>::max();
+#pragma omp simd reduction(min:rowMin)
         for(int col = 0; col < num_cols; col++)
-            min = std::min(data[row*num_cols + col],min);
+            rowMin = in[col] < rowMin ? in[col] : rowMin;
+        min = std::min(rowMin, min);
+    }
     return min;
 }
 
 template <class T>
-double matrix<T>::mean()
+double matrix<T>::mean() const
 {
     assert(num_rows > 0 && num_cols > 0);
-    double size = num_rows*num_cols;
+    double size = double(num_rows)*num_cols;
     return sum()/size;
 }
 
 template <class T>
-double matrix<T>::variance()
+double matrix<T>::variance() const
 {
     double m = mean();
-    double size = num_rows*num_cols;
+    double size = double(num_rows)*num_cols;
     double variance = 0;
 
 #pragma omp parallel for reduction(+:variance)
     for(int row = 0; row < num_rows; row++)
+    {
+        const T* in = ptr[row];
+        double rowVariance = 0;
+#pragma omp simd reduction(+:rowVariance)
         for(int col = 0; col < num_cols; col++)
-             variance += pow(data[row*num_cols+col]-m,2);
+        {
+            const double d = in[col] - m;
+            rowVariance += d*d;
+        }
+        variance += rowVariance;
+    }
     return variance/size;
 }
 
@@ -686,70 +988,102 @@ double variance(matrix<T> &mat)
     return mat.variance();
 }
 
-template <class T, class U>
-const matrix<T> operator+(const matrix<T> &mat1, const matrix<U> &mat2)
-{
-    return mat1.add(mat2);
-}
-
-template <class T, class U>
-const matrix<T> operator+(const U value, const matrix<T> &mat)
-{
-    return mat.add(value);
-}
-
-template <class T, class U>
-const matrix<T> operator+(const matrix<T> &mat, const U value)
-{
-    return mat.add(value);
-}
-
-template <class T, class U>
-const matrix<T> operator+=(matrix<T> &mat, const U value)
-{
-    return mat.add_this(value);
-}
-
-template <class T, class U>
-const matrix<T> operator-(const matrix<T> &mat1, const matrix<U> &mat2)
-{
-    return mat1.subtract(mat2);
-}
-
-template <class T, class U>
-const matrix<T> operator-(const matrix<T> &mat, const U value)
-{
-    return mat.subtact(value);
-}
-
-template <class T, class U>
-const matrix<T> operator%(const matrix<T> &mat1, const matrix<U> &mat2)
+//A non-owning window onto some matrix's storage: an origin, an extent, and a row stride.
+//With a column step of 3 over an interleaved RGB matrix, it sees a single color plane.
+//It doesn't keep the matrix alive, and it goes stale if the matrix gets reallocated,
+// so only hold onto one for as long as the matrix is known not to change.
+//Use matrix_view<const T> for read-only access.
+template <class T>
+class matrix_view
 {
-    return mat1.pointmult(mat2);
-}
+    private:
+        typedef typename std::remove_const<T>::type value_type;
+        T* origin;
+        int num_rows;
+        int num_cols;
+        int stride;//distance between rows, in elements
+        int step;//distance between columns, in elements
+    public:
+        matrix_view() : origin(nullptr), num_rows(0), num_cols(0), stride(0), step(1) {}
+        matrix_view(T* originIn, const int nrows, const int ncols,
+                    const int strideIn, const int stepIn = 1)
+            : origin(originIn), num_rows(nrows), num_cols(ncols), stride(strideIn), step(stepIn) {}
+        //The whole matrix. These are implicit so that a matrix can be passed
+        // wherever a view is accepted.
+        matrix_view(matrix<value_type> &mat)
+            : origin(mat.nr() > 0 ? mat[0] : nullptr), num_rows(mat.nr()), num_cols(mat.nc()),
+              stride(mat.row_stride()), step(1) {}
+        //Only views of const T can look at a const matrix.
+        template <class U = T, typename std::enable_if<std::is_const<U>::value, int>::type = 0>
+        matrix_view(const matrix<value_type> &mat)
+            : origin(mat.nr() > 0 ? mat[0] : nullptr), num_rows(mat.nr()), num_cols(mat.nc()),
+              stride(mat.row_stride()), step(1) {}
+        //Read-write views convert to read-only ones.
+        operator matrix_view<const value_type>() const
+        {
+            return matrix_view<const value_type>(origin, num_rows, num_cols, stride, step);
+        }
 
-template <class T, class U>
-const matrix<T> operator*(const U value, const matrix<T> &mat)
-{
-    return mat.mult(value);
-}
+        int nr() const {return num_rows;}
+        int nc() const {return num_cols;}
+        int row_stride() const {return stride;}
+        int col_step() const {return step;}
+        //True if each row's elements are adjacent, so rows can be memcpy'd.
+        bool contiguous_rows() const {return step == 1;}
 
-template <class T, class U>
-const matrix<T> operator*(const matrix<T> &mat, const U value)
-{
-    return mat.mult(value);
-}
+        T& operator()(const int row, const int col) const
+        {
+            assert(row < num_rows && col < num_cols);
+            return origin[std::ptrdiff_t(row)*stride + std::ptrdiff_t(col)*step];
+        }
+        T* operator[](const int row) const
+        {
+            return origin + std::ptrdiff_t(row)*stride;
+        }
 
-template <class T, class U>
-const matrix<T> operator*=(matrix<T> &mat, const U value)
-{
-    return mat.mult_this(value);
-}
+        //A rectangle of this view, in this view's element coordinates.
+        matrix_view<T> sub(const int startRow, const int startCol,
+                           const int nrows, const int ncols) const
+        {
+            assert(startRow + nrows <= num_rows && startCol + ncols <= num_cols);
+            return matrix_view<T>(origin + std::ptrdiff_t(startRow)*stride + std::ptrdiff_t(startCol)*step,
+                                  nrows, ncols, stride, step);
+        }
+        //A rectangle of an interleaved image, in pixel coordinates.
+        matrix_view<T> crop(const int startX, const int startY,
+                            const int width, const int height,
+                            const int channels = 3) const
+        {
+            return sub(startY, startX*channels, height, width*channels);
+        }
+        //One channel of an interleaved image, as a plane.
+        matrix_view<T> channel(const int c, const int channels = 3) const
+        {
+            return matrix_view<T>(origin + std::ptrdiff_t(c)*step,
+                                  num_rows, num_cols/channels, stride, step*channels);
+        }
+};
 
-template <class T, class U>
-const matrix<T> operator/(const matrix<T> &mat, const U value)
+template <class T>
+template <class U>
+void matrix<T>::copy_from(const matrix_view<U> &source)
 {
-    return mat.divide(value);
+    set_size(source.nr(), source.nc());
+    const bool memcopy = source.contiguous_rows() &&
+            std::is_same<typename std::remove_const<U>::type, T>::value;
+#pragma omp parallel for
+    for (int row = 0; row < num_rows; row++)
+    {
+        if (memcopy)
+        {
+            std::memcpy(ptr[row], source[row], num_cols*sizeof(T));
+        }
+        else
+        {
+            for (int col = 0; col < num_cols; col++)
+                ptr[row][col] = source(row, col);
+        }
+    }
 }
 
 #endif //MATRIX_H
@@ -18,86 +18,127 @@
  */
 #include "filmSim.hpp"
 
-void rotate_image(matrix<float> &input, matrix<float> &output,
-                  int rotation)
+//Edge length of the square tiles used for the quarter-turn cases.
+//32x32 pixels of 3 floats is 12 KiB per tile, so both the source and the
+// destination tile stay in L1 while we walk across the transposition.
+#define ROTATE_TILE 32
+
+//Rotates the image by a multiple of 90 degrees and crops it in a single pass.
+//startX, startY, width, and height are in the coordinates of the rotated image,
+// and we only ever touch the source pixels that land inside the crop.
+void rotate_and_crop(const matrix_view<const float> &input, matrix<float> &output,
+                     const int rotation,
+                     const int startX, const int startY,
+                     const int width, const int height)
 {
-    int nrows, ncols;
-    nrows = input.nr();
-    ncols = input.nc();
+    assert(input.contiguous_rows());
+    const int inRows = input.nr();
+    const int inCols = input.nc()/3;
+
+    output.set_size(height, width*3);
 
+    const CancelToken &cancel = currentCancelToken();
     switch(rotation)
     {
         case 2://upside down
-            output.set_size(nrows,ncols);
-            for(int i = 0; i < nrows; i++)
+            //Rows stay rows, so we just walk both in reverse.
+            #pragma omp parallel for
+            for (int i = 0; i < height; i++)
             {
-                // out   in
-                /* 12345 00000
-                 * 00000 00000
-                 * 00000 54321
-                 */
+                if (cancel.cancelled())
+                {
+                    continue;
+                }
                 //Reversing the row index
-                int r = nrows-1-i;
-                for(int j = 0; j < ncols; j = j + 3)
+                const int r = inRows - 1 - (startY + i);
+                const float * __restrict inRow = input[r];
+                float * __restrict outRow = output[i];
+                for (int j = 0; j < width; j++)
                 {
                     //Reversing the column index
-                    int c = ncols - 3 - j;
-                    output(i,j  ) = input(r,c  );
-                    output(i,j+1) = input(r,c+1);
-                    output(i,j+2) = input(r,c+2);
+                    const int c = 3*(inCols - 1 - (startX + j));
+                    outRow[3*j  ] = inRow[c  ];
+                    outRow[3*j+1] = inRow[c+1];
+                    outRow[3*j+2] = inRow[c+2];
                 }
             }
             break;
         case 3://right side down
-            output.set_size(ncols/3,nrows*3);
-            for(int j = 0; j < ncols/3; j++)
+        case 1://left side down
+        {
+            //Output rows are input columns, so walking it naively strides down
+            // the input one row per pixel. We instead go tile by tile, so that
+            // the few input rows feeding one tile remain in cache.
+            const int tileRows = (height + ROTATE_TILE - 1)/ROTATE_TILE;
+            const int tileCols = (width  + ROTATE_TILE - 1)/ROTATE_TILE;
+            #pragma omp parallel for collapse(2)
+            for (int ti = 0; ti < tileRows; ti++)
+            {
+                for (int tj = 0; tj < tileCols; tj++)
                 {
-                    //index of an output row as a column on the input matrix
-                    // out   in
-                    /* 123   30000
-                     * 000   20000
-                     * 000   10000
-                     * 000
-                     * 000
-                     */
-                    //Remember that the columns are interlaced.
-                    int c = j*3;
-                    for(int i = 0; i < nrows; i++)
+                    if (cancel.cancelled())
+                    {
+                        continue;
+                    }
+                    const int iEnd = min(height, (ti+1)*ROTATE_TILE);
+                    const int jEnd = min(width,  (tj+1)*ROTATE_TILE);
+                    //We iterate over the output columns in the outer loop so
+                    // that each source row is read contiguously.
+                    for (int j = tj*ROTATE_TILE; j < jEnd; j++)
                     {
-                        //Also, in this case, the order is reversed for the rows of the input.
-                        int r = nrows-1-i;
-                        output(j,i*3  ) = input(r,c  );
-                        output(j,i*3+1) = input(r,c+1);
-                        output(j,i*3+2) = input(r,c+2);
+                        //Case 3: output (y, x) comes from input (H-1-x, y)
+                        //Case 1: output (y, x) comes from input (x, W-1-y)
+                        const int r = (rotation == 3) ? inRows - 1 - (startX + j) : startX + j;
+                        const float * __restrict inRow = input[r];
+                        for (int i = ti*ROTATE_TILE; i < iEnd; i++)
+                        {
+                            const int c = (rotation == 3) ? 3*(startY + i) : 3*(inCols - 1 - (startY + i));
+                            output(i, 3*j  ) = inRow[c  ];
+                            output(i, 3*j+1) = inRow[c+1];
+                            output(i, 3*j+2) = inRow[c+2];
+                        }
                     }
                 }
+            }
             break;
-        case 1://left side down
-            output.set_size(ncols/3,nrows*3);
-            for(int j = 0; j < ncols/3; j++)
+        }
+        default://no rotation, this is just a crop
+            #pragma omp parallel for
+            for (int i = 0; i < height; i++)
             {
-                //index of an output row as a column on the input matrix
-                // out   in
-                /* 123   00001
-                 * 000   00002
-                 * 000   00003
-                 * 000
-                 * 000
-                 */
-                //Remember that the columns are interlaced, and scanned in reverse.
-                int c = ncols - 3 - j*3;
-                for(int i = 0; i < nrows; i++)
+                if (cancel.cancelled())
+                {
+                    continue;
+                }
+                const float * __restrict inRow = input[startY + i] + 3*startX;
+                float * __restrict outRow = output[i];
+                for (int j = 0; j < width*3; j++)
                 {
-                    //Here the order is not reversed for the rows of the input.
-                    int r = i;
-                    output(j,i*3  ) = input(r,c  );
-                    output(j,i*3+1) = input(r,c+1);
-                    output(j,i*3+2) = input(r,c+2);
+                    outRow[j] = inRow[j];
                 }
             }
-            break;
-        default:
-            output = input;
+    }
+}
+
+void rotate_image(matrix<float> &input, matrix<float> &output,
+                  int rotation)
+{
+    int nrows, ncols;
+    nrows = input.nr();
+    ncols = input.nc()/3;
+
+    if (rotation == 1 || rotation == 3)
+    {
+        std::swap(nrows, ncols);
+    }
+
+    if (rotation == 1 || rotation == 2 || rotation == 3)
+    {
+        rotate_and_crop(input, output, rotation, 0, 0, ncols, nrows);
+    }
+    else
+    {
+        output = input;
     }
 
     return;
@@ -13,7 +13,7 @@ void downscaleDivisible1D(const matrix<T> &input,
                           const bool interleaved);
 
 template <typename T>
-void downscaleBilinear1D(const matrix<T> &input,
+void downscaleBilinear1D(const matrix_view<const T> &input,
                          matrix<T> &output,
                          const int start,
                          const int end,
@@ -28,7 +28,7 @@ void upscaleBilinear1D(const matrix<T> input,
 
 
 //Scales the input to the output to fit within the output sizes.
-void downscale_and_crop(const matrix<float> &input,
+void downscale_and_crop(const matrix_view<const float> &input,
                         matrix<float> &output,
                         const int inputStartX,
                         const int inputStartY,
@@ -50,35 +50,16 @@ void downscale_and_crop(const matrix<float> &input,
     const double overallScaleFactor = max(double(inputXSize)/double(outputXSize),double(inputYSize)/double(outputYSize));
     if (overallScaleFactor == 1)
     {
-        if ((outputXSize == input.nc()/3) && (outputYSize == input.nr()))
-        {
-            // no scale and no crop
-            output = input;
-            return;
-        } else {
-            // crop only, no scale
-            output.set_size(outputYSize, outputXSize*3);
-            #pragma omp parallel for shared(output)
-            for (int i = 0; i < outputYSize; i++)
-            {
-                int iin = inputStartY + i;
-                for (int j = 0; j < outputXSize*3; j += 3)
-                {
-                    int jin = 3*inputStartX + j;
-                    output(i, j  ) = input(iin, jin  );
-                    output(i, j+1) = input(iin, jin+1);
-                    output(i, j+2) = input(iin, jin+2);
-                }
-            }
-            return;
-        }
+        //No scale, so at most a crop: copy the rows straight out of a view.
+        output.copy_from(input.crop(inputStartX, inputStartY, outputXSize, outputYSize));
+        return;
     }
     const int integerScaleFactor = floor(overallScaleFactor);
 
     //Downscale in one direction
     matrix<float> bilinearX;
     matrix<float> bothX;
-    downscaleBilinear1D(input,bilinearX,inputStartX,inputEndX,overallScaleFactor,true);
+    downscaleBilinear1D<float>(input,bilinearX,inputStartX,inputEndX,overallScaleFactor,true);
     if (integerScaleFactor != 1)
     {
         downscaleDivisible1D(bilinearX,bothX,integerScaleFactor,true);
@@ -93,7 +74,7 @@ void downscale_and_crop(const matrix<float> &input,
     //Then downscale in the other direction.
     matrix<float> bothXTransposedBilinearY;
     matrix<float> bothXTransposedBothY;
-    downscaleBilinear1D(bothXTransposed,bothXTransposedBilinearY,inputStartY,inputEndY,overallScaleFactor,false);
+    downscaleBilinear1D<float>(bothXTransposed,bothXTransposedBilinearY,inputStartY,inputEndY,overallScaleFactor,false);
     if (integerScaleFactor != 1)
     {
         downscaleDivisible1D(bothXTransposedBilinearY,bothXTransposedBothY,integerScaleFactor,false);
@@ -128,10 +109,16 @@ void downscaleDivisible1D(const matrix<T> &input,
     }
     output.set_size(outputNumRows,outputNumCols);
 
+    const CancelToken &cancel = currentCancelToken();
     if (interleaved)
     {
         #pragma omp parallel for shared(output)
         for (int i = 0; i < outputNumRows; i++)
+        {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             for (int j = 0; j < outputNumCols; j = j+3)
             {
                 double sumR = 0;
@@ -147,11 +134,17 @@ void downscaleDivisible1D(const matrix<T> &input,
                 output(i,j+1) = sumG/scaleFactor;
                 output(i,j+2) = sumB/scaleFactor;
             }
+        }
     }
     else
     {
         #pragma omp parallel for shared(output)
         for (int i = 0; i < outputNumRows; i++)
+        {
+            if (cancel.cancelled())
+            {
+                continue;
+            }
             for (int j = 0; j < outputNumCols; j++)
             {
                 double sum = 0;
@@ -161,6 +154,7 @@ void downscaleDivisible1D(const matrix<T> &input,
                 }
                 output(i,j) = sum/scaleFactor;
             }
+        }
     }
     return;
 }
@@ -169,7 +163,7 @@ void downscaleDivisible1D(const matrix<T> &input,
 //The scaling factor is computed from the overall scale factor such that it ends up an integer multiple
 // of the desired final size.
 template <typename T>
-void downscaleBilinear1D(const matrix<T> &input,
+void downscaleBilinear1D(const matrix_view<const T> &input,
                          matrix<T> &output,
                          const int start,
                          const int end,
@@ -196,9 +190,14 @@ void downscaleBilinear1D(const matrix<T> &input,
     else
         output.set_size(outputNumRows,outputNumCols);
 
+    const CancelToken &cancel = currentCancelToken();
     #pragma omp parallel for shared(output)
     for (int i = 0; i < outputNumRows; i++)
     {
+        if (cancel.cancelled())
+        {
+            continue;
+        }
         for (int j = 0; j < outputNumCols; j++)
         {
             const double inputPoint = (double(j) + 0.5)*scaleFactor -0.5 + double(start);
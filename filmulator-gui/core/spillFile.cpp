@@ -0,0 +1,126 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "spillFile.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#if (defined(_WIN32) || defined(__WIN32__))
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+std::mutex directoryMutex;
+std::string directory;
+
+}
+
+std::atomic<std::size_t> SpillFile::pendingBytes(0);
+
+SpillFile::~SpillFile()
+{
+    discard();
+}
+
+void SpillFile::setDirectory(const std::string &dir)
+{
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    directory = dir;
+}
+
+bool SpillFile::enabled()
+{
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    return !directory.empty();
+}
+
+std::size_t SpillFile::writebackBytes()
+{
+    return pendingBytes.load();
+}
+
+//Names are unique to this process, so that two running copies don't collide.
+std::string SpillFile::newPath()
+{
+    static std::atomic<unsigned> counter(0);
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    return directory + "/spill-" + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".bin";
+}
+
+bool SpillFile::finish()
+{
+    if (writeback.valid() && !writeback.get())
+    {
+        cout << "SpillFile::finish: could not write " << path << endl;
+        removeFile(path);
+        path.clear();
+        return false;
+    }
+    return true;
+}
+
+void SpillFile::discard()
+{
+    if (!held())
+    {
+        return;
+    }
+    if (writeback.valid())
+    {
+        writeback.wait();//the file is still open on the writeback thread
+        writeback = std::future<bool>();
+    }
+    removeFile(path);
+    path.clear();
+}
+
+bool SpillFile::writeFile(const std::string &path, const char * buffer, const std::size_t bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+    file.write(buffer, std::streamsize(bytes));
+    file.close();
+    return !file.fail();
+}
+
+bool SpillFile::readFile(const std::string &path, char * buffer, const std::size_t bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    file.read(buffer, std::streamsize(bytes));
+    return std::size_t(file.gcount()) == bytes;
+}
+
+void SpillFile::removeFile(const std::string &path)
+{
+    std::remove(path.c_str());
+}
@@ -0,0 +1,143 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include "matrix.hpp"
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <string>
+
+//Keeps an image buffer in a scratch file while it's out of memory.
+//Writing happens on a background thread, which owns the buffer and frees it once written.
+//Reading back maps the file where possible, so pages only come in as they're touched.
+//The file is kept until discard(), so a buffer that's unchanged since it was last written
+// can be dropped again without writing it a second time.
+class SpillFile
+{
+public:
+    SpillFile() {}
+    SpillFile(SpillFile &&) = default;
+    SpillFile& operator=(SpillFile &&) = default;
+    ~SpillFile();
+
+    //Where spill files go. Spilling is off until this is set to a writable directory.
+    static void setDirectory(const std::string &dir);
+    static bool enabled();
+
+    //Bytes handed to writeback threads and not yet freed.
+    static std::size_t writebackBytes();
+
+    //Takes the image's memory and writes it out in the background.
+    template <class T>
+    void spill(matrix<T> &image);
+
+    //Waits for any writeback, then brings the image back.
+    //Returns false if there's no usable copy on disk.
+    template <class T>
+    bool restore(matrix<T> &image);
+
+    //Whether there's a copy on disk, or one on its way there.
+    bool held() const {return !path.empty();}
+
+    //Deletes the file; for when the buffer it holds has gone stale.
+    void discard();
+
+private:
+    //Waits for the writeback; false if it failed.
+    bool finish();
+    static std::string newPath();
+    static bool writeFile(const std::string &path, const char * buffer, const std::size_t bytes);
+    static bool readFile(const std::string &path, char * buffer, const std::size_t bytes);
+    static void removeFile(const std::string &path);
+
+    static std::atomic<std::size_t> pendingBytes;
+
+    std::string path;
+    std::future<bool> writeback;
+    std::size_t elementSize = 0;
+    int rows = 0;
+    int cols = 0;
+    MatrixLayout layout = MatrixLayout::dense;
+};
+
+template <class T>
+void SpillFile::spill(matrix<T> &image)
+{
+    if (image.nr() == 0)
+    {
+        return;
+    }
+    if (held() && elementSize == sizeof(T) && rows == image.nr() && cols == image.nc())
+    {
+        //Still on disk from last time.
+        image.free();
+        return;
+    }
+    discard();
+    if (!enabled())
+    {
+        image.free();
+        return;
+    }
+
+    path = newPath();
+    elementSize = sizeof(T);
+    rows = image.nr();
+    cols = image.nc();
+    layout = image.get_layout();
+
+    std::shared_ptr<matrix<T>> buffer = std::make_shared<matrix<T>>();
+    *buffer = std::move(image);
+    const std::size_t bytes = std::size_t(rows)*std::size_t(buffer->row_stride())*sizeof(T);
+    pendingBytes += bytes;
+    const std::string target = path;
+    writeback = std::async(std::launch::async, [buffer, target, bytes]()
+    {
+        const bool written = writeFile(target, reinterpret_cast<const char*>((*buffer)[0]), bytes);
+        pendingBytes -= bytes;
+        buffer->free();
+        return written;
+    });
+}
+
+template <class T>
+bool SpillFile::restore(matrix<T> &image)
+{
+    if (!held() || elementSize != sizeof(T) || !finish())
+    {
+        return false;
+    }
+    if (image.map_file(path, rows, cols, layout))
+    {
+        return true;
+    }
+    image.set_size(rows, cols, layout);
+    if (!readFile(path, reinterpret_cast<char*>(image[0]), image.bytes()))
+    {
+        image.free();
+        discard();
+        return false;
+    }
+    return true;
+}
+
+#endif // SPILLFILE_H
@@ -0,0 +1,353 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "stageCache.hpp"
+#include <QByteArray>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QString>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char magic[4] = {'F','S','C','1'};
+const int bandRows = 64;
+const int compressionLevel = 1;//zlib's fastest; the byte planes do most of the work
+
+struct Header
+{
+    char magic[4];
+    int32_t rows;
+    int32_t cols;
+    int32_t bandRows;
+    int32_t bands;
+};
+
+std::mutex cacheMutex;
+QString cacheDir;
+std::size_t sizeLimit = 0;
+
+//Writes still in flight; finished ones are pruned on each store, and the
+// rest are waited for at exit.
+std::mutex writesMutex;
+std::vector<std::future<void>> writes;
+
+QString entryPath(const QString &dir, const std::string &key)
+{
+    return dir + "/" + QString::fromStdString(key) + ".fsc";
+}
+
+//Removes the least recently used entries until the cache fits its limit.
+void trim(const QString &dir, const std::size_t limit)
+{
+    QDir cache(dir);
+    //Newest first; load() touches entries as they're used.
+    const QFileInfoList entries = cache.entryInfoList(QStringList() << "*.fsc", QDir::Files, QDir::Time);
+    std::size_t total = 0;
+    for (const QFileInfo &entry : entries)
+    {
+        total += std::size_t(entry.size());
+        if (total > limit)
+        {
+            cache.remove(entry.fileName());
+        }
+    }
+}
+
+//Splits a band of floats into byte planes and compresses them.
+QByteArray packBand(const matrix<float> &image, const int firstRow, const int lastRow)
+{
+    const int cols = image.nc();
+    const int count = (lastRow - firstRow)*cols;
+    QByteArray planes(count*int(sizeof(float)), Qt::Uninitialized);
+    char * out = planes.data();
+    int index = 0;
+    for (int row = firstRow; row < lastRow; row++)
+    {
+        const unsigned char * in = reinterpret_cast<const unsigned char*>(image[row]);
+        for (int col = 0; col < cols; col++, index++)
+        {
+            for (int b = 0; b < int(sizeof(float)); b++)
+            {
+                out[b*count + index] = char(in[col*sizeof(float) + b]);
+            }
+        }
+    }
+    return qCompress(planes, compressionLevel);
+}
+
+bool unpackBand(const char * compressed, const int length, matrix<float> &image,
+                const int firstRow, const int lastRow)
+{
+    const int cols = image.nc();
+    const int count = (lastRow - firstRow)*cols;
+    const QByteArray planes = qUncompress(reinterpret_cast<const uchar*>(compressed), length);
+    if (planes.size() != count*int(sizeof(float)))
+    {
+        return false;
+    }
+    const char * in = planes.constData();
+    int index = 0;
+    for (int row = firstRow; row < lastRow; row++)
+    {
+        unsigned char * out = reinterpret_cast<unsigned char*>(image[row]);
+        for (int col = 0; col < cols; col++, index++)
+        {
+            for (int b = 0; b < int(sizeof(float)); b++)
+            {
+                out[col*sizeof(float) + b] = static_cast<unsigned char>(in[b*count + index]);
+            }
+        }
+    }
+    return true;
+}
+
+void writeEntry(const QString dir, const std::size_t limit, const std::string key,
+                std::shared_ptr<matrix<float>> image)
+{
+    const int rows = image->nr();
+    const int bands = (rows + bandRows - 1)/bandRows;
+    std::vector<QByteArray> packed(bands);
+    #pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < bands; band++)
+    {
+        packed[band] = packBand(*image, band*bandRows, std::min(rows, (band+1)*bandRows));
+    }
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.rows = rows;
+    header.cols = image->nc();
+    header.bandRows = bandRows;
+    header.bands = bands;
+    image->free();
+
+    //Write under a temporary name, so that a reader never sees half an entry.
+    const QString path = entryPath(dir, key);
+    const QString tempPath = path + "." + QString::number(QDateTime::currentMSecsSinceEpoch()) + ".tmp";
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        cout << "StageCache: could not write " << tempPath.toStdString() << endl;
+        return;
+    }
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == qint64(sizeof(header));
+    for (int band = 0; band < bands && ok; band++)
+    {
+        const uint32_t length = uint32_t(packed[band].size());
+        ok = file.write(reinterpret_cast<const char*>(&length), sizeof(length)) == qint64(sizeof(length));
+    }
+    for (int band = 0; band < bands && ok; band++)
+    {
+        ok = file.write(packed[band]) == packed[band].size();
+    }
+    file.close();
+    if (!ok || !QFile::rename(tempPath, path))
+    {
+        QFile::remove(tempPath);//an error, or another write of the same entry got there first
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    trim(dir, limit);
+}
+
+}
+
+StageKey& StageKey::add(const std::string &text)
+{
+    const uint64_t length = text.size();
+    addBytes(&length, sizeof(length));//so that "ab","c" and "a","bc" differ
+    addBytes(text.data(), text.size());
+    return *this;
+}
+
+StageKey& StageKey::add(const float value)
+{
+    addBytes(&value, sizeof(value));
+    return *this;
+}
+
+StageKey& StageKey::add(const int value)
+{
+    addBytes(&value, sizeof(value));
+    return *this;
+}
+
+void StageKey::addBytes(const void * bytes, const std::size_t length)
+{
+    const unsigned char * data = static_cast<const unsigned char*>(bytes);
+    for (std::size_t i = 0; i < length; i++)
+    {
+        hashA = (hashA ^ data[i])*0x100000001b3ULL;
+        hashB = (hashB ^ data[i])*0x100000001b3ULL;
+        hashB ^= hashB >> 29;
+    }
+}
+
+std::string StageKey::str() const
+{
+    char text[33];
+    std::snprintf(text, sizeof(text), "%016llx%016llx",
+                  static_cast<unsigned long long>(hashA), static_cast<unsigned long long>(hashB));
+    return std::string(text);
+}
+
+void StageCache::setSizeLimit(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    sizeLimit = bytes;
+    if (bytes == 0)
+    {
+        cacheDir.clear();
+        return;
+    }
+    QString dirstr = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    dirstr.append("/filmulator/stages");
+    if (!QDir(dirstr).mkpath("."))
+    {
+        cout << "StageCache: could not create " << dirstr.toStdString() << endl;
+        cacheDir.clear();
+        return;
+    }
+    cacheDir = dirstr;
+    trim(cacheDir, sizeLimit);
+}
+
+bool StageCache::enabled()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return !cacheDir.isEmpty();
+}
+
+bool StageCache::load(const std::string &key, matrix<float> &image)
+{
+    QString dir;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        dir = cacheDir;
+    }
+    if (key.empty() || dir.isEmpty())
+    {
+        return false;
+    }
+    QFile file(entryPath(dir, key));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    Header header;
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header)) ||
+        std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        header.rows <= 0 || header.cols <= 0 || header.bandRows <= 0 ||
+        header.bands != (header.rows + header.bandRows - 1)/header.bandRows)
+    {
+        cout << "StageCache: bad entry " << key << endl;
+        file.close();
+        file.remove();
+        return false;
+    }
+    std::vector<uint32_t> lengths(header.bands);
+    std::vector<qint64> offsets(header.bands);
+    if (file.read(reinterpret_cast<char*>(lengths.data()), qint64(header.bands*sizeof(uint32_t))) != qint64(header.bands*sizeof(uint32_t)))
+    {
+        file.close();
+        file.remove();
+        return false;
+    }
+    qint64 total = 0;
+    for (int band = 0; band < header.bands; band++)
+    {
+        offsets[band] = total;
+        total += lengths[band];
+    }
+    const QByteArray compressed = file.read(total);
+    if (compressed.size() != total)
+    {
+        file.close();
+        file.remove();
+        return false;
+    }
+    //Mark it as recently used.
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    file.close();
+
+    image.set_size(header.rows, header.cols);
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (int band = 0; band < header.bands; band++)
+    {
+        ok = unpackBand(compressed.constData() + offsets[band], int(lengths[band]), image,
+                        band*header.bandRows, std::min(int(header.rows), (band+1)*header.bandRows)) && ok;
+    }
+    if (!ok)
+    {
+        cout << "StageCache: corrupt entry " << key << endl;
+        image.free();
+        QFile::remove(entryPath(dir, key));
+        return false;
+    }
+    cout << "StageCache: loaded " << key << endl;
+    return true;
+}
+
+void StageCache::store(const std::string &key, const matrix<float> &image)
+{
+    QString dir;
+    std::size_t limit;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        dir = cacheDir;
+        limit = sizeLimit;
+    }
+    if (key.empty() || dir.isEmpty() || image.nr() == 0)
+    {
+        return;
+    }
+    if (QFile::exists(entryPath(dir, key)))
+    {
+        return;
+    }
+
+    std::shared_ptr<matrix<float>> copy;
+    {
+        BufferTagScope bufferScope("stageCache", "store");
+        copy = std::make_shared<matrix<float>>(image);
+    }
+
+    std::lock_guard<std::mutex> lock(writesMutex);
+    writes.erase(std::remove_if(writes.begin(), writes.end(), [](std::future<void> &write)
+    {
+        return write.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), writes.end());
+    writes.push_back(std::async(std::launch::async, writeEntry, dir, limit, key, copy));
+}
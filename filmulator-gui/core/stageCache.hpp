@@ -0,0 +1,77 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef STAGECACHE_H
+#define STAGECACHE_H
+
+#include "matrix.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//Hashed into the demosaic key, which the later stages' keys chain from, so that results
+// cached on disk by an older build are never looked up again. Bump this whenever the code of any cached stage changes
+// what it outputs: decoding, demosaicing, highlight recovery, white balance, lens
+// corrections, or filmulation.
+#define STAGE_CACHE_VERSION 1
+
+//Builds a cache key by hashing everything that affects a stage's output.
+//Keys chain: a later stage's key starts from the key of the stage it reads from.
+class StageKey
+{
+public:
+    StageKey() {}
+    explicit StageKey(const std::string &base) {add(base);}
+
+    StageKey& add(const std::string &text);
+    StageKey& add(const float value);
+    StageKey& add(const int value);
+    StageKey& add(const bool value) {return add(int(value));}
+
+    //32 hex digits.
+    std::string str() const;
+
+private:
+    void addBytes(const void * bytes, const std::size_t length);
+    //Two independent 64-bit FNV-1a hashes.
+    uint64_t hashA = 0xcbf29ce484222325ULL;
+    uint64_t hashB = 0x84222325cbf29ce4ULL;
+};
+
+//Stage outputs kept on disk between sessions, so that reopening an image that was
+// edited before doesn't mean demosaicing and filmulating it all over again.
+//Each entry is one file named by its key, holding the image in bands of rows that are
+// compressed independently (and so in parallel), after splitting each float into byte
+// planes so that zlib can find the redundancy in the exponents.
+//The total size is bounded; the least recently used entries are removed first.
+class StageCache
+{
+public:
+    //The most the cache may hold on disk; 0 turns it off.
+    static void setSizeLimit(std::size_t bytes);
+    static bool enabled();
+
+    //Fills in the image if there's an entry for the key.
+    static bool load(const std::string &key, matrix<float> &image);
+
+    //Saves a copy of the image under the key. Compressing and writing happen in the background,
+    // but the copy is made on the calling thread, so pipelines call this from a side task.
+    static void store(const std::string &key, const matrix<float> &image);
+};
+
+#endif // STAGECACHE_H
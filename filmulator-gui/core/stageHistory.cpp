@@ -0,0 +1,162 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "stageHistory.hpp"
+#include <algorithm>
+#include <utility>
+
+std::atomic<uint64_t> StageHistory::clock(0);
+std::atomic<long> StageHistory::allHits(0);
+std::atomic<long> StageHistory::allMisses(0);
+
+StageHistory::StageHistory(const int depthIn)
+{
+    depth = depthIn;
+}
+
+bool StageHistory::exchange(const int stage, const std::string &oldKey, const std::string &newKey,
+                            matrix<float> &image)
+{
+    //Nothing changed since this output was made, so it can be used as is.
+    if (!newKey.empty() && newKey == oldKey && image.nr() > 0)
+    {
+        hitCounts[stage]++;
+        allHits++;
+        return true;
+    }
+
+    if (!oldKey.empty() && image.nr() > 0 && depth > 0)
+    {
+        entries.remove_if([&](const Entry &entry)
+        {
+            return entry.stage == stage && entry.key == oldKey;
+        });
+        entries.emplace_front();
+        Entry &entry = entries.front();
+        entry.stage = stage;
+        entry.key = oldKey;
+        entry.image = std::move(image);
+        entry.lastUse = ++clock;
+        entry.image.retag(tag);
+    }
+    else
+    {
+        image.free();
+    }
+
+    bool found = false;
+    if (!newKey.empty())
+    {
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+        {
+            if (entry->stage == stage && entry->key == newKey)
+            {
+                image = std::move(entry->image);
+                image.retag(currentBufferTag());
+                entries.erase(entry);
+                found = true;
+                break;
+            }
+        }
+        if (found)
+        {
+            hitCounts[stage]++;
+            allHits++;
+        }
+        else
+        {
+            missCounts[stage]++;
+            allMisses++;
+        }
+    }
+
+    //Only the most recent few of each stage are kept.
+    int kept = 0;
+    for (auto entry = entries.begin(); entry != entries.end();)
+    {
+        if (entry->stage == stage && ++kept > depth)
+        {
+            entry = entries.erase(entry);
+        }
+        else
+        {
+            ++entry;
+        }
+    }
+    return found;
+}
+
+uint64_t StageHistory::oldestUse() const
+{
+    return entries.empty() ? 0 : entries.back().lastUse;
+}
+
+bool StageHistory::dropOldest()
+{
+    if (entries.empty())
+    {
+        return false;
+    }
+    entries.pop_back();
+    return true;
+}
+
+void StageHistory::clear()
+{
+    entries.clear();
+}
+
+std::size_t StageHistory::bytes() const
+{
+    std::size_t total = 0;
+    for (auto &entry : entries)
+    {
+        total += entry.image.bytes();
+    }
+    return total;
+}
+
+void StageHistory::retag(BufferTag * tagIn)
+{
+    tag = tagIn;
+    for (auto &entry : entries)
+    {
+        entry.image.retag(tag);
+    }
+}
+
+void StageHistory::swap(StageHistory &other)
+{
+    entries.swap(other.entries);
+    std::swap(depth, other.depth);
+    std::swap(tag, other.tag);
+    hitCounts.swap(other.hitCounts);
+    missCounts.swap(other.missCounts);
+}
+
+long StageHistory::hits(const int stage) const
+{
+    auto count = hitCounts.find(stage);
+    return count == hitCounts.end() ? 0 : count->second;
+}
+
+long StageHistory::misses(const int stage) const
+{
+    auto count = missCounts.find(stage);
+    return count == missCounts.end() ? 0 : count->second;
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef STAGEHISTORY_H
+#define STAGEHISTORY_H
+
+#include "matrix.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+
+//Recent outputs of a pipeline's slow stages, so that going back to an earlier setting
+// (flipping a checkbox off and on again, comparing two slider values) is free.
+//Entries are keyed by the StageKey of everything that produced them.
+//Each stage keeps only a few; the least recently used goes first.
+class StageHistory
+{
+public:
+    explicit StageHistory(const int depthIn = 3);
+
+    //Called when a stage is about to be recomputed.
+    //The image, made under oldKey, is set aside, and the entry for newKey (if any) is moved
+    // into it and charged to the current buffer tag. On a miss the image is left empty.
+    //Either key may be empty, meaning the image isn't worth keeping or can't be looked up.
+    bool exchange(const int stage, const std::string &oldKey, const std::string &newKey,
+                  matrix<float> &image);
+
+    //For the memory budget: when the least recently used entry was last touched
+    // (0 if there's none), and dropping it.
+    uint64_t oldestUse() const;
+    bool dropOldest();
+
+    void clear();
+    std::size_t bytes() const;
+
+    //Where set-aside images are charged to.
+    void retag(BufferTag * tagIn);
+
+    void swap(StageHistory &other);
+
+    //Lookup counts for one stage of this history, and for all of them together.
+    long hits(const int stage) const;
+    long misses(const int stage) const;
+    static long totalHits() {return allHits.load();}
+    static long totalMisses() {return allMisses.load();}
+
+private:
+    struct Entry
+    {
+        int stage;
+        std::string key;
+        matrix<float> image;
+        uint64_t lastUse;
+    };
+    std::list<Entry> entries;//most recently used first
+    int depth;
+    BufferTag * tag = nullptr;
+    std::map<int, long> hitCounts;
+    std::map<int, long> missCounts;
+
+    static std::atomic<uint64_t> clock;
+    static std::atomic<long> allHits;
+    static std::atomic<long> allMisses;
+};
+
+#endif // STAGEHISTORY_H
@@ -0,0 +1,164 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#include "threadBudget.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <mutex>
+#include <omp.h>
+
+using std::chrono::steady_clock;
+
+namespace {
+
+const char * const className[] = {"interactive", "full render", "preload", "background"};
+
+//How many cores each active thread of a class gets relative to the others.
+const int classWeight[] = {8, 4, 2, 1};
+
+struct ClassUsage
+{
+    int active = 0;//threads in this class right now
+    double busySeconds = 0;//summed over its threads
+    double threadSeconds = 0;//busy time times team size
+};
+
+//Everything in here is only touched with the mutex held.
+std::mutex budgetMutex;
+ClassUsage usage[int(WorkClass::count)];
+const steady_clock::time_point startTime = steady_clock::now();
+
+struct ThreadState
+{
+    bool active = false;
+    WorkClass workClass = WorkClass::background;
+    int threads = 0;
+    steady_clock::time_point since;
+};
+thread_local ThreadState state;
+
+int cores()
+{
+    static const int count = std::max(1, omp_get_num_procs());
+    return count;
+}
+
+int share(const WorkClass workClass)
+{
+    int totalWeight = 0;
+    for (int i = 0; i < int(WorkClass::count); i++)
+    {
+        totalWeight += usage[i].active*classWeight[i];
+    }
+    if (totalWeight == 0)
+    {
+        return cores();
+    }
+    const double fraction = double(classWeight[int(workClass)])/double(totalWeight);
+    return std::max(1, int(std::lround(cores()*fraction)));
+}
+
+//Books this thread's time since its last grant.
+void charge(const steady_clock::time_point now)
+{
+    if (!state.active)
+    {
+        return;
+    }
+    const double seconds = std::chrono::duration<double>(now - state.since).count();
+    ClassUsage &classUsage = usage[int(state.workClass)];
+    classUsage.busySeconds += seconds;
+    classUsage.threadSeconds += seconds*state.threads;
+    state.since = now;
+}
+
+void grant()
+{
+    state.threads = share(state.workClass);
+    omp_set_num_threads(state.threads);
+}
+
+}
+
+ThreadBudgetScope::ThreadBudgetScope(WorkClass workClass)
+{
+    previousClass = state.workClass;
+    previousActive = state.active;
+    previousThreads = omp_get_max_threads();
+
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    const steady_clock::time_point now = steady_clock::now();
+    if (state.active)
+    {
+        charge(now);
+        usage[int(state.workClass)].active--;
+    }
+    state.active = true;
+    state.workClass = workClass;
+    state.since = now;
+    usage[int(workClass)].active++;
+    grant();
+}
+
+ThreadBudgetScope::~ThreadBudgetScope()
+{
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    charge(steady_clock::now());
+    usage[int(state.workClass)].active--;
+    state.workClass = previousClass;
+    state.active = previousActive;
+    if (previousActive)
+    {
+        usage[int(previousClass)].active++;
+        grant();
+    }
+    else
+    {
+        omp_set_num_threads(previousThreads);
+    }
+}
+
+void refreshThreadBudget()
+{
+    if (!state.active)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    charge(steady_clock::now());
+    grant();
+}
+
+void dumpThreadUsage(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    const double uptime = std::chrono::duration<double>(steady_clock::now() - startTime).count();
+    out << "Thread budget over " << std::fixed << std::setprecision(1) << uptime
+        << " s on " << cores() << " cores:" << std::endl;
+    for (int i = 0; i < int(WorkClass::count); i++)
+    {
+        const ClassUsage &classUsage = usage[i];
+        const double averageTeam = classUsage.busySeconds > 0 ? classUsage.threadSeconds/classUsage.busySeconds : 0;
+        const double coreShare = uptime > 0 ? 100*classUsage.threadSeconds/(uptime*cores()) : 0;
+        out << "  " << className[i] << ": " << classUsage.busySeconds << " s busy, "
+            << averageTeam << " threads on average, " << coreShare << "% of core time, "
+            << classUsage.active << " active now" << std::endl;
+    }
+}
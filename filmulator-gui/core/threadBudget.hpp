@@ -0,0 +1,50 @@
+/*
+ * This file is part of Filmulator.
+ *
+ * Copyright 2013 Omer Mano and Carlo Vaccari
+ *
+ * Filmulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Filmulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Filmulator. If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef THREADBUDGET_H
+#define THREADBUDGET_H
+
+#include <iostream>
+
+//The kinds of work that compete for cores, most urgent first.
+enum class WorkClass {interactive, fullRender, preload, background, count};
+
+//Splits the cores between the pipelines and workers that run at once, so that an import
+// during editing doesn't leave everything fighting over oversubscribed cores.
+//Each thread doing image work holds a ThreadBudgetScope naming its class, and its OpenMP
+// teams are sized from its class's weight against all the other active threads' weights.
+//Budgets are revisited with refreshThreadBudget(), which pipelines call between stages
+// and filmulation steps, so a thread picks up cores when others finish.
+class ThreadBudgetScope
+{
+public:
+    explicit ThreadBudgetScope(WorkClass workClass);
+    ~ThreadBudgetScope();
+private:
+    WorkClass previousClass;
+    bool previousActive;
+    int previousThreads;
+};
+
+//Resizes this thread's OpenMP teams to its current share.
+void refreshThreadBudget();
+
+//Prints the cores granted to each class so far.
+void dumpThreadUsage(std::ostream &out);
+
+#endif // THREADBUDGET_H
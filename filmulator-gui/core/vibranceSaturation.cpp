@@ -143,8 +143,13 @@ void vibrance_saturation(const matrix<unsigned short> &input,
     const float sat = pow(2,saturation);
     output.set_size(nrows,ncols);
 
+    const CancelToken &cancel = currentCancelToken();
     #pragma omp parallel for schedule(dynamic)
     for(int i = 0; i < nrows; i++) {
+        if (cancel.cancelled())
+        {
+            continue;
+        }
         for(int j = 0; j < ncols; j += 3)
         {
             float r = input(i,j  );
@@ -169,9 +174,14 @@ void monochrome_convert(const matrix<unsigned short> &input,
     const int ncols = input.nc();
     output.set_size(nrows, ncols);
 
+    const CancelToken &cancel = currentCancelToken();
     #pragma omp parallel for schedule(dynamic)
     for(int i = 0; i < nrows; i++)
     {
+        if (cancel.cancelled())
+        {
+            continue;
+        }
         for (int j = 0; j < ncols; j += 3)
         {
             int gray = input(i,j)*rmult + input(i,j+1)*gmult + input(i,j+2)*bmult;
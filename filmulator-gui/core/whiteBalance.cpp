@@ -228,6 +228,8 @@ float wbDistance(array<float,2> tempTint, float camToRgb[3][3],
 }
 
 //Run a Nelder-Mead simplex optimization on wbDistance.
+//This version opens the raw file itself; prefer the other overloads if the
+// file is already open or the camera matrices are already known.
 void optimizeWBMults(std::string file,
                      float &temperature, float &tint)
 {
@@ -253,18 +255,22 @@ void optimizeWBMults(std::string file,
         return;
     }
 
+    optimizeWBMults(libraw.get(), temperature, tint);
+}
+
+//Same as above, but takes the camera matrix and multipliers from an already-opened raw.
+void optimizeWBMults(LibRaw * libraw,
+                     float &temperature, float &tint)
+{
     float camToRGB[3][3];
 
     //get color matrix
     for (int i = 0; i < 3; i++)
     {
-        //cout << "camToRGB: ";
         for (int j = 0; j < 3; j++)
         {
             camToRGB[i][j] = libraw->imgdata.color.rgb_cam[i][j];
-            //cout << camToRGB[i][j] << " ";
         }
-        //cout << endl;
     }
     float rCamMul = libraw->imgdata.color.cam_mul[0];
     float gCamMul = libraw->imgdata.color.cam_mul[1];
@@ -281,18 +287,60 @@ void optimizeWBMults(std::string file,
     gPreMul /= minMult;
     bPreMul /= minMult;
 
+    optimizeWBMults(camToRGB,
+                    rCamMul, gCamMul, bCamMul,
+                    rPreMul, gPreMul, bPreMul,
+                    temperature, tint);
+}
+
+//The actual solve, which works purely from the camera matrix and (normalized) multipliers.
+//We first scan a coarse temperature/tint table for the best starting point, so that the
+// simplex starts right next to the answer and only has to polish it.
+void optimizeWBMults(float camToRGB[3][3],
+                     float rCamMul, float gCamMul, float bCamMul,
+                     float rPreMul, float gPreMul, float bPreMul,
+                     float &temperature, float &tint)
+{
+    //Coarse table: temperatures spaced evenly in mired from 2000K to 12000K, tints from 0.8 to 1.2.
+    const int tempSteps = 26;
+    const int tintSteps = 9;
+    const float minMired = 1000000.0f/12000.0f;
+    const float maxMired = 1000000.0f/2000.0f;
+    const float miredStep = (maxMired - minMired)/(tempSteps - 1);
+    const float tintStep = 0.4f/(tintSteps - 1);
+    array<float,2> seedCoord;
+    seedCoord[0] = 5200.0f;
+    seedCoord[1] = 1.0f;
+    float seed = wbDistance(seedCoord, camToRGB, rCamMul, gCamMul, bCamMul, rPreMul, gPreMul, bPreMul);
+    for (int t = 0; t < tempSteps; t++)
+    {
+        for (int n = 0; n < tintSteps; n++)
+        {
+            array<float,2> coord;
+            coord[0] = 1000000.0f/(minMired + t*miredStep);
+            coord[1] = 0.8f + n*tintStep;
+            const float dist = wbDistance(coord, camToRGB, rCamMul, gCamMul, bCamMul, rPreMul, gPreMul, bPreMul);
+            if (dist < seed)
+            {
+                seed = dist;
+                seedCoord = coord;
+            }
+        }
+    }
+
     //This is nelder-mead in 2d, so we have 3 points.
     array<float,2> lowCoord, midCoord, hiCoord;
     //Some temporary coordinates for use in optimizing.
     array<float,2> meanCoord, reflCoord, expCoord, contCoord;
+    //The starting simplex is about one table cell across, around the seed.
     //Temperature
-    lowCoord[0] = 4000.0f;
-    midCoord[0] = 5200.0f;
-    hiCoord[0]  = 6300.0f;
+    lowCoord[0] = seedCoord[0]*0.95f;
+    midCoord[0] = seedCoord[0];
+    hiCoord[0]  = seedCoord[0]*1.05f;
     //Tint
-    lowCoord[1] = 1.0f;
-    midCoord[1] = 1.05f;
-    hiCoord[1]  = 1.0f;
+    lowCoord[1] = seedCoord[1];
+    midCoord[1] = seedCoord[1] + tintStep;
+    hiCoord[1]  = seedCoord[1];
 
     float low, mid, hi, oldLow;
     low = wbDistance(lowCoord, camToRGB, rCamMul, gCamMul, bCamMul, rPreMul, gPreMul, bPreMul);
@@ -403,15 +451,13 @@ void optimizeWBMults(std::string file,
     tint = lowCoord[1];
 }
 
-//Actually apply a white balance to image data.
-//It takes in the input and output matrices, the desired temperature and tint,
-// and the filename where it looks up the camera matrix and daylight multipliers.
-//It also takes in the camera matrix and the raw color space WB multipliers.
-void whiteBalance(matrix<float> &input, matrix<float> &output,
-                  float temperature, float tint, float cam2rgb[3][3],
-                  float rCamMul, float gCamMul, float bCamMul,
-                  float rPreMul, float gPreMul, float bPreMul,
-                  float maxValue, float factor)
+//Builds the single camera-to-output transform used by the prefilmulation stage.
+//White balance multipliers, the camera matrix, and the exposure factor are all linear,
+// so they collapse into one 3x3 matrix that gets applied in a single pass.
+void whiteBalanceMatrix(float temperature, float tint, float cam2rgb[3][3],
+                        float rCamMul, float gCamMul, float bCamMul,
+                        float rPreMul, float gPreMul, float bPreMul,
+                        float factor, float (&transform)[3][3])
 {
     float rMult, gMult, bMult;
     whiteBalancePostMults(temperature, tint, cam2rgb,
@@ -425,124 +471,68 @@ void whiteBalance(matrix<float> &input, matrix<float> &output,
     cout << "gCamMul: " << gCamMul << endl;
     cout << "bCamMul: " << bCamMul << endl;
 
-    float transform[3][3];
     for (int i = 0; i < 3; i++)
     {
         transform[0][i] = factor * rMult * cam2rgb[0][i];
         transform[1][i] = factor * gMult * cam2rgb[1][i];
         transform[2][i] = factor * bMult * cam2rgb[2][i];
     }
-    //transform[0][0] = 1.0f;
-    //transform[1][1] = 1.0f;
-    //transform[2][2] = 1.0f;
-
-    int nRows = input.nr();
-    int nCols = input.nc();
-
-    output.set_size(nRows, nCols);
-
-    /*
-    int case1 = 0;
-    int case2 = 0;
-    int case3 = 0;
-    int case4 = 0;
-    int case5 = 0;
-    int case6 = 0;
-    int case7 = 0;
-    */
-
-#pragma omp parallel shared(output, input) firstprivate(nRows, nCols)
+}
+
+//Applies a 3x3 color matrix to an interleaved image, clipping negative values to zero.
+//This is one streaming pass over memory: each pixel is read once and written once.
+void colorTransform(const matrix_view<const float> &input, matrix<float> &output,
+                    const float transform[3][3])
+{
+    assert(input.contiguous_rows());
+    const int nRows = input.nr();
+    const int nCols = input.nc()/3;
+
+    output.set_size(nRows, nCols*3);
+
+    //Copy into locals so that the compiler can keep them in registers.
+    const float t00 = transform[0][0], t01 = transform[0][1], t02 = transform[0][2];
+    const float t10 = transform[1][0], t11 = transform[1][1], t12 = transform[1][2];
+    const float t20 = transform[2][0], t21 = transform[2][1], t22 = transform[2][2];
+
+    const CancelToken &cancel = currentCancelToken();
+#pragma omp parallel for
+    for (int i = 0; i < nRows; i++)
     {
-#pragma omp for schedule(dynamic) nowait
-        for (int i = 0; i < nRows; i++)
+        if (cancel.cancelled())
         {
-            for (int j = 0; j < nCols; j += 3)
-            {
-                //highlight handling
-                //If the channel with the lowest camera multipliers is clipped, then clip the other channels in that pixel so as to not drag down the brightness
-                /*
-                bool rClipped = (input(i,j  ) > maxValue);
-                bool gClipped = (input(i,j+1) > maxValue);
-                bool bClipped = (input(i,j+2) > maxValue);
-
-                if (rClipped && !gClipped && !bClipped) //only red is clipped
-                {
-                    case1++;
-                    input(i,j+1) = min(input(i,j+1),input(i,j+1)*rCamMul/gCamMul); //reduce green if necessary
-                    input(i,j+2) = min(input(i,j+2),input(i,j+2)*rCamMul/bCamMul); //reduce blue if necessary
-                }
-                if (!rClipped && gClipped && !bClipped)
-                {
-                    case2++;
-                    input(i,j  ) = min(input(i,j  ),input(i,j  )*gCamMul/rCamMul);
-                    input(i,j+2) = min(input(i,j+2),input(i,j+2)*gCamMul/bCamMul);
-                }
-                if (!rClipped && !gClipped && bClipped)
-                {
-                    case3++;
-                    input(i,j  ) = min(input(i,j  ),input(i,j  )*bCamMul/rCamMul);
-                    input(i,j+1) = min(input(i,j+1),input(i,j+1)*bCamMul/gCamMul);
-                }
-
-                if (rClipped && gClipped && !bClipped) //red and green are both clipped;
-                {
-                    case4++;
-                    input(i,j  ) = min(input(i,j  ),input(i,j  )*min(rCamMul,gCamMul)/rCamMul);//reduce relative to the clipped channel with the lowest multpilier
-                    input(i,j+1) = min(input(i,j+1),input(i,j+1)*min(rCamMul,gCamMul)/gCamMul);
-                    input(i,j+2) = min(input(i,j+2),input(i,j+2)*min(rCamMul,gCamMul)/bCamMul);
-                }
-                if (rClipped && !gClipped && bClipped)
-                {
-                    case5++;
-                    input(i,j  ) = min(input(i,j  ),input(i,j  )*min(rCamMul,bCamMul)/rCamMul);
-                    input(i,j+1) = min(input(i,j+1),input(i,j+1)*min(rCamMul,bCamMul)/gCamMul);
-                    input(i,j+2) = min(input(i,j+2),input(i,j+2)*min(rCamMul,bCamMul)/bCamMul);
-                }
-                if (!rClipped && gClipped && bClipped)
-                {
-                    case6++;
-                    input(i,j  ) = min(input(i,j  ),input(i,j  )*min(gCamMul,bCamMul)/rCamMul);
-                    input(i,j+1) = min(input(i,j+1),input(i,j+1)*min(gCamMul,bCamMul)/gCamMul);
-                    input(i,j+2) = min(input(i,j+2),input(i,j+2)*min(gCamMul,bCamMul)/bCamMul);
-                }
-                if (rClipped && gClipped && bClipped) //all channels are clipped
-                {
-                    case7++;
-                    input(i,j  ) = min(input(i,j  ),input(i,j  )*min(min(rCamMul,gCamMul),bCamMul)/rCamMul);
-                    input(i,j+1) = min(input(i,j+1),input(i,j+1)*min(min(rCamMul,gCamMul),bCamMul)/gCamMul);
-                    input(i,j+2) = min(input(i,j+2),input(i,j+2)*min(min(rCamMul,gCamMul),bCamMul)/bCamMul);
-                }
-                */
-
-                //Actually set output according to camera matrix and pre and post multipliers
-                //output(i, j  ) = max(0.0f, transform[0][0]*rCamMul*input(i, j) + transform[0][1]*gCamMul*input(i, j+1) + transform[0][2]*bCamMul*input(i, j+2));
-                //output(i, j+1) = max(0.0f, transform[1][0]*rCamMul*input(i, j) + transform[1][1]*gCamMul*input(i, j+1) + transform[1][2]*bCamMul*input(i, j+2));
-                //output(i, j+2) = max(0.0f, transform[2][0]*rCamMul*input(i, j) + transform[2][1]*gCamMul*input(i, j+1) + transform[2][2]*bCamMul*input(i, j+2));
-                output(i, j  ) = max(0.0f, transform[0][0]*input(i, j) + transform[0][1]*input(i, j+1) + transform[0][2]*input(i, j+2));
-                output(i, j+1) = max(0.0f, transform[1][0]*input(i, j) + transform[1][1]*input(i, j+1) + transform[1][2]*input(i, j+2));
-                output(i, j+2) = max(0.0f, transform[2][0]*input(i, j) + transform[2][1]*input(i, j+1) + transform[2][2]*input(i, j+2));
-
-                /*
-                if (rClipped || gClipped || bClipped)
-                {
-                    if (i%2 == 0)
-                    {
-                        output(i,j+0) = 0.0f;
-                        output(i,j+1) = 0.0f;
-                        output(i,j+2) = 0.0f;
-                    }
-                }*/
-            }
+            continue;
+        }
+        const float * __restrict inRow = input[i];
+        float * __restrict outRow = output[i];
+#pragma omp simd
+        for (int j = 0; j < nCols; j++)
+        {
+            const float r = inRow[3*j  ];
+            const float g = inRow[3*j+1];
+            const float b = inRow[3*j+2];
+            outRow[3*j  ] = max(0.0f, t00*r + t01*g + t02*b);
+            outRow[3*j+1] = max(0.0f, t10*r + t11*g + t12*b);
+            outRow[3*j+2] = max(0.0f, t20*r + t21*g + t22*b);
         }
     }
+}
+
+//Actually apply a white balance to image data.
+//It takes in the input and output matrices, the desired temperature and tint,
+// and the filename where it looks up the camera matrix and daylight multipliers.
+//It also takes in the camera matrix and the raw color space WB multipliers.
+void whiteBalance(matrix<float> &input, matrix<float> &output,
+                  float temperature, float tint, float cam2rgb[3][3],
+                  float rCamMul, float gCamMul, float bCamMul,
+                  float rPreMul, float gPreMul, float bPreMul,
+                  float /*maxValue*/, float factor)
+{
+    float transform[3][3];
+    whiteBalanceMatrix(temperature, tint, cam2rgb,
+                       rCamMul, gCamMul, bCamMul,
+                       rPreMul, gPreMul, bPreMul,
+                       factor, transform);
 
-    /*
-    cout << "case1: " << case1 << endl;
-    cout << "case2: " << case2 << endl;
-    cout << "case3: " << case3 << endl;
-    cout << "case4: " << case4 << endl;
-    cout << "case5: " << case5 << endl;
-    cout << "case6: " << case6 << endl;
-    cout << "case7: " << case7 << endl;
-    */
+    colorTransform(input, output, transform);
 }
@@ -6,10 +6,16 @@ void whitepoint_blackpoint(matrix<float> &input, matrix<unsigned short> &output,
     int nrows = input.nr();
     int ncols = input.nc();
     output.set_size(nrows,ncols);
+    const CancelToken &cancel = currentCancelToken();
 #pragma omp parallel shared(output, input) firstprivate(nrows,ncols)
     {
 #pragma omp for schedule(dynamic) nowait
     for(int i = 0; i < nrows; i++)
+    {
+        if (cancel.cancelled())
+        {
+            continue;
+        }
         for(int j = 0; j < ncols; j++)
         {
             float subtracted = input(i,j)-blackpoint;
@@ -17,4 +23,5 @@ void whitepoint_blackpoint(matrix<float> &input, matrix<unsigned short> &output,
             output(i,j) = (unsigned short) max(min(multiplied,float(65535)),float(0));
         }
     }
+    }
 }
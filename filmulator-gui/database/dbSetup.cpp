@@ -46,12 +46,12 @@ DBSuccess setupDB(QSqlDatabase *db)
     {
         std::cout << "First initialization." << std::endl;
     }
-    else if (oldVersion > 13)//=================================================================version check here!
+    else if (oldVersion > 14)//=================================================================version check here!
     {
         std::cout << "Newer database format. Aborting." << std::endl;
         return DBSuccess::failure;
     }
-    else if (oldVersion < 13)//============================================================version check here!
+    else if (oldVersion < 14)//============================================================version check here!
     {
         std::cout << "Backing up old database" << std::endl;
         QFile file(dir.absoluteFilePath("filmulatorDB"));
@@ -93,7 +93,10 @@ DBSuccess setupDB(QSqlDatabase *db)
                 "FTexposureTime varchar,"
                 "FTaperture real,"
                 "FTfocalLength real,"
-                "FTusageIncrement integer"
+                "FTusageIncrement integer,"
+                "FTdefTemperature real,"//camera WB as temperature; null if not yet computed
+                "FTdefTint real,"
+                "FTautoCaAvail integer"//whether auto CA correct is possible for this sensor
                 ");"
                );
 
@@ -489,6 +492,14 @@ DBSuccess setupDB(QSqlDatabase *db)
         query.exec("UPDATE ProfileTable SET ProfTrotationPointY = -1;");
         versionString = "PRAGMA user_version = 13;";
         std::cout << "Upgrading from old db version 12" << std::endl;
+        [[fallthrough]];
+    case 13:
+        //These get filled in lazily the next time each image is selected.
+        query.exec("ALTER TABLE FileTable ADD COLUMN FTdefTemperature real;");
+        query.exec("ALTER TABLE FileTable ADD COLUMN FTdefTint real;");
+        query.exec("ALTER TABLE FileTable ADD COLUMN FTautoCaAvail integer;");
+        versionString = "PRAGMA user_version = 14;";
+        std::cout << "Upgrading from old db version 13" << std::endl;
     }
     query.exec(versionString);
     query.exec("COMMIT TRANSACTION;");//finalize the transaction only after writing the version.
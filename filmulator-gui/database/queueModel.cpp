@@ -1,5 +1,6 @@
 #include "queueModel.h"
 #include "../database/database.hpp"
+#include "../ui/paramWriteWorker.h"
 #include <iostream>
 #include <string>
 
@@ -288,6 +289,9 @@ void QueueModel::batchEnqueue(const QString searchQuery)
 
 void QueueModel::batchForget()
 {
+    //Don't let a queued parameter write bring back a row we're about to delete.
+    ParamWriteWorker::instance()->flush();
+
     //Each thread needs a unique database connection
     QSqlDatabase db = getDB();
     QSqlQuery query(db);
@@ -580,6 +584,19 @@ QString QueueModel::getNext(const QString searchID)
     }
 }
 
+QStringList QueueModel::getQueueIDs()
+{
+    QStringList queueIDs;
+    QSqlDatabase db = getDB();
+    QSqlQuery query(db);
+    query.exec("SELECT QTsearchID FROM QueueTable ORDER BY QTsortedIndex;");
+    while (query.next())
+    {
+        queueIDs.append(query.value(0).toString());
+    }
+    return queueIDs;
+}
+
 //this can be used to make a mark on the scrollbar
 //it can also be used to keep the active image visible (centered?) on the scrollbar
 float QueueModel::getActivePosition(const QString searchID)
@@ -3,6 +3,7 @@
 
 #include "sqlModel.h"
 #include <QString>
+#include <QStringList>
 #include <QQueue>
 
 struct QueueOrder {
@@ -26,6 +27,8 @@ public:
 
     Q_INVOKABLE QString getNext(const QString searchID);
     Q_INVOKABLE QString getPrev(const QString searchID);
+    //Every image in the queue, in queue order.
+    Q_INVOKABLE QStringList getQueueIDs();
 
     Q_INVOKABLE float getActivePosition(const QString searchID);
     Q_INVOKABLE int getQueueSize(){return m_queueSize;}
@@ -14,6 +14,90 @@ using std::endl;
 #define OTHER libraw->imgdata.other
 #define SIZES libraw->imgdata.sizes
 
+/*This function computes the per-file defaults that need the raw's metadata:
+ * the as-shot white balance as temperature and tint, and whether the sensor
+ * layout supports auto CA correction.*/
+void rawFileDefaults(LibRaw * libraw,
+                     float &temperature,
+                     float &tint,
+                     bool &autoCaAvail)
+{
+    optimizeWBMults(libraw, temperature, tint);
+
+    //Auto CA Correct only works with Bayer CFAs.
+    const bool isSraw = libraw->is_sraw();
+    const bool isWeird = libraw->COLOR(0,0)==6;
+    int maxXtrans = 0;
+    for (int i=0; i<6; i++)
+    {
+        for (int j=0; j<6; j++)
+        {
+            maxXtrans = max(maxXtrans,int(IDATA.xtrans[i][j]));
+        }
+    }
+    const bool isXtrans = maxXtrans > 0;
+    autoCaAvail = !isSraw && !isWeird && !isXtrans;
+}
+
+/*This function looks up the per-file defaults in the file table.
+ * Files imported before they were stored get them computed and stored here,
+ * so the raw only ever gets opened for this once.
+ * It returns false if the raw could not be read.*/
+bool fileDefaults(const QString hash,
+                  const QString fullFilename,
+                  float &temperature,
+                  float &tint,
+                  bool &autoCaAvail)
+{
+    //Each thread needs a unique database connection
+    QSqlDatabase db = getDB();
+    QSqlQuery query(db);
+
+    query.prepare("SELECT FTdefTemperature, FTdefTint, FTautoCaAvail FROM FileTable WHERE (FTfileID = ?);");
+    query.bindValue(0, hash);
+    query.exec();
+    if (query.next() && !query.value(0).isNull() && !query.value(1).isNull() && !query.value(2).isNull())
+    {
+        temperature = query.value(0).toFloat();
+        tint = query.value(1).toFloat();
+        autoCaAvail = query.value(2).toBool();
+        return true;
+    }
+
+    std::unique_ptr<LibRaw> libraw = std::unique_ptr<LibRaw>(new LibRaw());
+
+    int libraw_error;
+#if (defined(_WIN32) || defined(__WIN32__))
+    std::wstring wstr = fullFilename.toStdWString();
+    libraw_error = libraw->open_file(wstr.c_str());
+#else
+    std::string filenameStr = fullFilename.toStdString();
+    const char *cstr = filenameStr.c_str();
+    libraw_error = libraw->open_file(cstr);
+#endif
+    if (0 != libraw_error)
+    {
+        cout << "fileDefaults: Could not read input file!" << endl;
+        cout << "libraw error text: " << libraw_strerror(libraw_error) << endl;
+        temperature = 5200.0f;
+        tint = 1.0f;
+        autoCaAvail = false;
+        return false;
+    }
+
+    rawFileDefaults(libraw.get(), temperature, tint, autoCaAvail);
+
+    query.prepare("UPDATE FileTable "
+                  "SET FTdefTemperature = ?, FTdefTint = ?, FTautoCaAvail = ? "
+                  "WHERE (FTfileID = ?);");
+    query.bindValue(0, temperature);
+    query.bindValue(1, tint);
+    query.bindValue(2, autoCaAvail ? 1 : 0);
+    query.bindValue(3, hash);
+    query.exec();
+    return true;
+}
+
 /*This function inserts info on a raw file into the database.*/
 void fileInsert(const QString hash,
                 const QString fullFilename)
@@ -52,14 +136,30 @@ void fileInsert(const QString hash,
         const char *cstr = filenameStr.c_str();
         libraw_error = libraw->open_file(cstr);
 #endif
+        //We have the raw open anyway, so compute the white balance and such now
+        // instead of reopening it when the image first gets selected.
+        QVariant defTemperature, defTint, autoCaAvail;
         if (0 != libraw_error)
         {
             cout << "exifLocalDateString: Could not read input file!" << endl;
             cout << "libraw error text: " << libraw_strerror(libraw_error) << endl;
         }
+        else
+        {
+            float temperature, tint;
+            bool caAvail;
+            rawFileDefaults(libraw.get(), temperature, tint, caAvail);
+            defTemperature = temperature;
+            defTint = tint;
+            autoCaAvail = caAvail ? 1 : 0;
+        }
 
-        query.prepare("INSERT INTO FileTable values (?,?,?,?,?,?,?,?,?);");
-                                                   //0 1 2 3 4 5 6 7 8
+        query.prepare("INSERT INTO FileTable ("
+                      "FTfileID, FTfilePath, FTcameraMake, FTcameraModel, FTsensitivity, "
+                      "FTexposureTime, FTaperture, FTfocalLength, FTusageIncrement, "
+                      "FTdefTemperature, FTdefTint, FTautoCaAvail) "
+                      "values (?,?,?,?,?,?,?,?,?,?,?,?);");
+                            //0 1 2 3 4 5 6 7 8 9 10 11
         //Hash of the file:
         query.bindValue(0, hash);
         //Full path to the new location of the file:
@@ -79,6 +179,10 @@ void fileInsert(const QString hash,
         //Initialize a counter at 0 for number of times it has been referenced.
         // We only do this for new imports into the database.
         query.bindValue(8, 0);
+        //Camera white balance and auto CA availability; null if the raw couldn't be read.
+        query.bindValue(9, defTemperature);
+        query.bindValue(10, defTint);
+        query.bindValue(11, autoCaAvail);
         query.exec();
     }
 }
@@ -192,7 +296,7 @@ QString createNewProfile(const QString fileHash,
     Interface dummyInterface;
 
     //Create a pipeline of the appropriate type.
-    ImagePipeline pipeline(NoCache, NoHisto, LowQuality);
+    ImagePipeline pipeline(NoCache, NoHisto, LowQuality, "importThumb");
 
     //Process an image.
     matrix<unsigned short> image = pipeline.processImage(&paramManager, &dummyInterface, exif);
@@ -10,6 +10,19 @@
 #include <QSqlQuery>
 #include <QDir>
 
+class LibRaw;
+
+void rawFileDefaults(LibRaw * libraw,
+                     float &temperature,
+                     float &tint,
+                     bool &autoCaAvail);
+
+bool fileDefaults(const QString hash,
+                  const QString fullFilename,
+                  float &temperature,
+                  float &tint,
+                  bool &autoCaAvail);
+
 void fileInsert(const QString hash,
                 const QString fullFilename);
 
@@ -9,6 +9,8 @@ QML_IMPORT_PATH =
 # The .cpp file which was generated for your project. Feel free to hack it.
 SOURCES += main.cpp \
     core/agitate.cpp \
+    core/bufferTracker.cpp \
+    core/cancelToken.cpp \
     core/colorCurves.cpp \
     core/colorSpaces.cpp \
     core/curves.cpp \
@@ -16,6 +18,7 @@ SOURCES += main.cpp \
     core/diffuse.cpp \
     core/exposure.cpp \
     core/filmulate.cpp \
+    core/halfFloat.cpp \
     core/imagePipeline.cpp \
     core/imload.cpp \
     core/imread.cpp \
@@ -23,11 +26,16 @@ SOURCES += main.cpp \
     core/imreadTiff.cpp \
     core/imwriteJpeg.cpp \
     core/imwriteTiff.cpp \
+    core/interleave.cpp \
     core/layerMix.cpp \
     core/mergeExps.cpp \
     core/outputFile.cpp \
     core/rotateImage.cpp \
     core/scale.cpp \
+    core/spillFile.cpp \
+    core/stageCache.cpp \
+    core/stageHistory.cpp \
+    core/threadBudget.cpp \
     core/timeDiff.cpp \
     core/vibranceSaturation.cpp \
     core/whiteBalance.cpp \
@@ -50,8 +58,11 @@ SOURCES += main.cpp \
     database/rawproc_lensfun/lensfun_dbupdate.cpp \
     ui/filmImageProvider.cpp \
     ui/lensSelectModel.cpp \
+    ui/paramWriteWorker.cpp \
     ui/parameterManager.cpp \
+    ui/preloadWorker.cpp \
     ui/settings.cpp \
+    ui/speculationWorker.cpp \
     ui/thumbWriteWorker.cpp \
     ui/updateHistograms.cpp \
     database/database.cpp
@@ -91,11 +102,18 @@ qtcAddDeployment()
 #    filmulator
 
 HEADERS += \
+    core/bufferTracker.hpp \
+    core/cancelToken.hpp \
+    core/decodedImage.hpp \
     core/filmSim.hpp \
     core/imagePipeline.h \
     core/interface.h \
     core/lut.hpp \
     core/matrix.hpp \
+    core/spillFile.hpp \
+    core/stageCache.hpp \
+    core/stageHistory.hpp \
+    core/threadBudget.hpp \
     database/backgroundQueue.h \
     database/basicSqlModel.h \
     database/cJSON.h \
@@ -113,8 +131,11 @@ HEADERS += \
     database/rawproc_lensfun/lensfun_dbupdate.h \
     ui/filmImageProvider.h \
     ui/lensSelectModel.h \
+    ui/paramWriteWorker.h \
     ui/parameterManager.h \
+    ui/preloadWorker.h \
     ui/settings.h \
+    ui/speculationWorker.h \
     ui/thumbWriteWorker.h \
     database/database.hpp
 
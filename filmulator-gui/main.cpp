@@ -13,6 +13,7 @@
 #include "ui/filmImageProvider.h"
 #include "ui/lensSelectModel.h"
 #include "ui/settings.h"
+#include "ui/paramWriteWorker.h"
 #include "database/importModel.h"
 #include "database/organizeModel.h"
 #include "database/queueModel.h"
@@ -93,6 +94,9 @@ int main(int argc, char *argv[])
     cout << QDateTime::currentDateTime().toString("hh:mm:ss.zzz ").toStdString() << "connecting parametermanager" << endl;
     QObject::connect(paramManager, SIGNAL(updateTableOut(QString, int)),
                      switchboard, SLOT(updateTableIn(QString, int)));
+    //Parameter edits are written to the database in the background.
+    QObject::connect(ParamWriteWorker::instance(), SIGNAL(updateTableOut(QString, int)),
+                     switchboard, SLOT(updateTableIn(QString, int)));
 
     //Prepare an image provider object.
     cout << QDateTime::currentDateTime().toString("hh:mm:ss.zzz ").toStdString() << "creating filmimageprovider" << endl;
@@ -172,5 +176,9 @@ int main(int argc, char *argv[])
     window->show();
 
     cout << QDateTime::currentDateTime().toString("hh:mm:ss.zzz ").toStdString() << "return" << endl;
-    return app.exec();
+    const int result = app.exec();
+
+    //Don't lose the last edits.
+    ParamWriteWorker::instance()->shutdown();
+    return result;
 }
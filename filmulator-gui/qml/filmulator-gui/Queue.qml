@@ -431,6 +431,27 @@ Item {
                                     }
                                     uiScale: root.uiScale
                                 }
+                                ToolButton {
+                                    id: pasteQueue
+                                    text: qsTr("Paste settings to whole queue")
+                                    tooltipText: qsTr("Paste the copied settings onto every image in the queue at once.\n\nIf you copy and then do anything other than paste, pasting will not be available.")
+                                    width: parent.width
+                                    z: 2
+                                    notDisabled: paramManager.pasteable
+                                    onTriggered: {
+                                        var queueIDs = queueModel.getQueueIDs()
+                                        paramManager.pasteMany(queueIDs)
+                                        //only the loaded images need to reselect their params
+                                        filmProvider.refreshParamsMany(queueIDs)
+                                        queueDelegate.rightClicked = false
+                                        root.rightClicked = false
+                                        loadMenu.sourceComponent = undefined
+                                    }
+                                    Component.onCompleted: {
+                                        pasteQueue.tooltipWanted.connect(root.tooltipWanted)
+                                    }
+                                    uiScale: root.uiScale
+                                }
                                 Item {
                                     //row layouts have rounding issues at high item counts if you specify size
                                     //if you use Layouts.fillWidth then the gaps are too big
@@ -75,16 +75,76 @@ Rectangle {
             uiScale: root.uiScale
         }
 
+        ToolSlider {
+            id: memoryBudgetSlider
+            title: qsTr("Editor memory budget (MiB)")
+            tooltipText: qsTr("How much memory the editor may use to keep intermediate images, so that edits don't have to start over from the beginning. When it runs over, the results that are quickest to recompute are dropped first.\n\n0 means automatic, which is half of the installed memory.\n\nThis is applied as soon as you save settings.")
+            minimumValue: 0
+            maximumValue: settings.getPhysicalMemory()
+            stepSize: 256
+            value: settings.getMemoryBudget()
+            defaultValue: settings.getMemoryBudget()
+            changed: false
+            onValueChanged: {
+                if (Math.abs(value - defaultValue) < 0.5) {
+                    memoryBudgetSlider.changed = false
+                } else {
+                    memoryBudgetSlider.changed = true
+                }
+            }
+            Component.onCompleted: {
+                memoryBudgetSlider.tooltipWanted.connect(root.tooltipWanted)
+            }
+            uiScale: root.uiScale
+        }
+
         ToolSwitch {
-            id: lowMemModeSwitch
-            text: qsTr("Reduce memory usage")
-            tooltipText: qsTr("Warning: VERY SLOW!\n\nEnabling this turns off high-resolution caching in the editor. It will consume less memory but the full resolution image will recompute from the beginning for any edit you make.\n\nThis setting takes effect after applying settings and then restarting Filmulator.")
-            isOn: settings.getLowMemMode()
-            defaultOn: settings.getLowMemMode()
-            onIsOnChanged: lowMemModeSwitch.changed = true
+            id: compactCacheSwitch
+            text: qsTr("Pack idle images before dropping them")
+            tooltipText: qsTr("When the editor is over its memory budget, intermediate images are first stored at half size with slightly reduced precision, instead of being thrown away and recomputed. This lets more images stay ready for editing.\n\nThis is applied as soon as you save settings.")
+            isOn: settings.getCompactCache()
+            defaultOn: settings.getCompactCache()
+            onIsOnChanged: compactCacheSwitch.changed = true
             Component.onCompleted: {
-                lowMemModeSwitch.tooltipWanted.connect(root.tooltipWanted)
-                lowMemModeSwitch.changed = false
+                compactCacheSwitch.tooltipWanted.connect(root.tooltipWanted)
+                compactCacheSwitch.changed = false
+            }
+            uiScale: root.uiScale
+        }
+
+        ToolSwitch {
+            id: spillToDiskSwitch
+            text: qsTr("Keep dropped images on disk")
+            tooltipText: qsTr("When the editor is over its memory budget, intermediate images it drops are written to a scratch folder and read back when needed, instead of being recomputed. This can save a lot of time on large raw files, at the cost of disk space and writes.\n\nThis is applied as soon as you save settings.")
+            isOn: settings.getSpillToDisk()
+            defaultOn: settings.getSpillToDisk()
+            onIsOnChanged: spillToDiskSwitch.changed = true
+            Component.onCompleted: {
+                spillToDiskSwitch.tooltipWanted.connect(root.tooltipWanted)
+                spillToDiskSwitch.changed = false
+            }
+            uiScale: root.uiScale
+        }
+
+        ToolSlider {
+            id: diskCacheSlider
+            title: qsTr("Disk cache size (GiB)")
+            tooltipText: qsTr("Demosaiced and filmulated results of the images you edit are kept on disk, so that reopening an image later doesn't have to redo that work. When the cache fills, the images opened longest ago are removed first.\n\n0 turns the cache off.\n\nThis is applied as soon as you save settings.")
+            minimumValue: 0
+            maximumValue: 100
+            stepSize: 1
+            value: settings.getDiskCacheSize()
+            defaultValue: settings.getDiskCacheSize()
+            changed: false
+            onValueChanged: {
+                if (Math.abs(value - defaultValue) < 0.5) {
+                    diskCacheSlider.changed = false
+                } else {
+                    diskCacheSlider.changed = true
+                }
+            }
+            Component.onCompleted: {
+                diskCacheSlider.tooltipWanted.connect(root.tooltipWanted)
             }
             uiScale: root.uiScale
         }
@@ -126,13 +186,27 @@ Rectangle {
             uiScale: root.uiScale
         }
 
+        ToolSwitch {
+            id: speculativePreviewSwitch
+            text: qsTr("Render ahead of slider drags")
+            tooltipText: qsTr("While you drag one of the film sliders, the small preview for the next few slider positions is rendered ahead of time on otherwise idle processor cores, so that it appears sooner if you keep dragging the same way. This uses more power and memory.\n\nThis is applied as soon as you save settings.")
+            isOn: settings.getSpeculativePreview()
+            defaultOn: settings.getSpeculativePreview()
+            onIsOnChanged: speculativePreviewSwitch.changed = true
+            Component.onCompleted: {
+                speculativePreviewSwitch.tooltipWanted.connect(root.tooltipWanted)
+                speculativePreviewSwitch.changed = false
+            }
+            uiScale: root.uiScale
+        }
+
         ToolButton {
             id: saveSettings
             text: qsTr("Save Settings")
             tooltipText: qsTr("Apply settings and save for future use")
             width: settingsList.width
             height: 40 * uiScale
-            notDisabled: uiScaleSlider.changed || useSystemLanguageSwitch.changed || mipmapSwitch.changed || lowMemModeSwitch.changed || quickPreviewSwitch.changed || previewResSlider.changed
+            notDisabled: uiScaleSlider.changed || useSystemLanguageSwitch.changed || mipmapSwitch.changed || memoryBudgetSlider.changed || compactCacheSwitch.changed || spillToDiskSwitch.changed || diskCacheSlider.changed || quickPreviewSwitch.changed || previewResSlider.changed || speculativePreviewSwitch.changed
             onTriggered: {
                 settings.uiScale = uiScaleSlider.value
                 uiScaleSlider.defaultValue = uiScaleSlider.value
@@ -143,15 +217,27 @@ Rectangle {
                 settings.mipmapView = mipmapSwitch.isOn
                 mipmapSwitch.defaultOn = mipmapSwitch.isOn
                 mipmapSwitch.changed = false
-                settings.lowMemMode = lowMemModeSwitch.isOn
-                lowMemModeSwitch.defaultOn = lowMemModeSwitch.isOn
-                lowMemModeSwitch.changed = false
+                settings.memoryBudget = memoryBudgetSlider.value
+                memoryBudgetSlider.defaultValue = memoryBudgetSlider.value
+                memoryBudgetSlider.changed = false
+                settings.compactCache = compactCacheSwitch.isOn
+                compactCacheSwitch.defaultOn = compactCacheSwitch.isOn
+                compactCacheSwitch.changed = false
+                settings.spillToDisk = spillToDiskSwitch.isOn
+                spillToDiskSwitch.defaultOn = spillToDiskSwitch.isOn
+                spillToDiskSwitch.changed = false
+                settings.diskCacheSize = diskCacheSlider.value
+                diskCacheSlider.defaultValue = diskCacheSlider.value
+                diskCacheSlider.changed = false
                 settings.quickPreview = quickPreviewSwitch.isOn
                 quickPreviewSwitch.defaultOn = quickPreviewSwitch.isOn
                 quickPreviewSwitch.changed = false
                 settings.previewResolution = previewResSlider.value
                 previewResSlider.defaultValue = previewResSlider.value
                 previewResSlider.changed = false
+                settings.speculativePreview = speculativePreviewSwitch.isOn
+                speculativePreviewSwitch.defaultOn = speculativePreviewSwitch.isOn
+                speculativePreviewSwitch.changed = false
             }
             uiScale: root.uiScale
         }
@@ -321,6 +407,63 @@ Rectangle {
                     settings.downloadCamConst()
                 }
 
+                uiScale: root.uiScale
+            }
+        }
+        Rectangle {
+            id: memorySpacer
+            width: parent.width
+            height: 4 * uiScale
+            color: Colors.darkGray
+            opacity: 0
+        }
+        Rectangle {
+            id: memoryReadout
+            width: parent.width
+            height: 45 * uiScale
+            property real padding: 4 * uiScale
+
+            color: Colors.darkGray
+
+            Text {
+                id: memoryLabel
+                color: "white"
+                width: parent.width - memoryButton.width - 2*parent.padding
+                x: parent.padding
+                y: parent.padding
+                font.pixelSize: 12.0 * uiScale
+                text: qsTr("Image buffer memory")
+            }
+            Rectangle {
+                id: memoryBox
+                width: parent.width - memoryButton.width - 2*parent.padding
+                height: 20 * uiScale
+                x: parent.padding
+                y: 20*uiScale + parent.padding
+                color: "black"
+
+                Text {
+                    id: memoryResult
+                    color: "white"
+                    x: lensfunCheck.padding / 2
+                    y: 1 * uiScale
+                    width: parent.width - x
+                    height: parent.height - y
+                    font.pixelSize: 12.0 * uiScale
+                    text: filmProvider.memoryStatus
+                }
+            }
+            ToolButton {
+                id: memoryButton
+                width: 100 * uiScale
+                height: 45 * uiScale
+                anchors.right: parent.right
+                y: 0 * uiScale
+                text: qsTr("Details","Print memory use per pipeline stage")
+                onTriggered: {
+                    filmProvider.dumpBufferMemory()
+                }
+
                 uiScale: root.uiScale
             }
         }
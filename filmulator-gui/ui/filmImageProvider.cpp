@@ -2,21 +2,26 @@
 #include "../database/exifFunctions.h"
 #include <iostream>
 #include <QDir>
+#include <future>
 #include "../database/organizeModel.h"
 
 using std::cout;
 using std::endl;
 
 #define TIMEOUT 0.1
+//How long a quick preview may take while a slider is dragged, in seconds.
+#define PREVIEW_LATENCY_TARGET 0.06
+//The quick preview never gets smaller than this while adapting.
+#define MIN_PREVIEW_RESOLUTION 400
 
 FilmImageProvider::FilmImageProvider(ParameterManager * manager) :
     QObject(0),
     QQuickImageProvider(QQuickImageProvider::Image,
                         QQuickImageProvider::ForceAsynchronousImageLoading),
-    pipeline(WithCache, WithHisto, HighQuality),
-    quickPipe(WithCache, WithHisto, PreviewQuality),
-    nextQuickPipe(WithCache, NoHisto, PreviewQuality),
-    prevQuickPipe(WithCache, NoHisto, PreviewQuality)
+    pipeline(WithCache, WithHisto, HighQuality, "pipeline"),
+    quickPipe(WithCache, WithHisto, PreviewQuality, "quickPipe"),
+    nextQuickPipe(WithCache, NoHisto, PreviewQuality, "nextQuickPipe"),
+    prevQuickPipe(WithCache, NoHisto, PreviewQuality, "prevQuickPipe")
 {
     paramManager = manager;
     cloneParam = new ParameterManager;
@@ -28,6 +33,12 @@ FilmImageProvider::FilmImageProvider(ParameterManager * manager) :
     connect(paramManager, SIGNAL(updateClone(ParameterManager*)), cloneParam, SLOT(cloneParams(ParameterManager*)));
     connect(paramManager, SIGNAL(updateClone(ParameterManager*)), nextParam, SLOT(cancelComputation()));
 
+    //Edits get the cores and memory back from full-size preloading immediately.
+    preloader = new PreloadWorker;
+    connect(paramManager, SIGNAL(updateClone(ParameterManager*)), preloader, SLOT(pause()), Qt::DirectConnection);
+    //Guesses get to finish while the drag goes on; they're only called off when it's over.
+    speculator = new SpeculationWorker(&quickPipe);
+
     zeroHistogram(finalHist);
     zeroHistogram(postFilmHist);
     zeroHistogram(preFilmHist);
@@ -36,23 +47,32 @@ FilmImageProvider::FilmImageProvider(ParameterManager * manager) :
     connect(this, SIGNAL(requestThumbnail(QString)), worker, SLOT(writeThumb(QString)));
     connect(worker, SIGNAL(doneWritingThumb()), this, SLOT(thumbDoneWriting()));
 
-    //Check if we want the pipeline to cache.
+    //Caching is always on; the memory budget decides what stays around.
     Settings settingsObject;
-    if (settingsObject.getLowMemMode() == true)
-    {
-        pipeline.setCache(NoCache);
-        useCache = false;
-    }
-    else
-    {
-        pipeline.setCache(WithCache);
-        useCache = true;
-    }
+    ImagePipeline::setMemoryBudget(std::size_t(settingsObject.getMemoryBudget())*1024*1024);
+    ImagePipeline::setCompactStages(settingsObject.getCompactCache());
+    ImagePipeline::setSpillToDisk(settingsObject.getSpillToDisk());
+    SpeculationWorker::setEnabled(settingsObject.getSpeculativePreview());
+    StageCache::setSizeLimit(std::size_t(settingsObject.getDiskCacheSize())*1024*1024*1024);
+    pipeline.setDiskCache(true);
+    //The quick pipelines only read the full pipeline's entries, shrinking them to size.
+    quickPipe.setDiskCache(true);
+    nextQuickPipe.setDiskCache(true);
+    prevQuickPipe.setDiskCache(true);
+    pipeline.setCache(WithCache);
+    useCache = true;
+    //The preload pipelines' stages are the first to go when memory is tight.
+    nextQuickPipe.setEvictionWeight(0.5);
+    prevQuickPipe.setEvictionWeight(0.5);
+    //They also only get what cores the current image leaves over.
+    nextQuickPipe.setWorkClass(WorkClass::preload);
+    prevQuickPipe.setWorkClass(WorkClass::preload);
 
     previewResolution = settingsObject.getPreviewResolution();
     quickPipe.resolution = previewResolution;
     nextQuickPipe.resolution = previewResolution;
     prevQuickPipe.resolution = previewResolution;
+    dragResolution.assign(Valid::count/2, previewResolution);
 
     //Check if we want to use dual pipelines
     if (settingsObject.getQuickPreview())
@@ -69,6 +89,10 @@ FilmImageProvider::FilmImageProvider(ParameterManager * manager) :
 
 FilmImageProvider::~FilmImageProvider()
 {
+    speculator->shutdown();
+    delete speculator;
+    preloader->shutdown();
+    delete preloader;
 }
 
 QImage FilmImageProvider::requestImage(const QString& id,
@@ -77,6 +101,10 @@ QImage FilmImageProvider::requestImage(const QString& id,
 {
     gettimeofday(&request_start_time,NULL);
     cout << "FilmImageProvider::requestImage id: " << id.toStdString() << endl;
+    BufferTagScope bufferScope("filmProvider", "output");
+
+    //Whatever is being requested comes before preloading.
+    preloader->pause();
 
     //Copy out the filename.
     std::string filename;
@@ -87,6 +115,7 @@ QImage FilmImageProvider::requestImage(const QString& id,
     //Run the pipeline.
     Exiv2::ExifData data;
     matrix<unsigned short> image;
+    std::future<void> quickRefresh;
     if (!useQuickPipe)
     {
         filename = paramManager->getFullFilename();
@@ -106,13 +135,37 @@ QImage FilmImageProvider::requestImage(const QString& id,
                     quickPipe.rerunHistograms();
                 }
             }
+            //Edits that have been slow from this stage get a smaller preview.
+            //Anything starting before demosaic is a new image, not an edit.
+            const Valid startValid = paramManager->getValid();
+            const bool isEdit = useCache && startValid >= Valid::demosaic;
+            if (isEdit && dragResolution[startValid/2] < quickPipe.resolution)
+            {
+                quickPipe.reduceResolution(dragResolution[startValid/2]);
+                paramManager->lowerValid(Valid::filmulation);
+            }
+            const int renderResolution = quickPipe.resolution;
+            std::shared_ptr<const ParamSnapshot> renderSnap = paramManager->currentSnapshot();
+
             struct timeval quickTime;
             gettimeofday(&quickTime, nullptr);
             image = quickPipe.processImage(paramManager, this, data);
-            cout << "requestImage quickPipe time: " << timeDiff(quickTime) << endl;
+            const double quickSeconds = timeDiff(quickTime);
+            cout << "requestImage quickPipe time: " << quickSeconds << endl;
+            if (isEdit && image.nr() > 0)
+            {
+                adaptPreviewResolution(startValid, renderResolution, quickSeconds);
+                //Get the next steps of the drag going while the user looks at this one.
+                speculator->speculate(lastEditSnap, renderSnap);
+                lastEditSnap = renderSnap;
+            }
         }
         else
         {
+            //The drag is over, so there's nothing left to guess at.
+            speculator->pause();
+            lastEditSnap.reset();
+
             //dummy stuff for the precomputation pipe
             Exiv2::ExifData exif;
 
@@ -129,6 +182,16 @@ QImage FilmImageProvider::requestImage(const QString& id,
                 cout << "requestImage preload time: " << timeDiff(preTime) << endl;
             }
 
+            //If the current image was preloaded at full size, start from there.
+            if (useCache && cloneParam->getValid() == Valid::none)
+            {
+                const Valid preloaded = preloader->take(cloneParam->getImageIndex(), &pipeline);
+                if (preloaded > Valid::none)
+                {
+                    cloneParam->setValid(preloaded);
+                }
+            }
+
             //run full pipeline of current image
             filename = cloneParam->getFullFilename();
             struct timeval fullTime;
@@ -138,9 +201,22 @@ QImage FilmImageProvider::requestImage(const QString& id,
 
             //Copy the high-res pipeline images back to low-res to deal with
             // softness from lens corrections or rotation
+            //This doesn't touch the output, so it goes on while we convert that below.
             if (image.nr() > 0 && useCache)//don't copy invalid data
             {
-                quickPipe.copyAndDownsampleImages(&pipeline);
+                //Interaction is over, so the preview goes back to full detail.
+                if (quickPipe.raiseResolution(previewResolution))
+                {
+                    paramManager->lowerValid(Valid::filmulation);
+                }
+                quickRefresh = std::async(std::launch::async, [this]()
+                {
+                    ThreadBudgetScope threadScope(WorkClass::fullRender);
+                    quickPipe.copyAndDownsampleImages(&pipeline);
+                });
+
+                //Now that the current image is done, get ahead on the next ones.
+                preloader->start(cloneParam->getImageIndex());
             }
         }
     }
@@ -177,12 +253,48 @@ QImage FilmImageProvider::requestImage(const QString& id,
         }
     }
 
+    if (quickRefresh.valid())
+    {
+        quickRefresh.wait();
+    }
+
     tout << "Request time: " << timeDiff(request_start_time) << " seconds" << endl;
     setProgress(1);
+    emit memoryStatusChanged();
     *size = output.size();
     return output;
 }
 
+//Render time goes with the pixel count, which goes with the square of the resolution.
+//Each estimate is averaged with the last so that one hiccup doesn't throw away detail.
+void FilmImageProvider::adaptPreviewResolution(Valid startValid, int resolution, double seconds)
+{
+    const double scale = sqrt(PREVIEW_LATENCY_TARGET/max(seconds, 0.001));
+    const int ideal = max(MIN_PREVIEW_RESOLUTION, min(previewResolution, int(resolution*scale)));
+    int &learned = dragResolution[startValid/2];
+    learned = (learned + ideal)/2;
+    cout << "adaptPreviewResolution: stage " << startValid << " took " << seconds
+         << " at " << resolution << ", next time " << learned << endl;
+}
+
+QString FilmImageProvider::getMemoryStatus()
+{
+    return tr("%1 MiB in use, %2 MiB peak, %3 of %4 stage lookups reused")
+            .arg(liveBufferBytes()/(1024*1024))
+            .arg(peakBufferBytes()/(1024*1024))
+            .arg(StageHistory::totalHits())
+            .arg(StageHistory::totalHits() + StageHistory::totalMisses());
+}
+
+void FilmImageProvider::dumpBufferMemory()
+{
+    dumpBufferUsage(cout);
+    dumpLargestBuffers(cout, "", 10);
+    pipeline.dumpHistoryStats(cout);
+    quickPipe.dumpHistoryStats(cout);
+    dumpThreadUsage(cout);
+}
+
 void FilmImageProvider::writeTiff()
 {
     processMutex.lock();
@@ -415,3 +527,15 @@ void FilmImageProvider::refreshParams(const QString IDin)
         nextParam->selectImage(IDin);
     }
 }
+
+//Only the loaded image and its neighbors need rereading, however many were pasted to.
+void FilmImageProvider::refreshParamsMany(const QStringList IDsIn)
+{
+    for (ParameterManager * params : {prevParam, paramManager, nextParam})
+    {
+        if (IDsIn.contains(params->getImageIndex()))
+        {
+            refreshParams(params->getImageIndex());
+        }
+    }
+}
@@ -13,6 +13,8 @@
 #include "parameterManager.h"
 #include <QThread>
 #include "thumbWriteWorker.h"
+#include "preloadWorker.h"
+#include "speculationWorker.h"
 #include "../ui/settings.h"
 
 class FilmImageProvider : public QObject, public QQuickImageProvider, public Interface
@@ -20,6 +22,7 @@ class FilmImageProvider : public QObject, public QQuickImageProvider, public Int
     Q_OBJECT
 
     Q_PROPERTY(float progress READ getProgress WRITE setProgress NOTIFY progressChanged)
+    Q_PROPERTY(QString memoryStatus READ getMemoryStatus NOTIFY memoryStatusChanged)
 
 public:
     FilmImageProvider(ParameterManager*);
@@ -31,6 +34,11 @@ public:
     void setProgress(float progressIn);
     //Getter methods
     float getProgress(){return progress;}
+    //Live and peak memory held by all image buffers.
+    QString getMemoryStatus();
+
+    //Prints per-pipeline, per-stage memory use and the biggest buffers to the console.
+    Q_INVOKABLE void dumpBufferMemory();
 
     void updateFilmProgress(float);
 
@@ -62,6 +70,8 @@ public:
     Q_INVOKABLE void prepareShuffle(const QString newIDin, const QString newNextIDin);
     Q_INVOKABLE void shufflePipelines();
     Q_INVOKABLE void refreshParams(const QString IDin);
+    //The same for a whole batch of pasted images.
+    Q_INVOKABLE void refreshParamsMany(const QStringList IDsIn);
 
 protected:
     ImagePipeline pipeline;
@@ -71,8 +81,19 @@ protected:
     //Validity too... that goes with the ParamManagers.
     ImagePipeline nextQuickPipe;
     ImagePipeline prevQuickPipe;
-
+    //Renders the next images in the queue at full quality whenever we're idle.
+    PreloadWorker * preloader;
+    //Filmulates the quick preview ahead of film slider drags, if enabled.
+    SpeculationWorker * speculator;
+    //The params of the last quick preview edit, to tell which way a drag is going.
+    std::shared_ptr<const ParamSnapshot> lastEditSnap;
+
+    //The quick preview's resolution when idle; the most it's allowed.
     int previewResolution;
+    //For each stage an edit can start from, the preview resolution that renders it in
+    // about the target time, learned from past edits.
+    std::vector<int> dragResolution;
+    void adaptPreviewResolution(Valid startValid, int resolution, double seconds);
 
     ThumbWriteWorker *worker = new ThumbWriteWorker;
     QThread workerThread;
@@ -123,6 +144,7 @@ protected:
 
 signals:
     void progressChanged();
+    void memoryStatusChanged();
 
     //Notifications for the histograms
     void histFinalChanged();
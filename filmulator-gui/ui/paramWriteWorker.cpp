@@ -0,0 +1,254 @@
+#include "paramWriteWorker.h"
+#include <QDateTime>
+#include <QSqlQuery>
+#include <iostream>
+#include "../database/database.hpp"
+using namespace std;
+
+//How long a row waits for others to share its transaction, in milliseconds.
+#define WRITE_INTERVAL 500
+
+ParamWriteWorker * ParamWriteWorker::instance()
+{
+    static ParamWriteWorker * worker = new ParamWriteWorker;//leaked on purpose; shutdown() stops it
+    return worker;
+}
+
+ParamWriteWorker::ParamWriteWorker() : QObject(0)
+{
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+    timer->setInterval(WRITE_INTERVAL);
+    connect(timer, SIGNAL(timeout()), this, SLOT(writePending()));
+
+    //The timer is a child, so it comes along to the writer thread.
+    moveToThread(&thread);
+    running = true;
+    thread.start();
+}
+
+void ParamWriteWorker::enqueue(const QString imageID, const QVariantList row)
+{
+    enqueueMany(QStringList() << imageID, row);
+}
+
+void ParamWriteWorker::enqueueMany(const QStringList imageIDs, QVariantList row)
+{
+    QMutexLocker locker(&queueMutex);
+    for (const QString &imageID : imageIDs)
+    {
+        row[0] = imageID;
+        pending.insert(imageID, row);//replaces any older row for this image
+    }
+    if (!running)
+    {
+        locker.unlock();
+        writePending();
+        return;
+    }
+    locker.unlock();
+    QMetaObject::invokeMethod(this, "scheduleWrite", Qt::QueuedConnection);
+}
+
+void ParamWriteWorker::writeSoon()
+{
+    QMutexLocker locker(&queueMutex);
+    if (running && !pending.isEmpty())
+    {
+        QMetaObject::invokeMethod(this, "writePending", Qt::QueuedConnection);
+    }
+}
+
+void ParamWriteWorker::flush(const QString imageID)
+{
+    QMutexLocker locker(&queueMutex);
+    if (!isQueued(imageID))
+    {
+        return;
+    }
+    if (!running)
+    {
+        locker.unlock();
+        writePending();
+        return;
+    }
+    QMetaObject::invokeMethod(this, "writePending", Qt::QueuedConnection);
+    while (isQueued(imageID))
+    {
+        batchDone.wait(&queueMutex);
+        //A failed batch is retried later; the reader gets what's in the database now
+        // instead of waiting on it indefinitely.
+        if (batchFailed)
+        {
+            return;
+        }
+    }
+}
+
+void ParamWriteWorker::shutdown()
+{
+    {
+        QMutexLocker locker(&queueMutex);
+        running = false;
+    }
+    thread.quit();
+    thread.wait();
+    //Whatever is left goes out on this thread.
+    writePending();
+}
+
+//Call this with the mutex held.
+bool ParamWriteWorker::isQueued(const QString &imageID)
+{
+    if (imageID.isEmpty())
+    {
+        return !pending.isEmpty() || !writing.isEmpty();
+    }
+    return pending.contains(imageID) || writing.contains(imageID);
+}
+
+void ParamWriteWorker::scheduleWrite()
+{
+    //The interval counts from the first row in the batch, so steady edits still get written.
+    if (!timer->isActive())
+    {
+        timer->start();
+    }
+}
+
+void ParamWriteWorker::writePending()
+{
+    QMutexLocker locker(&queueMutex);
+    if (pending.isEmpty())
+    {
+        return;
+    }
+    writing.swap(pending);
+    //Our own copy, since writing may only be touched with the mutex held.
+    const QMap<QString, QVariantList> batch = writing;
+    batchFailed = false;
+    locker.unlock();
+
+    //Each thread needs a unique database connection
+    QSqlDatabase db = getDB();
+    //The statements are prepared once and reused for every image in the batch.
+    QSqlQuery procQuery(db);
+    procQuery.prepare("REPLACE INTO ProcessingTable ("
+                      "ProcTprocID, "                         // 0
+                      "ProcTinitialDeveloperConcentration, "  // 1
+                      "ProcTreservoirThickness, "             // 2
+                      "ProcTactiveLayerThickness, "           // 3
+                      "ProcTcrystalsPerPixel, "               // 4
+                      "ProcTinitialCrystalRadius, "           // 5
+                      "ProcTinitialSilverSaltDensity, "       // 6
+                      "ProcTdeveloperConsumptionConst, "      // 7
+                      "ProcTcrystalGrowthConst, "             // 8
+                      "ProcTsilverSaltConsumptionConst, "     // 9
+                      "ProcTtotalDevelopmentTime, "           //10
+                      "ProcTagitateCount, "                   //11
+                      "ProcTdevelopmentSteps, "               //12
+                      "ProcTfilmArea, "                       //13
+                      "ProcTsigmaConst, "                     //14
+                      "ProcTlayerMixConst, "                  //15
+                      "ProcTlayerTimeDivisor, "               //16
+                      "ProcTrolloffBoundary, "                //17
+                      "ProcTexposureComp, "                   //18
+                      "ProcTwhitepoint, "                     //19
+                      "ProcTblackpoint, "                     //20
+                      "ProcTshadowsX, "                       //21
+                      "ProcTshadowsY, "                       //22
+                      "ProcThighlightsX, "                    //23
+                      "ProcThighlightsY, "                    //24
+                      "ProcThighlightRecovery, "              //25
+                      "ProcTcaEnabled, "                      //26
+                      "ProcTtemperature, "                    //27
+                      "ProcTtint, "                           //28
+                      "ProcTvibrance, "                       //29
+                      "ProcTsaturation, "                     //30
+                      "ProcTrotation, "                       //31
+                      "ProcTcropHeight, "                     //32
+                      "ProcTcropAspect, "                     //33
+                      "ProcTcropVoffset, "                    //34
+                      "ProcTcropHoffset, "                    //35
+                      "ProcTmonochrome, "                     //36
+                      "ProcTbwRmult, "                        //37
+                      "ProcTbwGmult, "                        //38
+                      "ProcTbwBmult, "                        //39
+                      "ProcTtoeBoundary, "                    //40
+                      "ProcTlensfunName, "                    //41
+                      "ProcTlensfunCa, "                      //42
+                      "ProcTlensfunVign, "                    //43
+                      "ProcTlensfunDist, "                    //44
+                      "ProcTrotationAngle, "                  //45
+                      "ProcTrotationPointX, "                 //46
+                      "ProcTrotationPointY) "                 //47
+                      " values (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?);");
+
+    //Write that it's been edited to the SearchTable (actually writing the edit time)
+    QSqlQuery searchQuery(db);
+    searchQuery.prepare("UPDATE SearchTable SET STlastProcessedTime = ?, "
+                        "STthumbWritten = 0, "
+                        "STbigThumbWritten = 0 "
+                        "WHERE STsearchID = ?;");
+    //Write that it's been edited to the QueueTable
+    //If it's not in the queue yet then this won't do anything.
+    QSqlQuery queueQuery(db);
+    queueQuery.prepare("UPDATE QueueTable SET QTprocessed = 1, "
+                       "QTexported = 0 WHERE QTsearchID = ?;");
+
+    QSqlQuery query(db);
+    bool ok = query.exec("BEGIN;");//Stick these all into one db action for speed.
+    const QVariant now = QVariant(QDateTime::currentDateTime().toSecsSinceEpoch());
+    for (auto entry = batch.constBegin(); ok && entry != batch.constEnd(); ++entry)
+    {
+        const QVariantList &row = entry.value();
+        for (int i = 0; i < row.size(); i++)
+        {
+            procQuery.bindValue(i, row[i]);
+        }
+        ok = procQuery.exec();
+        searchQuery.bindValue(0, now);
+        searchQuery.bindValue(1, entry.key());
+        ok = ok && searchQuery.exec();
+        queueQuery.bindValue(0, entry.key());
+        ok = ok && queueQuery.exec();
+    }
+    ok = ok && query.exec("COMMIT;");//Apply all the changes together.
+    if (!ok)
+    {
+        cout << "ParamWriteWorker::writePending: writing " << batch.size() << " rows failed; trying again later" << endl;
+        query.exec("ROLLBACK;");
+    }
+
+    locker.relock();
+    if (!ok)
+    {
+        //Put the batch back, except where a newer row for the same image came in meanwhile.
+        for (auto entry = batch.constBegin(); entry != batch.constEnd(); ++entry)
+        {
+            if (!pending.contains(entry.key()))
+            {
+                pending.insert(entry.key(), entry.value());
+            }
+        }
+        batchFailed = true;
+    }
+    writing.clear();
+    batchDone.wakeAll();
+    const bool retry = !ok && running;
+    locker.unlock();
+
+    if (retry)
+    {
+        QMetaObject::invokeMethod(this, "scheduleWrite", Qt::QueuedConnection);
+    }
+    if (!ok)
+    {
+        return;
+    }
+
+    //Notify other database models of the changes.
+    emit updateTableOut("ProcessingTable", 0);//0 means edit
+    emit updateTableOut("SearchTable", 0);//0 means edit
+    emit updateTableOut("QueueTable", 0);//0 means edit
+}
@@ -0,0 +1,70 @@
+#ifndef PARAMWRITEWORKER_H
+#define PARAMWRITEWORKER_H
+
+#include <QObject>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QVariant>
+#include <QWaitCondition>
+
+/*The ParamWriteWorker writes processing parameters to the database on its own thread,
+ * so that releasing a slider never waits on SQLite.
+ *
+ * Rows are held for a short interval first. Another write for the same image replaces
+ * the one waiting, and everything waiting goes out in one transaction.
+ * Anything that reads the ProcessingTable back has to flush() first.
+ */
+
+class ParamWriteWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    //There's one of these for the whole program.
+    static ParamWriteWorker * instance();
+
+    //Queues one ProcessingTable row, bound in column order with the image ID first.
+    void enqueue(const QString imageID, const QVariantList row);
+
+    //Queues the same row for many images; the image ID in the row is replaced for each.
+    void enqueueMany(const QStringList imageIDs, QVariantList row);
+
+    //Starts writing whatever is queued now instead of waiting out the interval.
+    void writeSoon();
+
+    //Waits until the queued row for this image is in the database,
+    // or all queued rows if the image ID is empty.
+    void flush(const QString imageID = "");
+
+    //Writes everything out and stops the thread; for program exit.
+    void shutdown();
+
+signals:
+    void updateTableOut(QString table, int operation);
+
+protected slots:
+    void scheduleWrite();
+    void writePending();
+
+protected:
+    ParamWriteWorker();
+    bool isQueued(const QString &imageID);
+
+    QThread thread;
+    QTimer * timer;
+    bool running;
+
+    //pending, writing and batchFailed are only touched with the mutex held.
+    QMutex queueMutex;
+    QWaitCondition batchDone;
+    QMap<QString, QVariantList> pending;
+    QMap<QString, QVariantList> writing;
+    bool batchFailed = false;//the last batch was rolled back and requeued
+};
+
+#endif // PARAMWRITEWORKER_H
@@ -1,6 +1,8 @@
 #include "parameterManager.h"
 #include "../database/database.hpp"
 #include "../database/exifFunctions.h"
+#include "../database/sqlInsertion.h"
+#include "paramWriteWorker.h"
 #include <QFile>
 #include <QDir>
 #include <QStandardPaths>
@@ -60,6 +62,7 @@ ParameterManager::ParameterManager() : QObject(0)
     cout << "ParamManager done initializing lensfun" << endl;
 
     validity = Valid::none;
+    publish();
 
     pasteable = false;
     pasteSome = false;
@@ -75,60 +78,41 @@ ParameterManager::~ParameterManager()
 
 std::tuple<Valid,AbortStatus,LoadParams> ParameterManager::claimLoadParams()
 {
-    QMutexLocker paramLocker(&paramMutex);
     AbortStatus abort;
-    if (validity < Valid::none)//If something earlier than this has changed
+    if (changeMadeSinceCheck)
     {
-        abort = AbortStatus::restart;//not actually possible
-        cout << "claimLoadParams validity abort" << endl;
+        abort = AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    else if (!advanceValidity(Valid::none, Valid::partload))//mark as being in progress
     {
-        abort = AbortStatus::restart;
+        abort = AbortStatus::restart;//not actually possible
+        cout << "claimLoadParams validity abort" << endl;
     }
     else
     {
         abort = AbortStatus::proceed;
-        validity = Valid::partload;//mark as being in progress
     }
     //changeMadeSinceCheck = false;
-    LoadParams params;
-    params.fullFilename = m_fullFilename;
-    params.tiffIn = m_tiffIn;
-    params.jpegIn = m_jpegIn;
-    std::tuple<Valid,AbortStatus,LoadParams> tup(validity, abort, params);
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partload/2] = snap->changed[Valid::partload/2];
+    std::tuple<Valid,AbortStatus,LoadParams> tup(validity.load(), abort, snap->load);
     return tup;
 }
 
 AbortStatus ParameterManager::claimLoadAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    if (validity < Valid::partload)//make sure that progress on this step isn't invalid
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::restart;
-    }
-    else if (changeMadeSinceCheck)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partload) || changed)
     {
-        changeMadeSinceCheck = false;
         return AbortStatus::restart;
     }
-    else
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::proceed;
-    }
+    return AbortStatus::proceed;
 }
 
 Valid ParameterManager::markLoadComplete()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    processedYet = true;
-    if (Valid::partload == validity)
-    {
-        validity = Valid::load;//mark step complete (duh)
-    }
-    return validity;
+    return completeStage(Valid::partload, Valid::load);
 }
 
 void ParameterManager::setTiffIn(bool tiffIn)
@@ -137,7 +121,8 @@ void ParameterManager::setTiffIn(bool tiffIn)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_tiffIn = tiffIn;
-        validity = min(validity, Valid::none);
+        invalidate(Valid::none);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setTiff"));
@@ -150,7 +135,8 @@ void ParameterManager::setJpegIn(bool jpegIn)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_jpegIn = jpegIn;
-        validity = min(validity, Valid::none);
+        invalidate(Valid::none);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setJpeg"));
@@ -159,71 +145,39 @@ void ParameterManager::setJpegIn(bool jpegIn)
 
 std::tuple<Valid,AbortStatus,LoadParams,DemosaicParams> ParameterManager::claimDemosaicParams()
 {
-    QMutexLocker paramLocker(&paramMutex);
     AbortStatus abort;
-    if (validity < Valid::load)
+    if (changeMadeSinceCheck.exchange(false))
     {
         abort = AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    else if (!advanceValidity(Valid::load, Valid::partdemosaic))
     {
         abort = AbortStatus::restart;
     }
     else
     {
         abort = AbortStatus::proceed;
-        validity = Valid::partdemosaic;
-    }
-    changeMadeSinceCheck = false;
-    LoadParams loadParams;
-    loadParams.fullFilename = m_fullFilename;
-    loadParams.jpegIn = m_jpegIn;
-    loadParams.tiffIn = m_tiffIn;
-
-    DemosaicParams demParams;
-    demParams.caEnabled = s_caEnabled;
-    demParams.highlights = m_highlights;
-    demParams.cameraName = model;
-    demParams.lensName = s_lensfunName;//we use the staging ones because they're always populated
-    demParams.lensfunCA = s_lensfunCa >= 1;
-    demParams.lensfunVignetting = s_lensfunVign >= 1;
-    demParams.lensfunDistortion = s_lensfunDist >= 1;
-    demParams.focalLength = focalLength;
-    demParams.fnumber = fnumber;
-    demParams.rotationAngle = m_rotationAngle;
-    std::tuple<Valid,AbortStatus,LoadParams,DemosaicParams> tup(validity, abort, loadParams, demParams);
+    }
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partdemosaic/2] = snap->changed[Valid::partdemosaic/2];
+    std::tuple<Valid,AbortStatus,LoadParams,DemosaicParams> tup(validity.load(), abort, snap->load, snap->demosaic);
     return tup;
 }
 
 AbortStatus ParameterManager::claimDemosaicAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    if (validity < Valid::partdemosaic)
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::restart;
-    }
-    else if (changeMadeSinceCheck)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partdemosaic) || changed)
     {
-        changeMadeSinceCheck = false;
         return AbortStatus::restart;
     }
-    else
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::proceed;
-    }
+    return AbortStatus::proceed;
 }
 
 Valid ParameterManager::markDemosaicComplete()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    processedYet = true;
-    if (Valid::partdemosaic == validity)
-    {
-        validity = Valid::demosaic;
-    }
-    return validity;
+    return completeStage(Valid::partdemosaic, Valid::demosaic);
 }
 
 void ParameterManager::setCaEnabled(int caEnabled)
@@ -233,7 +187,8 @@ void ParameterManager::setCaEnabled(int caEnabled)
         QMutexLocker paramLocker(&paramMutex);
         s_caEnabled = caEnabled;
         m_caEnabled = caEnabled;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCaEnabled"));
@@ -246,7 +201,8 @@ void ParameterManager::setHighlights(int highlights)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_highlights = highlights;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setHighlights"));
@@ -263,7 +219,8 @@ void ParameterManager::setLensfunName(QString lensName)
         QMutexLocker paramLocker(&paramMutex);
         s_lensfunName = lensName;
         m_lensfunName = lensName;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         //We need to check what lens corrections are available based on the camera and lens
         updateAvailability();
@@ -279,7 +236,8 @@ void ParameterManager::setLensfunCa(int caEnabled)
         QMutexLocker paramLocker(&paramMutex);
         s_lensfunCa = caEnabled;
         m_lensfunCa = caEnabled;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setLensfunCa"));
@@ -293,7 +251,8 @@ void ParameterManager::setLensfunVign(int vignEnabled)
         QMutexLocker paramLocker(&paramMutex);
         s_lensfunVign = vignEnabled;
         m_lensfunVign = vignEnabled;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setLensfunVign"));
@@ -307,7 +266,8 @@ void ParameterManager::setLensfunDist(int distEnabled)
         QMutexLocker paramLocker(&paramMutex);
         s_lensfunDist = distEnabled;
         m_lensfunDist = distEnabled;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setLensfunDist"));
@@ -320,7 +280,8 @@ void ParameterManager::setRotationAngle(float angleIn)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_rotationAngle = angleIn;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setRotationAngle"));
@@ -351,60 +312,39 @@ void ParameterManager::setRotationPointY(float colIn)
 
 std::tuple<Valid,AbortStatus,PrefilmParams> ParameterManager::claimPrefilmParams()
 {
-    QMutexLocker paramLocker(&paramMutex);
     AbortStatus abort;
-    if (validity < Valid::demosaic)
+    if (changeMadeSinceCheck.exchange(false))
     {
         abort = AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    else if (!advanceValidity(Valid::demosaic, Valid::partprefilmulation))
     {
         abort = AbortStatus::restart;
     }
     else
     {
         abort = AbortStatus::proceed;
-        validity = Valid::partprefilmulation;
-    }
-    changeMadeSinceCheck = false;
-    PrefilmParams params;
-    params.exposureComp = m_exposureComp;
-    params.temperature = m_temperature;
-    params.tint = m_tint;
-    params.fullFilename = m_fullFilename;//it's okay to include previous things in later params if necessary
-    std::tuple<Valid,AbortStatus,PrefilmParams> tup(validity, abort, params);
+    }
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partprefilmulation/2] = snap->changed[Valid::partprefilmulation/2];
+    std::tuple<Valid,AbortStatus,PrefilmParams> tup(validity.load(), abort, snap->prefilm);
     return tup;
 }
 
 AbortStatus ParameterManager::claimPrefilmAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    if (validity < Valid::partprefilmulation)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partprefilmulation) || changed)
     {
-        changeMadeSinceCheck = false;
         return AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::restart;
-    }
-    else
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::proceed;
-    }
+    return AbortStatus::proceed;
 }
 
 Valid ParameterManager::markPrefilmComplete()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    processedYet = true;
-    if (Valid::partprefilmulation == validity)
-    {
-        validity = Valid::prefilmulation;
-    }
-    return validity;
+    return completeStage(Valid::partprefilmulation, Valid::prefilmulation);
 }
 
 void ParameterManager::setExposureComp(float exposureComp)
@@ -413,7 +353,8 @@ void ParameterManager::setExposureComp(float exposureComp)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_exposureComp = exposureComp;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setExposureComp"));
@@ -426,7 +367,8 @@ void ParameterManager::setTemperature(float temperature)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_temperature = temperature;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setTemperature"));
@@ -439,7 +381,8 @@ void ParameterManager::setTint(float tint)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_tint = tint;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setTint"));
@@ -448,76 +391,39 @@ void ParameterManager::setTint(float tint)
 
 std::tuple<Valid,AbortStatus,FilmParams> ParameterManager::claimFilmParams()
 {
-    QMutexLocker paramLocker(&paramMutex);
     AbortStatus abort;
-
-    //If it's the first time, the source data is from prefilmulation.
-    if (validity < Valid::prefilmulation)
+    if (changeMadeSinceCheck.exchange(false))
     {
         abort = AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    else if (!advanceValidity(Valid::prefilmulation, Valid::partfilmulation))
     {
         abort = AbortStatus::restart;
     }
     else
     {
         abort = AbortStatus::proceed;
-        validity = Valid::partfilmulation;
-    }
-    changeMadeSinceCheck = false;
-    FilmParams params;
-    params.initialDeveloperConcentration = m_initialDeveloperConcentration;
-    params.reservoirThickness = m_reservoirThickness;
-    params.activeLayerThickness = m_activeLayerThickness;
-    params.crystalsPerPixel = m_crystalsPerPixel;
-    params.initialCrystalRadius = m_initialCrystalRadius;
-    params.initialSilverSaltDensity = m_initialSilverSaltDensity;
-    params.developerConsumptionConst = m_developerConsumptionConst;
-    params.crystalGrowthConst = m_crystalGrowthConst;
-    params.silverSaltConsumptionConst = m_silverSaltConsumptionConst;
-    params.totalDevelopmentTime = m_totalDevelopmentTime;
-    params.agitateCount = m_agitateCount;
-    params.developmentSteps = m_developmentSteps;
-    params.filmArea = m_filmArea;
-    params.sigmaConst = m_sigmaConst;
-    params.layerMixConst = m_layerMixConst;
-    params.layerTimeDivisor = m_layerTimeDivisor;
-    params.rolloffBoundary = m_rolloffBoundary;
-    params.toeBoundary = m_toeBoundary;
-    std::tuple<Valid,AbortStatus,FilmParams> tup(validity,abort, params);
+    }
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partfilmulation/2] = snap->changed[Valid::partfilmulation/2];
+    std::tuple<Valid,AbortStatus,FilmParams> tup(validity.load(), abort, snap->film);
     return tup;
 }
 
 AbortStatus ParameterManager::claimFilmAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    if (validity < Valid::partfilmulation)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partfilmulation) || changed)
     {
-        changeMadeSinceCheck = false;
         return AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::restart;
-    }
-    else
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::proceed;
-    }
+    return AbortStatus::proceed;
 }
 
 Valid ParameterManager::markFilmComplete()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    processedYet = true;
-    if (Valid::partfilmulation == validity)
-    {
-        validity = Valid::filmulation;
-    }
-    return validity;
+    return completeStage(Valid::partfilmulation, Valid::filmulation);
 }
 
 void ParameterManager::setInitialDeveloperConcentration(float initialDeveloperConcentration)
@@ -526,7 +432,8 @@ void ParameterManager::setInitialDeveloperConcentration(float initialDeveloperCo
     {
         QMutexLocker paramLocker(&paramMutex);
         m_initialDeveloperConcentration = initialDeveloperConcentration;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setInitialDeveloperConcentration"));
@@ -539,7 +446,8 @@ void ParameterManager::setReservoirThickness(float reservoirThickness)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_reservoirThickness = reservoirThickness;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setReservoirThickness"));
@@ -552,7 +460,8 @@ void ParameterManager::setActiveLayerThickness(float activeLayerThickness)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_activeLayerThickness = activeLayerThickness;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setActiveLayerThickness"));
@@ -565,7 +474,8 @@ void ParameterManager::setCrystalsPerPixel(float crystalsPerPixel)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_crystalsPerPixel = crystalsPerPixel;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCrystalsPerPixel"));
@@ -578,7 +488,8 @@ void ParameterManager::setInitialCrystalRadius(float initialCrystalRadius)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_initialCrystalRadius = initialCrystalRadius;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setInitialCrystalRadius"));
@@ -591,7 +502,8 @@ void ParameterManager::setInitialSilverSaltDensity(float initialSilverSaltDensit
     {
         QMutexLocker paramLocker(&paramMutex);
         m_initialSilverSaltDensity = initialSilverSaltDensity;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setInitialSilverSaltDensity"));
@@ -604,7 +516,8 @@ void ParameterManager::setDeveloperConsumptionConst(float developerConsumptionCo
     {
         QMutexLocker paramLocker(&paramMutex);
         m_developerConsumptionConst = developerConsumptionConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setDeveloperConsumptionConst"));
@@ -617,7 +530,8 @@ void ParameterManager::setCrystalGrowthConst(float crystalGrowthConst)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_crystalGrowthConst = crystalGrowthConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCrystalGrowthConst"));
@@ -630,7 +544,8 @@ void ParameterManager::setSilverSaltConsumptionConst(float silverSaltConsumption
     {
         QMutexLocker paramLocker(&paramMutex);
         m_silverSaltConsumptionConst = silverSaltConsumptionConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setSilverSaltConsumptionConst"));
@@ -643,7 +558,8 @@ void ParameterManager::setTotalDevelopmentTime(float totalDevelopmentTime)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_totalDevelopmentTime = totalDevelopmentTime;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setTotalDevelopmentTime"));
@@ -656,7 +572,8 @@ void ParameterManager::setAgitateCount(int agitateCount)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_agitateCount = agitateCount;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setAgitateCount"));
@@ -669,7 +586,8 @@ void ParameterManager::setDevelopmentSteps(int developmentSteps)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_developmentSteps = developmentSteps;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setDevelopmentSteps"));
@@ -682,7 +600,8 @@ void ParameterManager::setFilmArea(float filmArea)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_filmArea = filmArea;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setFilmArea"));
@@ -695,7 +614,8 @@ void ParameterManager::setSigmaConst(float sigmaConst)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_sigmaConst = sigmaConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setSigmaConst"));
@@ -708,7 +628,8 @@ void ParameterManager::setLayerMixConst(float layerMixConst)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_layerMixConst = layerMixConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setLayerMixConst"));
@@ -721,7 +642,8 @@ void ParameterManager::setLayerTimeDivisor(float layerTimeDivisor)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_layerTimeDivisor = layerTimeDivisor;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setLayerTimeDivisor"));
@@ -734,7 +656,8 @@ void ParameterManager::setRolloffBoundary(float rolloffBoundary)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_rolloffBoundary = rolloffBoundary;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setRolloffBoundary"));
@@ -747,72 +670,86 @@ void ParameterManager::setToeBoundary(float toeBoundary)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_toeBoundary = toeBoundary;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setToeBoundary"));
     }
 }
 
-std::tuple<Valid,AbortStatus,BlackWhiteParams> ParameterManager::claimBlackWhiteParams()
+std::tuple<Valid,AbortStatus,CropParams> ParameterManager::claimCropParams()
 {
-    QMutexLocker paramLocker(&paramMutex);
     AbortStatus abort;
-    if (validity < Valid::filmulation)
+    if (changeMadeSinceCheck.exchange(false))
     {
         abort = AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    else if (!advanceValidity(Valid::filmulation, Valid::partcrop))
     {
         abort = AbortStatus::restart;
     }
     else
     {
         abort = AbortStatus::proceed;
-        validity = Valid::partblackwhite;
-    }
-    changeMadeSinceCheck = false;
-    BlackWhiteParams params;
-    params.blackpoint  = m_blackpoint;
-    params.whitepoint  = m_whitepoint;
-    params.cropHeight  = m_cropHeight;
-    params.cropAspect  = m_cropAspect;
-    params.cropVoffset = m_cropVoffset;
-    params.cropHoffset = m_cropHoffset;
-    params.rotation = m_rotation;
-    std::tuple<Valid,AbortStatus,BlackWhiteParams> tup(validity, abort, params);
+    }
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partcrop/2] = snap->changed[Valid::partcrop/2];
+    std::tuple<Valid,AbortStatus,CropParams> tup(validity.load(), abort, snap->crop);
     return tup;
 }
 
-AbortStatus ParameterManager::claimBlackWhiteAbort()
+AbortStatus ParameterManager::claimCropAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    if (validity < Valid::partblackwhite)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partcrop) || changed)
     {
-        changeMadeSinceCheck = false;
         return AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    return AbortStatus::proceed;
+}
+
+Valid ParameterManager::markCropComplete()
+{
+    return completeStage(Valid::partcrop, Valid::crop);
+}
+
+std::tuple<Valid,AbortStatus,BlackWhiteParams> ParameterManager::claimBlackWhiteParams()
+{
+    AbortStatus abort;
+    if (changeMadeSinceCheck.exchange(false))
+    {
+        abort = AbortStatus::restart;
+    }
+    else if (!advanceValidity(Valid::crop, Valid::partblackwhite))
     {
-        changeMadeSinceCheck = false;
-        return AbortStatus::restart;
+        abort = AbortStatus::restart;
     }
     else
     {
-        changeMadeSinceCheck = false;
-        return AbortStatus::proceed;
+        abort = AbortStatus::proceed;
     }
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partblackwhite/2] = snap->changed[Valid::partblackwhite/2];
+    std::tuple<Valid,AbortStatus,BlackWhiteParams> tup(validity.load(), abort, snap->blackWhite);
+    return tup;
 }
 
-Valid ParameterManager::markBlackWhiteComplete()
+AbortStatus ParameterManager::claimBlackWhiteAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    processedYet = true;
-    if (Valid::partblackwhite == validity)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partblackwhite) || changed)
     {
-        validity = Valid::blackwhite;
+        return AbortStatus::restart;
     }
-    return validity;
+    return AbortStatus::proceed;
+}
+
+Valid ParameterManager::markBlackWhiteComplete()
+{
+    return completeStage(Valid::partblackwhite, Valid::blackwhite);
 }
 
 void ParameterManager::setBlackpoint(float blackpoint)
@@ -821,7 +758,8 @@ void ParameterManager::setBlackpoint(float blackpoint)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_blackpoint = blackpoint;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::crop);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setBlackpoint"));
@@ -834,7 +772,8 @@ void ParameterManager::setWhitepoint(float whitepoint)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_whitepoint = whitepoint;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::crop);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setWhitepoint"));
@@ -847,7 +786,8 @@ void ParameterManager::setCropHeight(float cropHeight)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_cropHeight = cropHeight;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCropHeight"));
@@ -860,7 +800,8 @@ void ParameterManager::setCropAspect(float cropAspect)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_cropAspect = cropAspect;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCropAspect"));
@@ -873,7 +814,8 @@ void ParameterManager::setCropVoffset(float cropVoffset)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_cropVoffset = cropVoffset;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCropVoffset"));
@@ -886,7 +828,8 @@ void ParameterManager::setCropHoffset(float cropHoffset)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_cropHoffset = cropHoffset;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setCropHoffset"));
@@ -899,7 +842,8 @@ void ParameterManager::setRotation(int rotation)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_rotation = rotation;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setRotation"));
@@ -917,7 +861,8 @@ void ParameterManager::rotateRight()
             rotation += 4;
         }
         m_rotation = rotation;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("rotateRight"));
@@ -936,7 +881,8 @@ void ParameterManager::rotateLeft()
             rotation -= 4;
         }
         m_rotation = rotation;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("rotateLeft"));
@@ -946,12 +892,10 @@ void ParameterManager::rotateLeft()
 
 Valid ParameterManager::markColorCurvesComplete()
 {
-    QMutexLocker paramLocker(&paramMutex);
+    //There's no claim for this stage, so it goes straight from blackwhite.
     processedYet = true;
-    if (Valid::blackwhite == validity)
-    {
-        validity = Valid::colorcurve;
-    }
+    Valid expected = Valid::blackwhite;
+    validity.compare_exchange_strong(expected, Valid::colorcurve);
     return validity;
 }
 
@@ -961,66 +905,39 @@ Valid ParameterManager::markColorCurvesComplete()
 // uses of 'Valid::blackwhite' with 'Valid::colorcurve'
 std::tuple<Valid,AbortStatus,FilmlikeCurvesParams> ParameterManager::claimFilmlikeCurvesParams()
 {
-    QMutexLocker paramLocker(&paramMutex);
     AbortStatus abort;
-    if (validity < Valid::colorcurve)
+    if (changeMadeSinceCheck.exchange(false))
     {
         abort = AbortStatus::restart;
     }
-    else if (changeMadeSinceCheck)
+    else if (!advanceValidity(Valid::colorcurve, Valid::partfilmlikecurve))
     {
         abort = AbortStatus::restart;
     }
     else
     {
         abort = AbortStatus::proceed;
-        validity = Valid::partfilmlikecurve;
-    }
-    changeMadeSinceCheck = false;
-    FilmlikeCurvesParams params;
-    params.shadowsX = m_shadowsX;
-    params.shadowsY = m_shadowsY;
-    params.highlightsX = m_highlightsX;
-    params.highlightsY = m_highlightsY;
-    params.vibrance = m_vibrance;
-    params.saturation = m_saturation;
-    params.monochrome = m_monochrome;
-    params.bwRmult = m_bwRmult;
-    params.bwGmult = m_bwGmult;
-    params.bwBmult = m_bwBmult;
-    std::tuple<Valid,AbortStatus,FilmlikeCurvesParams> tup(validity, abort, params);
+    }
+    std::shared_ptr<const ParamSnapshot> snap = currentSnapshot();
+    claimedVersion[Valid::partfilmlikecurve/2] = snap->changed[Valid::partfilmlikecurve/2];
+    std::tuple<Valid,AbortStatus,FilmlikeCurvesParams> tup(validity.load(), abort, snap->filmlikeCurves);
     return tup;
 }
 
 AbortStatus ParameterManager::claimFilmLikeCurvesAbort()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    if (validity < Valid::partfilmlikecurve)
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::restart;
-    }
-    else if (changeMadeSinceCheck)
+    //Clear the change flag either way so the next check starts fresh.
+    const bool changed = changeMadeSinceCheck.exchange(false);
+    if (stageStale(Valid::partfilmlikecurve) || changed)
     {
-        changeMadeSinceCheck = false;
         return AbortStatus::restart;
     }
-    else
-    {
-        changeMadeSinceCheck = false;
-        return AbortStatus::proceed;
-    }
+    return AbortStatus::proceed;
 }
 
 Valid ParameterManager::markFilmLikeCurvesComplete()
 {
-    QMutexLocker paramLocker(&paramMutex);
-    processedYet = true;
-    if (Valid::partfilmlikecurve == validity)
-    {
-        validity = Valid::filmlikecurve;
-    }
-    return validity;
+    return completeStage(Valid::partfilmlikecurve, Valid::filmlikecurve);
 }
 
 void ParameterManager::setShadowsX(float shadowsX)
@@ -1029,7 +946,8 @@ void ParameterManager::setShadowsX(float shadowsX)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_shadowsX = shadowsX;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setShadowsX"));
@@ -1042,7 +960,8 @@ void ParameterManager::setShadowsY(float shadowsY)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_shadowsY = shadowsY;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setShadowsY"));
@@ -1055,7 +974,8 @@ void ParameterManager::setHighlightsX(float highlightsX)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_highlightsX = highlightsX;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setHighlightsX"));
@@ -1069,7 +989,8 @@ void ParameterManager::setHighlightsY(float highlightsY)
         cout << "highlights Y changed" << endl;
         QMutexLocker paramLocker(&paramMutex);
         m_highlightsY = highlightsY;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setHighlightsY"));
@@ -1082,7 +1003,8 @@ void ParameterManager::setVibrance(float vibrance)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_vibrance = vibrance;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setVibrance"));
@@ -1095,7 +1017,8 @@ void ParameterManager::setSaturation(float saturation)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_saturation = saturation;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setSaturation"));
@@ -1108,7 +1031,8 @@ void ParameterManager::setMonochrome(bool monochrome)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_monochrome = monochrome;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setMonochrome"));
@@ -1121,7 +1045,8 @@ void ParameterManager::setBwRmult(float Rmult)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_bwRmult = Rmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setBwRmult"));
@@ -1134,7 +1059,8 @@ void ParameterManager::setBwGmult(float Gmult)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_bwGmult = Gmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setBwGmult"));
@@ -1147,7 +1073,8 @@ void ParameterManager::setBwBmult(float Bmult)
     {
         QMutexLocker paramLocker(&paramMutex);
         m_bwBmult = Bmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
+        publish();
         paramLocker.unlock();
         QMutexLocker signalLocker(&signalMutex);
         paramChangeWrapper(QString("setBwBmult"));
@@ -1156,7 +1083,6 @@ void ParameterManager::setBwBmult(float Bmult)
 
 Valid ParameterManager::getValid()
 {
-    QMutexLocker paramLocker(&paramMutex);
     if (processedYet)
     {
         return validity;
@@ -1167,18 +1093,33 @@ Valid ParameterManager::getValid()
 
 void ParameterManager::setValid(Valid validityIn)
 {
-    QMutexLocker paramLocker(&paramMutex);
     validity = validityIn;
-    if (validity != Valid::none)
+    if (validityIn != Valid::none)
     {
         //we know it had been processed
         processedYet = true;
     }
 }
 
-Valid ParameterManager::getValidityWhenCanceled()
+void ParameterManager::useSnapshot(std::shared_ptr<const ParamSnapshot> snap, Valid validIn)
 {
     QMutexLocker paramLocker(&paramMutex);
+    std::atomic_store(&snapshot, snap);
+    validity = validIn;
+}
+
+void ParameterManager::lowerValid(Valid stage)
+{
+    Valid current = validity.load();
+    while (current > stage && !validity.compare_exchange_weak(current, stage)) {}
+    if (stage < runningStage)
+    {
+        cancelToken.cancel();
+    }
+}
+
+Valid ParameterManager::getValidityWhenCanceled()
+{
     return validityWhenCanceled;
 }
 
@@ -1199,134 +1140,64 @@ void ParameterManager::writeback()
 //or else it won't populate the field; it deletes and then re-inserts.
 void ParameterManager::writeToDB(QString imageID)
 {
-    //Each thread needs a unique database connection
-    QSqlDatabase db = getDB();
-    //Write back the slider to the database.
-    QSqlQuery query(db);
-    query.exec("BEGIN;");//Stick these all into one db action for speed.
-    query.prepare("REPLACE INTO ProcessingTable ("
-                  "ProcTprocID, "                         // 0
-                  "ProcTinitialDeveloperConcentration, "  // 1
-                  "ProcTreservoirThickness, "             // 2
-                  "ProcTactiveLayerThickness, "           // 3
-                  "ProcTcrystalsPerPixel, "               // 4
-                  "ProcTinitialCrystalRadius, "           // 5
-                  "ProcTinitialSilverSaltDensity, "       // 6
-                  "ProcTdeveloperConsumptionConst, "      // 7
-                  "ProcTcrystalGrowthConst, "             // 8
-                  "ProcTsilverSaltConsumptionConst, "     // 9
-                  "ProcTtotalDevelopmentTime, "           //10
-                  "ProcTagitateCount, "                   //11
-                  "ProcTdevelopmentSteps, "               //12
-                  "ProcTfilmArea, "                       //13
-                  "ProcTsigmaConst, "                     //14
-                  "ProcTlayerMixConst, "                  //15
-                  "ProcTlayerTimeDivisor, "               //16
-                  "ProcTrolloffBoundary, "                //17
-                  "ProcTexposureComp, "                   //18
-                  "ProcTwhitepoint, "                     //19
-                  "ProcTblackpoint, "                     //20
-                  "ProcTshadowsX, "                       //21
-                  "ProcTshadowsY, "                       //22
-                  "ProcThighlightsX, "                    //23
-                  "ProcThighlightsY, "                    //24
-                  "ProcThighlightRecovery, "              //25
-                  "ProcTcaEnabled, "                      //26
-                  "ProcTtemperature, "                    //27
-                  "ProcTtint, "                           //28
-                  "ProcTvibrance, "                       //29
-                  "ProcTsaturation, "                     //30
-                  "ProcTrotation, "                       //31
-                  "ProcTcropHeight, "                     //32
-                  "ProcTcropAspect, "                     //33
-                  "ProcTcropVoffset, "                    //34
-                  "ProcTcropHoffset, "                    //35
-                  "ProcTmonochrome, "                     //36
-                  "ProcTbwRmult, "                        //37
-                  "ProcTbwGmult, "                        //38
-                  "ProcTbwBmult, "                        //39
-                  "ProcTtoeBoundary, "                    //40
-                  "ProcTlensfunName, "                    //41
-                  "ProcTlensfunCa, "                      //42
-                  "ProcTlensfunVign, "                    //43
-                  "ProcTlensfunDist, "                    //44
-                  "ProcTrotationAngle, "                  //45
-                  "ProcTrotationPointX, "                 //46
-                  "ProcTrotationPointY) "                 //47
-                  " values (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?);");
-                  //                            1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3 3 3 3 3 3 3 3 3 4 4 4 4 4 4 4 4
-                  //        0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7
-    query.bindValue( 0, imageID);
-    query.bindValue( 1, m_initialDeveloperConcentration);
-    query.bindValue( 2, m_reservoirThickness);
-    query.bindValue( 3, m_activeLayerThickness);
-    query.bindValue( 4, m_crystalsPerPixel);
-    query.bindValue( 5, m_initialCrystalRadius);
-    query.bindValue( 6, m_initialSilverSaltDensity);
-    query.bindValue( 7, m_developerConsumptionConst);
-    query.bindValue( 8, m_crystalGrowthConst);
-    query.bindValue( 9, m_silverSaltConsumptionConst);
-    query.bindValue(10, m_totalDevelopmentTime);
-    query.bindValue(11, m_agitateCount);
-    query.bindValue(12, m_developmentSteps);
-    query.bindValue(13, m_filmArea);
-    query.bindValue(14, m_sigmaConst);
-    query.bindValue(15, m_layerMixConst);
-    query.bindValue(16, m_layerTimeDivisor);
-    query.bindValue(17, m_rolloffBoundary);
-    query.bindValue(18, m_exposureComp);
-    query.bindValue(19, m_whitepoint);
-    query.bindValue(20, m_blackpoint);
-    query.bindValue(21, m_shadowsX);
-    query.bindValue(22, m_shadowsY);
-    query.bindValue(23, m_highlightsX);
-    query.bindValue(24, m_highlightsY);
-    query.bindValue(25, m_highlights);
-    query.bindValue(26, m_caEnabled);
-    query.bindValue(27, m_temperature);
-    query.bindValue(28, m_tint);
-    query.bindValue(29, m_vibrance);
-    query.bindValue(30, m_saturation);
-    query.bindValue(31, m_rotation);
-    query.bindValue(32, m_cropHeight);
-    query.bindValue(33, m_cropAspect);
-    query.bindValue(34, m_cropVoffset);
-    query.bindValue(35, m_cropHoffset);
-    query.bindValue(36, m_monochrome);
-    query.bindValue(37, m_bwRmult);
-    query.bindValue(38, m_bwGmult);
-    query.bindValue(39, m_bwBmult);
-    query.bindValue(40, m_toeBoundary);
-    query.bindValue(41, m_lensfunName);
-    query.bindValue(42, m_lensfunCa);
-    query.bindValue(43, m_lensfunVign);
-    query.bindValue(44, m_lensfunDist);
-    query.bindValue(45, m_rotationAngle);
-    query.bindValue(46, m_rotationPointX);
-    query.bindValue(47, m_rotationPointY);
-    query.exec();
-    //Write that it's been edited to the SearchTable (actually writing the edit time)
-    QDateTime now = QDateTime::currentDateTime();
-    query.prepare("UPDATE SearchTable SET STlastProcessedTime = ?, "
-                  "STthumbWritten = 0, "
-                  "STbigThumbWritten = 0 "
-                  "WHERE STsearchID = ?;");
-    query.bindValue(0, QVariant(now.toSecsSinceEpoch()));
-    query.bindValue(1, imageID);
-    query.exec();
-    //Write that it's been edited to the QueueTable
-    //If it's not in the queue yet then this won't do anything.
-    query.prepare("UPDATE QueueTable SET QTprocessed = 1, "
-                  "QTexported = 0 WHERE QTsearchID = ?;");
-    query.bindValue(0, imageID);
-    query.exec();
-    query.exec("COMMIT;");//Apply all the changes together.
-
-    //Notify other database models of the changes.
-    //If you change this, you have to change the same in paste() as well.
-    emit updateTableOut("ProcessingTable", 0);//0 means edit
-    emit updateTableOut("SearchTable", 0);//0 means edit
-    emit updateTableOut("QueueTable", 0);//0 means edit
+    //The write itself happens later on the writer thread, which also notifies
+    // the other database models once it's done.
+    ParamWriteWorker::instance()->enqueue(imageID, processingRow(imageID));
+}
+
+//This lays out the ProcessingTable columns in the order ParamWriteWorker binds them.
+QVariantList ParameterManager::processingRow(QString imageID)
+{
+    QVariantList row;
+    row << imageID;
+    row << m_initialDeveloperConcentration;
+    row << m_reservoirThickness;
+    row << m_activeLayerThickness;
+    row << m_crystalsPerPixel;
+    row << m_initialCrystalRadius;
+    row << m_initialSilverSaltDensity;
+    row << m_developerConsumptionConst;
+    row << m_crystalGrowthConst;
+    row << m_silverSaltConsumptionConst;
+    row << m_totalDevelopmentTime;
+    row << m_agitateCount;
+    row << m_developmentSteps;
+    row << m_filmArea;
+    row << m_sigmaConst;
+    row << m_layerMixConst;
+    row << m_layerTimeDivisor;
+    row << m_rolloffBoundary;
+    row << m_exposureComp;
+    row << m_whitepoint;
+    row << m_blackpoint;
+    row << m_shadowsX;
+    row << m_shadowsY;
+    row << m_highlightsX;
+    row << m_highlightsY;
+    row << m_highlights;
+    row << m_caEnabled;
+    row << m_temperature;
+    row << m_tint;
+    row << m_vibrance;
+    row << m_saturation;
+    row << m_rotation;
+    row << m_cropHeight;
+    row << m_cropAspect;
+    row << m_cropVoffset;
+    row << m_cropHoffset;
+    row << m_monochrome;
+    row << m_bwRmult;
+    row << m_bwGmult;
+    row << m_bwBmult;
+    row << m_toeBoundary;
+    row << m_lensfunName;
+    row << m_lensfunCa;
+    row << m_lensfunVign;
+    row << m_lensfunDist;
+    row << m_rotationAngle;
+    row << m_rotationPointX;
+    row << m_rotationPointY;
+    return row;
 }
 
 //selectImage deals with selection from qml.
@@ -1338,17 +1209,22 @@ void ParameterManager::selectImage(const QString imageID)
     QMutexLocker paramLocker(&paramMutex);//Make all the param changes happen together.
     disableParamChange();//Prevent aborting of computation.
 
+    //Any edits to this image still waiting to be written need to land before we read them back.
+    ParamWriteWorker::instance()->flush(imageID);
+
     if (imageIndex != imageID)
     {
+        //And the last image's edits shouldn't wait around.
+        ParamWriteWorker::instance()->writeSoon();
         imageIndex = imageID;
         if (processedYet)
         {
-            validityWhenCanceled = validity;
+            validityWhenCanceled = validity.load();
             processedYet = false;
         } else {
             validityWhenCanceled = Valid::none;
         }
-        validity = Valid::none;
+        invalidate(Valid::none);
         emit imageIndexChanged();
     }
 
@@ -1383,6 +1259,7 @@ void ParameterManager::selectImage(const QString imageID)
     if(!file.open(QIODevice::ReadOnly))
     {
         qDebug("File could not be opened.");
+        publish();
         emit fileError();
         return;
     } else {
@@ -1580,45 +1457,25 @@ void ParameterManager::selectImage(const QString imageID)
 
     //Finally, we need to change the availability for the various lens corrections
     //First is Auto CA Correct, which only works with Bayer CFAs.
-    std::unique_ptr<LibRaw> libraw = std::unique_ptr<LibRaw>(new LibRaw());
-    int libraw_error;
-#if (defined(_WIN32) || defined(__WIN32__))
-    const QString tempFilename = QString::fromStdString(m_fullFilename);
-    std::wstring wstr = tempFilename.toStdWString();
-    libraw_error = libraw->open_file(wstr.c_str());
-#else
-    const char *cstr = m_fullFilename.c_str();
-    libraw_error = libraw->open_file(cstr);
-#endif
-    if (libraw_error)
+    //This is stored in the file table alongside the camera WB.
+    float temp_temperature, temp_tint;
+    bool temp_autoCaAvail;
+    if (!fileDefaults(tempString, name, temp_temperature, temp_tint, temp_autoCaAvail))
     {
         cout << "selectImage: Could not read input file!" << endl;
-        cout << "libraw error text: " << libraw_strerror(libraw_error) << endl;
+        publish();
         emit fileError();
         return;
     }
-
-    bool isSraw = libraw->is_sraw();
-    //cout << "Is sraw: " << isSraw << endl;
-    bool isWeird = libraw->COLOR(0,0)==6;
-    //cout << "Is weird: " << isWeird << endl;
-    int maxXtrans = 0;
-    for (int i=0; i<6; i++)
-    {
-        for (int j=0; j<6; j++)
-        {
-            maxXtrans = max(maxXtrans,int(libraw->imgdata.idata.xtrans[i][j]));
-        }
-    }
-    bool isXtrans = maxXtrans > 0;
-    //cout << "Is xtrans: " << isXtrans << endl;
-    autoCaAvail = !isSraw && !isWeird && !isXtrans;
+    autoCaAvail = temp_autoCaAvail;
     //cout << "Auto CA is available: " << autoCaAvail << endl;
     emit autoCaAvailChanged();
 
     //Then is lensfun, which depends on the camera and lens.
     updateAvailability();
 
+    //Everything for the new image goes out to the pipelines at once.
+    publish();
     paramLocker.unlock();
 
     //Emit that the things have changed.
@@ -1744,7 +1601,7 @@ void ParameterManager::loadDefaults(const CopyDefaults copyDefaults, const std::
     //These should be changed depending on the file, once we get this loading tiffs.
     if (copyDefaults == CopyDefaults::loadToParams)
     {
-        validity = Valid::none;
+        invalidate(Valid::none);
         m_tiffIn = false;
         m_jpegIn = false;
     }
@@ -1849,9 +1706,13 @@ void ParameterManager::loadDefaults(const CopyDefaults copyDefaults, const std::
     }
     else
     {
-        //If there is a file, calculate the camera WB.
+        //If there is a file, use the camera WB.
+        //It's computed at import and kept in the file table, so we don't reopen the raw.
         float temp_temperature, temp_tint;
-        optimizeWBMults(absFilePath, temp_temperature, temp_tint);
+        bool temp_autoCaAvail;
+        QString fileID = imageIndex;
+        fileID.truncate(32);//length of md5
+        fileDefaults(fileID, QString::fromStdString(absFilePath), temp_temperature, temp_tint, temp_autoCaAvail);
         d_temperature = temp_temperature;
         d_tint = temp_tint;
     }
@@ -2230,7 +2091,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams caEnabled" << endl;
         m_caEnabled = temp_caEnabled;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //highlights (highlight recovery)
@@ -2241,7 +2102,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams highlights" << endl;
         m_highlights = temp_highlights;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun lens name
@@ -2252,7 +2113,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams lensfunName" << endl;
         m_lensfunName = temp_lensfunName;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun CA correction
@@ -2263,7 +2124,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams lensfunCa" << endl;
         m_lensfunCa = temp_lensfunCa;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun vignetting correction
@@ -2274,7 +2135,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams lensfunVign" << endl;
         m_lensfunVign = temp_lensfunVign;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun distortion correction
@@ -2285,7 +2146,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams lensfunDist" << endl;
         m_lensfunDist = temp_lensfunDist;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Fine rotation angle
@@ -2296,7 +2157,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams rotationAngle" << endl;
         m_rotationAngle = temp_rotationAngle;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Rotation reference point coordinates
@@ -2327,7 +2188,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams exposureComp" << endl;
         m_exposureComp = temp_exposureComp;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
     }
 
     //Temperature
@@ -2338,7 +2199,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams temperature" << endl;
         m_temperature = temp_temperature;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
     }
 
     //Tint
@@ -2349,7 +2210,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams tint" << endl;
         m_tint = temp_tint;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
     }
 
     //Initial developer concentration
@@ -2360,7 +2221,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams initialDeveloperConcentration" << endl;
         m_initialDeveloperConcentration = temp_initialDeveloperConcentration;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Reservoir thickness
@@ -2371,7 +2232,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams reservoirThickness" << endl;
         m_reservoirThickness = temp_reservoirThickness;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Active layer thickness
@@ -2382,7 +2243,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams activeLayerThickness" << endl;
         m_activeLayerThickness = temp_activeLayerThickness;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Crystals per pixel
@@ -2393,7 +2254,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams crystalsPerPixel" << endl;
         m_crystalsPerPixel = temp_crystalsPerPixel;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Initial crystal radius
@@ -2404,7 +2265,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams initialCrystalRadius" << endl;
         m_initialCrystalRadius = temp_initialCrystalRadius;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Initial silver salt area density
@@ -2415,7 +2276,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams initialSilverSaltDensity" << endl;
         m_initialSilverSaltDensity = temp_initialSilverSaltDensity;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Developer consumption rate constant
@@ -2426,7 +2287,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams developerConsumptionConst" << endl;
         m_developerConsumptionConst = temp_developerConsumptionConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Crystal growth rate constant
@@ -2437,7 +2298,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams crystalGrowthConst" << endl;
         m_crystalGrowthConst = temp_crystalGrowthConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Silver halide consumption rate constant
@@ -2448,7 +2309,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams silverSaltConsumptionConst" << endl;
         m_silverSaltConsumptionConst = temp_silverSaltConsumptionConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Total development time
@@ -2459,7 +2320,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams totalDevelopmentTime" << endl;
         m_totalDevelopmentTime = temp_totalDevelopmentTime;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Number of agitations
@@ -2470,7 +2331,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams agitateCount" << endl;
         m_agitateCount = temp_agitateCount;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Number of simulation steps for development
@@ -2481,7 +2342,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams developmentSteps" << endl;
         m_developmentSteps = temp_developmentSteps;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Area of film for the simulation
@@ -2492,7 +2353,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams filmArea" << endl;
         m_filmArea = temp_filmArea;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //A constant for the size of the diffusion. It...affects the same thing as film area.
@@ -2503,7 +2364,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams sigmaConst" << endl;
         m_sigmaConst = temp_sigmaConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Layer mix constant: the amount of active developer that gets exchanged with the reservoir.
@@ -2514,7 +2375,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams layerMixConst" << endl;
         m_layerMixConst = temp_layerMixConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Layer time divisor: Controls the relative intra-layer and inter-layer diffusion.
@@ -2525,7 +2386,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams layerTimeDivisor" << endl;
         m_layerTimeDivisor = temp_layerTimeDivisor;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Rolloff boundary. This is where highlights start to roll off.
@@ -2536,7 +2397,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams rolloffBoundary" << endl;
         m_rolloffBoundary = temp_rolloffBoundary;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Toe boundary. This is the offset for the values where the toe starts to roll off.
@@ -2547,7 +2408,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams toeBoundary" << endl;
         m_toeBoundary = temp_toeBoundary;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Post-filmulator black clipping point
@@ -2558,7 +2419,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams blackpoint" << endl;
         m_blackpoint = temp_blackpoint;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::crop);
     }
 
     //Post-filmulator white clipping point
@@ -2569,7 +2430,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams whitepoint" << endl;
         m_whitepoint = temp_whitepoint;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::crop);
     }
 
     //Height of the crop WRT image height
@@ -2580,7 +2441,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams cropHeight" << endl;
         m_cropHeight = temp_cropHeight;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Aspect ratio of the crop
@@ -2591,7 +2452,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams cropAspect" << endl;
         m_cropAspect = temp_cropAspect;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Vertical position offset relative to center, WRT image height
@@ -2602,7 +2463,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams cropVoffset" << endl;
         m_cropVoffset = temp_cropVoffset;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Horizontal position offset relative to center, WRT image width
@@ -2613,7 +2474,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams cropHoffset" << endl;
         m_cropHoffset = temp_cropHoffset;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Shadow control point x value
@@ -2624,7 +2485,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams shadowsX" << endl;
         m_shadowsX = temp_shadowsX;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Shadow control point y value
@@ -2635,7 +2496,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams shadowsY" << endl;
         m_shadowsY = temp_shadowsY;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Highlight control point x value
@@ -2646,7 +2507,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams highlightsX" << endl;
         m_highlightsX = temp_highlightsX;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Highlight control point y value
@@ -2657,7 +2518,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams highlightsY" << endl;
         m_highlightsY = temp_highlightsY;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Vibrance (saturation of less-saturated things)
@@ -2668,7 +2529,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams vibrance" << endl;
         m_vibrance = temp_vibrance;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Saturation
@@ -2679,7 +2540,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams saturation" << endl;
         m_saturation = temp_saturation;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Whether to convert to monochrome
@@ -2690,7 +2551,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams monochrome" << endl;
         m_monochrome = temp_monochrome;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Red weight multiplier for b&w conversion
@@ -2701,7 +2562,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams bwRmult" << endl;
         m_bwRmult = temp_bwRmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Green weight multiplier for b&w conversion
@@ -2712,7 +2573,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams bwGmult" << endl;
         m_bwGmult = temp_bwGmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Blue weight multiplier for b&w conversion
@@ -2723,7 +2584,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams bwBmult" << endl;
         m_bwBmult = temp_bwBmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Rotation
@@ -2734,7 +2595,7 @@ void ParameterManager::loadParams(QString imageID)
     {
         //cout << "ParameterManager::loadParams rotation" << endl;
         m_rotation = temp_rotation;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 }
 
@@ -2758,6 +2619,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     if (isClone)
     {
         changeMadeSinceCheck = true;
+        cancelToken.cancel();
     }
 
     //Load the image index
@@ -2765,7 +2627,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     if (temp_imageIndex != imageIndex)
     {
         imageIndex = temp_imageIndex;
-        validity = min(validity, Valid::none);
+        invalidate(Valid::none);
     }
 
     //do stuff to load filename and other file info; taken from selectImage
@@ -2867,7 +2729,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     if (temp_tiffIn != m_tiffIn)
     {
         m_tiffIn = temp_tiffIn;
-        validity = min(validity, Valid::none);
+        invalidate(Valid::none);
     }
 
     //So should jpegIn.
@@ -2875,7 +2737,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     if (temp_jpegIn != m_jpegIn)
     {
         m_jpegIn = temp_jpegIn;
-        validity = min(validity, Valid::none);
+        invalidate(Valid::none);
     }
 
     //Then is caEnabled.
@@ -2884,7 +2746,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams caEnabled" << endl;
         s_caEnabled = temp_caEnabled;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Highlight recovery
@@ -2893,7 +2755,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams highlights" << endl;
         m_highlights = temp_highlights;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun lens name
@@ -2902,7 +2764,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams lensfunName" << endl;
         s_lensfunName = temp_lensfunName;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun CA correction
@@ -2911,7 +2773,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams lensfunCa" << endl;
         s_lensfunCa = temp_lensfunCa;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun vignetting correction
@@ -2920,7 +2782,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams lensfunVign" << endl;
         s_lensfunVign = temp_lensfunVign;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Lensfun distortion correction
@@ -2929,7 +2791,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams lensfunDist" << endl;
         s_lensfunDist = temp_lensfunDist;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Fine rotation angle
@@ -2938,7 +2800,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams rotationAngle" << endl;
         m_rotationAngle = temp_rotationAngle;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Rotation reference point coordinates
@@ -2947,14 +2809,14 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams rotationPointX" << endl;
         m_rotationPointX = temp_rotationPointX;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
     const float temp_rotationPointY = sourceParams->getRotationPointY();
     if (temp_rotationPointY != m_rotationPointY)
     {
         //cout << "ParameterManager::cloneParams rotationPointY" << endl;
         m_rotationPointY = temp_rotationPointY;
-        validity = min(validity, Valid::load);
+        invalidate(Valid::load);
     }
 
     //Exposure compensation
@@ -2963,7 +2825,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams exposureComp" << endl;
         m_exposureComp = temp_exposureComp;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
     }
 
     //Temperature
@@ -2972,7 +2834,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams temperature" << endl;
         m_temperature = temp_temperature;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
     }
 
     //Tint
@@ -2981,7 +2843,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams tint" << endl;
         m_tint = temp_tint;
-        validity = min(validity, Valid::demosaic);
+        invalidate(Valid::demosaic);
     }
 
     //Initial developer concentration
@@ -2990,7 +2852,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams initialDeveloperConcentration" << endl;
         m_initialDeveloperConcentration = temp_initialDeveloperConcentration;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Reservoir thickness
@@ -2999,7 +2861,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams reservoirThickness" << endl;
         m_reservoirThickness = temp_reservoirThickness;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Active layer thickness
@@ -3008,7 +2870,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams activeLayerThickness" << endl;
         m_activeLayerThickness = temp_activeLayerThickness;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Crystals per pixel
@@ -3017,7 +2879,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams crystalsPerPixel" << endl;
         m_crystalsPerPixel = temp_crystalsPerPixel;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Initial crystal radius
@@ -3026,7 +2888,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams initialCrystalRadius" << endl;
         m_initialCrystalRadius = temp_initialCrystalRadius;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Initial silver salt area density
@@ -3035,7 +2897,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams initialSilverSaltDensity" << endl;
         m_initialSilverSaltDensity = temp_initialSilverSaltDensity;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Developer consumption rate constant
@@ -3044,7 +2906,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams developerConsumptionConst" << endl;
         m_developerConsumptionConst = temp_developerConsumptionConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Crystal growth rate constant
@@ -3053,7 +2915,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams crystalGrowthConst" << endl;
         m_crystalGrowthConst = temp_crystalGrowthConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Silver halide consumption rate constant
@@ -3062,7 +2924,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams silverSaltConsumptionConst" << endl;
         m_silverSaltConsumptionConst = temp_silverSaltConsumptionConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Total development time
@@ -3071,7 +2933,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams totalDevelopmentTime" << endl;
         m_totalDevelopmentTime = temp_totalDevelopmentTime;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Number of agitations
@@ -3080,7 +2942,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams agitateCount" << endl;
         m_agitateCount = temp_agitateCount;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Number of simulation steps for development
@@ -3089,7 +2951,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams developmentSteps" << endl;
         m_developmentSteps = temp_developmentSteps;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Area of film for the simulation
@@ -3098,7 +2960,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams filmArea" << endl;
         m_filmArea = temp_filmArea;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //A constant for the size of the diffusion. It...affects the same thing as film area.
@@ -3107,7 +2969,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams sigmaConst" << endl;
         m_sigmaConst = temp_sigmaConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Layer mix constant: the amount of active developer that gets exchanged with the reservoir.
@@ -3116,7 +2978,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams layerMixConst" << endl;
         m_layerMixConst = temp_layerMixConst;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Layer time divisor: Controls the relative intra-layer and inter-layer diffusion.
@@ -3125,7 +2987,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams layerTimeDivisor" << endl;
         m_layerTimeDivisor = temp_layerTimeDivisor;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Rolloff boundary. This is where highlights start to roll off.
@@ -3134,7 +2996,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams rolloffBoundary" << endl;
         m_rolloffBoundary = temp_rolloffBoundary;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Toe boundary. This is the offset for the values where the toe starts to roll off.
@@ -3143,7 +3005,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams toeBoundary" << endl;
         m_toeBoundary = temp_toeBoundary;
-        validity = min(validity, Valid::prefilmulation);
+        invalidate(Valid::prefilmulation);
     }
 
     //Post-filmulator black clipping point
@@ -3152,7 +3014,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams blackpoint" << endl;
         m_blackpoint = temp_blackpoint;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::crop);
     }
 
     //Post-filmulator white clipping point
@@ -3161,7 +3023,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams whitepoint" << endl;
         m_whitepoint = temp_whitepoint;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::crop);
     }
 
     //Height of the crop WRT image height
@@ -3170,7 +3032,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams cropHeight" << endl;
         m_cropHeight = temp_cropHeight;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Aspect ratio of the crop
@@ -3179,7 +3041,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams cropAspect" << endl;
         m_cropAspect = temp_cropAspect;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Vertical position offset relative to center, WRT image height
@@ -3188,7 +3050,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams cropVoffset" << endl;
         m_cropVoffset = temp_cropVoffset;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Horizontal position offset relative to center, WRT image width
@@ -3197,7 +3059,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams cropHoffset" << endl;
         m_cropHoffset = temp_cropHoffset;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
     //Shadow control point x value
@@ -3206,7 +3068,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams shadowsX" << endl;
         m_shadowsX = temp_shadowsX;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Shadow control point y value
@@ -3215,7 +3077,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams shadowsY" << endl;
         m_shadowsY = temp_shadowsY;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Highlight control point x value
@@ -3224,7 +3086,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams highlightsX" << endl;
         m_highlightsX = temp_highlightsX;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Highlight control point y value
@@ -3233,7 +3095,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams highlightsY" << endl;
         m_highlightsY = temp_highlightsY;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Vibrance (saturation of less-saturated things)
@@ -3242,7 +3104,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams vibrance" << endl;
         m_vibrance = temp_vibrance;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Saturation
@@ -3251,7 +3113,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams saturation" << endl;
         m_saturation = temp_saturation;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Whether to convert to monochrome
@@ -3260,7 +3122,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams monochrome" << endl;
         m_monochrome = temp_monochrome;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Red weight multiplier for b&w conversion
@@ -3269,7 +3131,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams bwRmult" << endl;
         m_bwRmult = temp_bwRmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Green weight multiplier for b&w conversion
@@ -3278,7 +3140,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams bwGmult" << endl;
         m_bwGmult = temp_bwGmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Blue weight multiplier for b&w conversion
@@ -3287,7 +3149,7 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams bwBmult" << endl;
         m_bwBmult = temp_bwBmult;
-        validity = min(validity, Valid::blackwhite);
+        invalidate(Valid::blackwhite);
     }
 
     //Rotation
@@ -3296,9 +3158,10 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
     {
         //cout << "ParameterManager::cloneParams rotation" << endl;
         m_rotation = temp_rotation;
-        validity = min(validity, Valid::filmulation);
+        invalidate(Valid::filmulation);
     }
 
+    publish();
     enableParamChange();//Re-enable updating of the image.
     paramChangeWrapper(QString("cloneParams"));
 }
@@ -3306,6 +3169,150 @@ void ParameterManager::cloneParams(ParameterManager * sourceParams)
 void ParameterManager::cancelComputation()
 {
     changeMadeSinceCheck = true;
+    cancelToken.cancel();
+}
+
+//Records that everything after the given stage is stale.
+//Nothing is visible to the pipelines until publish() is called.
+//Call this with paramMutex held.
+void ParameterManager::invalidate(Valid stage)
+{
+    pendingInvalidation = min(pendingInvalidation, stage);
+}
+
+//Copies the current params into a new snapshot and swaps it in, then lowers validity
+// for whatever was invalidated since the last publish. If that makes the stage being
+// worked on stale, the kernels working on it are told to give up.
+//The snapshot has to go out before validity drops: a pipeline that claims after
+// seeing the lower validity must also see the new params.
+//Call this with paramMutex held.
+void ParameterManager::publish()
+{
+    std::shared_ptr<const ParamSnapshot> previous = currentSnapshot();
+    std::shared_ptr<ParamSnapshot> next = std::make_shared<ParamSnapshot>();
+    next->version = previous ? previous->version + 1 : 1;
+    for (int i = 0; i < Valid::count/2; i++)
+    {
+        //Stage i runs as part-Valid 2i+1, so it's stale if invalidated to anything before that.
+        const bool stale = !previous || pendingInvalidation < Valid(2*i + 1);
+        next->changed[i] = stale ? next->version : previous->changed[i];
+    }
+
+    next->load.fullFilename = m_fullFilename;
+    next->load.sourceHash = imageIndex.left(32).toStdString();
+    next->load.tiffIn = m_tiffIn;
+    next->load.jpegIn = m_jpegIn;
+
+    next->demosaic.caEnabled = s_caEnabled;
+    next->demosaic.highlights = m_highlights;
+    next->demosaic.cameraName = model;
+    next->demosaic.lensName = s_lensfunName;//we use the staging ones because they're always populated
+    next->demosaic.lensfunCA = s_lensfunCa >= 1;
+    next->demosaic.lensfunVignetting = s_lensfunVign >= 1;
+    next->demosaic.lensfunDistortion = s_lensfunDist >= 1;
+    next->demosaic.focalLength = focalLength;
+    next->demosaic.fnumber = fnumber;
+    next->demosaic.rotationAngle = m_rotationAngle;
+
+    next->prefilm.exposureComp = m_exposureComp;
+    next->prefilm.temperature = m_temperature;
+    next->prefilm.tint = m_tint;
+    next->prefilm.fullFilename = m_fullFilename;//it's okay to include previous things in later params if necessary
+
+    next->film.initialDeveloperConcentration = m_initialDeveloperConcentration;
+    next->film.reservoirThickness = m_reservoirThickness;
+    next->film.activeLayerThickness = m_activeLayerThickness;
+    next->film.crystalsPerPixel = m_crystalsPerPixel;
+    next->film.initialCrystalRadius = m_initialCrystalRadius;
+    next->film.initialSilverSaltDensity = m_initialSilverSaltDensity;
+    next->film.developerConsumptionConst = m_developerConsumptionConst;
+    next->film.crystalGrowthConst = m_crystalGrowthConst;
+    next->film.silverSaltConsumptionConst = m_silverSaltConsumptionConst;
+    next->film.totalDevelopmentTime = m_totalDevelopmentTime;
+    next->film.agitateCount = m_agitateCount;
+    next->film.developmentSteps = m_developmentSteps;
+    next->film.filmArea = m_filmArea;
+    next->film.sigmaConst = m_sigmaConst;
+    next->film.layerMixConst = m_layerMixConst;
+    next->film.layerTimeDivisor = m_layerTimeDivisor;
+    next->film.rolloffBoundary = m_rolloffBoundary;
+    next->film.toeBoundary = m_toeBoundary;
+
+    next->crop.cropHeight  = m_cropHeight;
+    next->crop.cropAspect  = m_cropAspect;
+    next->crop.cropVoffset = m_cropVoffset;
+    next->crop.cropHoffset = m_cropHoffset;
+    next->crop.rotation = m_rotation;
+
+    next->blackWhite.blackpoint  = m_blackpoint;
+    next->blackWhite.whitepoint  = m_whitepoint;
+
+    next->filmlikeCurves.shadowsX = m_shadowsX;
+    next->filmlikeCurves.shadowsY = m_shadowsY;
+    next->filmlikeCurves.highlightsX = m_highlightsX;
+    next->filmlikeCurves.highlightsY = m_highlightsY;
+    next->filmlikeCurves.vibrance = m_vibrance;
+    next->filmlikeCurves.saturation = m_saturation;
+    next->filmlikeCurves.monochrome = m_monochrome;
+    next->filmlikeCurves.bwRmult = m_bwRmult;
+    next->filmlikeCurves.bwGmult = m_bwGmult;
+    next->filmlikeCurves.bwBmult = m_bwBmult;
+
+    std::atomic_store(&snapshot, std::shared_ptr<const ParamSnapshot>(next));
+
+    if (pendingInvalidation < Valid::count)
+    {
+        Valid current = validity.load();
+        while (current > pendingInvalidation && !validity.compare_exchange_weak(current, pendingInvalidation)) {}
+        if (pendingInvalidation < runningStage)
+        {
+            cancelToken.cancel();
+        }
+        pendingInvalidation = Valid::count;
+    }
+}
+
+//Marks a stage in progress if everything it needs is still valid.
+//Claims fetch their params only after this, so that any change that sneaks in
+// between also lowers validity and gets caught by the abort checks.
+bool ParameterManager::advanceValidity(Valid required, Valid partStage)
+{
+    Valid current = validity.load();
+    while (current >= required)
+    {
+        if (validity.compare_exchange_weak(current, partStage))
+        {
+            runningStage = partStage;
+            cancelToken.reset();
+            //A change that landed since the CAS had its cancel wiped out by the reset,
+            // but it left validity lowered or the change flag set.
+            if (validity.load() < partStage || changeMadeSinceCheck)
+            {
+                cancelToken.cancel();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+//True if the claimed stage's inputs have changed since it claimed them.
+bool ParameterManager::stageStale(Valid partStage)
+{
+    return validity < partStage ||
+           currentSnapshot()->changed[partStage/2] != claimedVersion[partStage/2];
+}
+
+//Marks a stage complete, but only if nothing it used changed while it ran.
+Valid ParameterManager::completeStage(Valid partStage, Valid doneStage)
+{
+    processedYet = true;
+    Valid expected = partStage;
+    if (!stageStale(partStage))
+    {
+        validity.compare_exchange_strong(expected, doneStage);
+    }
+    return validity;
 }
 
 //This prevents the back-and-forth between this object and QML from aborting
@@ -3354,18 +3361,25 @@ void ParameterManager::copyAll(QString fromImageID)
 }
 
 void ParameterManager::paste(QString toImageID)
+{
+    pasteMany(QStringList() << toImageID);
+}
+
+//The source is only loaded once however many targets there are,
+// and all of them go to the database in one transaction.
+void ParameterManager::pasteMany(QStringList toImageIDs)
 {
     if (pasteable)
     {
         if (!pasteSome)
         {
             ParameterManager tempParams;
+            ParamWriteWorker::instance()->flush(copyFromImageIndex);
             tempParams.loadParams(copyFromImageIndex);
-            tempParams.writeToDB(toImageID);
-            //The tempParams do not have their updateTableOut connected.
-            emit updateTableOut("ProcessingTable", 0);//0 means edit
-            emit updateTableOut("SearchTable", 0);//0 means edit
-            emit updateTableOut("QueueTable", 0);//0 means edit
+            //The writer notifies the other models once this lands.
+            ParamWriteWorker::instance()->enqueueMany(toImageIDs, tempParams.processingRow(""));
+            //Whoever pasted is likely to reload one of these right away.
+            ParamWriteWorker::instance()->writeSoon();
         }
         else// we only want to copy some of the parameters.
         {
@@ -3373,7 +3387,7 @@ void ParameterManager::paste(QString toImageID)
             //tempParams.loadParams(copyFromImageIndex);
 
             //do something to only copy some of them.
-            //tempParams.writeSomeToDB(some,toImageID);
+            //tempParams.writeSomeToDB(some,toImageIDs);
         }
     }
 }
@@ -9,8 +9,10 @@
 #include <QMutexLocker>
 #include <QDateTime>
 #include <QString>
+#include <QStringList>
 #include <QDebug>
 #include <tuple>
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <lensfun/lensfun.h>
@@ -26,6 +28,8 @@ enum Valid {none,
             prefilmulation,
             partfilmulation,
             filmulation,
+            partcrop,
+            crop,
             partblackwhite,
             blackwhite,
             partcolorcurve,
@@ -46,6 +50,7 @@ enum CopyDefaults {loadToParams,
 //We want a struct for each stage of the pipeline for validity.
 struct LoadParams {
     std::string fullFilename;
+    std::string sourceHash;//md5 of the file, from the image ID
     bool tiffIn;
     bool jpegIn;
 };
@@ -91,9 +96,7 @@ struct FilmParams {
     float toeBoundary;
 };
 
-struct BlackWhiteParams {
-    float blackpoint;
-    float whitepoint;
+struct CropParams {
     float cropHeight;
     float cropAspect;
     float cropVoffset;
@@ -101,6 +104,11 @@ struct BlackWhiteParams {
     int rotation;
 };
 
+struct BlackWhiteParams {
+    float blackpoint;
+    float whitepoint;
+};
+
 struct FilmlikeCurvesParams {
     float shadowsX;
     float shadowsY;
@@ -114,6 +122,23 @@ struct FilmlikeCurvesParams {
     float bwBmult;
 };
 
+//Everything the pipeline reads from a ParameterManager, frozen at one moment.
+//The UI side publishes a new one after each change by swapping a shared pointer,
+// so the pipelines can claim params and check for aborts without taking paramMutex.
+struct ParamSnapshot {
+    unsigned long version;
+    //For each stage, indexed by its part-Valid over two, the version at which its
+    // inputs last changed. If that moves while a stage is running, its work is stale.
+    unsigned long changed[Valid::count/2];
+    LoadParams load;
+    DemosaicParams demosaic;
+    PrefilmParams prefilm;
+    FilmParams film;
+    CropParams crop;
+    BlackWhiteParams blackWhite;
+    FilmlikeCurvesParams filmlikeCurves;
+};
+
 class ParameterManager : public QObject
 {
     Q_OBJECT
@@ -261,6 +286,9 @@ public:
 
     Q_INVOKABLE void copyAll(QString fromImageID);
     Q_INVOKABLE void paste(QString toImageID);
+    //Pastes onto many images at once. As with paste(), the caller has to refresh any
+    // of these that are loaded in the editor.
+    Q_INVOKABLE void pasteMany(QStringList toImageIDs);
 
     //Must be called when resetting lens corrections back to default
     //So that we write back to the database, the db gets the proper "autoselect" values
@@ -298,7 +326,12 @@ public:
     AbortStatus claimFilmAbort();
     Valid markFilmComplete();
 
-    //Whitepoint & Blackpoint (and cropping and rotation and distortion)
+    //Rotation and cropping
+    std::tuple<Valid,AbortStatus,CropParams> claimCropParams();
+    AbortStatus claimCropAbort();
+    Valid markCropComplete();
+
+    //Whitepoint & Blackpoint
     std::tuple<Valid,AbortStatus,BlackWhiteParams> claimBlackWhiteParams();
     AbortStatus claimBlackWhiteAbort();
     Valid markBlackWhiteComplete();
@@ -317,7 +350,21 @@ public:
 
     void markStartOfProcessing(){changeMadeSinceCheck = false;}
 
-    std::string getFullFilename(){return m_fullFilename;}
+    //For pipelines that render params nobody has set, like speculative previews:
+    // swaps in the given snapshot as if it had been published, valid through the given stage.
+    void useSnapshot(std::shared_ptr<const ParamSnapshot> snap, Valid validIn);
+
+    //Drops validity to at most the given stage, for when a pipeline's held stages change
+    // under it; anything running past that stage is cancelled.
+    void lowerValid(Valid stage);
+
+    //Tripped when the stage being worked on becomes stale; see CancelToken.
+    CancelToken * getCancelToken(){return &cancelToken;}
+
+    std::string getFullFilename(){return currentSnapshot()->load.fullFilename;}
+
+    //The latest published params; safe to call from any thread.
+    std::shared_ptr<const ParamSnapshot> currentSnapshot() const {return std::atomic_load(&snapshot);}
 
     void setClone(){isClone = true;}
 
@@ -480,10 +527,31 @@ protected:
     //If this is true, then this is the clone parameter manager
     //and we should always abort whenever there's a change made
     bool isClone = false;
-    bool changeMadeSinceCheck = false;
-
-    //The paramMutex exists to prevent race conditions between
-    //changes in the parameters and changes in validity.
+    std::atomic<bool> changeMadeSinceCheck{false};
+
+    //The stage most recently claimed, and the token its kernels poll.
+    std::atomic<Valid> runningStage{Valid::none};
+    CancelToken cancelToken;
+
+    //Param changes are staged in the m_ and s_ members and only become visible to the
+    // pipelines on publish(), which swaps in a new snapshot and then lowers validity
+    // to the earliest stage passed to invalidate() since the last publish.
+    void invalidate(Valid stage);
+    void publish();
+    std::shared_ptr<const ParamSnapshot> snapshot;
+    Valid pendingInvalidation = Valid::count;
+
+    //The snapshot version each stage claimed, indexed like ParamSnapshot::changed.
+    //Only touched by the thread running the pipeline.
+    unsigned long claimedVersion[Valid::count/2] = {};
+
+    //Lock-free helpers for the claim, abort check, and mark complete methods.
+    bool advanceValidity(Valid required, Valid partStage);
+    bool stageStale(Valid partStage);
+    Valid completeStage(Valid partStage, Valid doneStage);
+
+    //The paramMutex keeps UI-side edits from interleaving with each other and with publish().
+    //The pipelines never take it.
     QMutex paramMutex;
     QMutex signalMutex;
 
@@ -501,6 +569,7 @@ protected:
     bool pasteSome;
 
     void writeToDB(QString imageID);
+    QVariantList processingRow(QString imageID);
     void paramChangeWrapper(QString);
     void disableParamChange();
     void enableParamChange();
@@ -524,11 +593,11 @@ protected:
     bool lensfunVignAvail;
     bool lensfunDistAvail;
 
-    Valid validity;
-    Valid validityWhenCanceled;
+    std::atomic<Valid> validity;
+    std::atomic<Valid> validityWhenCanceled;
 
     //this is for dealing with the validity when canceled
-    bool processedYet = false;
+    std::atomic<bool> processedYet{false};
 
     //Input
     std::string m_fullFilename;
@@ -0,0 +1,194 @@
+#include "preloadWorker.h"
+#include <QSqlQuery>
+#include <iostream>
+#include "../database/database.hpp"
+using namespace std;
+
+//How many images past the current one get preloaded.
+#define PRELOAD_COUNT 2
+//Preloading doesn't start another image once image buffers take up more than this share of the memory budget.
+#define PRELOAD_BUDGET_SHARE 0.5
+
+PreloadWorker::PreloadWorker(QObject *parent) : QObject(parent)
+{
+    paused = true;
+    for (int i = 0; i < PRELOAD_COUNT; i++)
+    {
+        Preload preload;
+        preload.params = new ParameterManager;
+        preload.pipe = new ImagePipeline(WithCache, NoHisto, HighQuality, "preload" + std::to_string(i));
+        preload.pipe->setDiskCache(true);
+        //These stages are dropped before anybody else's when memory is tight,
+        // and they only get the cores nothing else wants.
+        preload.pipe->setEvictionWeight(0.25);
+        preload.pipe->setWorkClass(WorkClass::background);
+        preloads.push_back(preload);
+    }
+    moveToThread(&thread);
+    thread.start(QThread::LowPriority);
+}
+
+PreloadWorker::~PreloadWorker()
+{
+    for (Preload &preload : preloads)
+    {
+        delete preload.pipe;
+        delete preload.params;
+    }
+}
+
+void PreloadWorker::start(const QString currentIDin)
+{
+    {
+        QMutexLocker locker(&currentMutex);
+        currentID = currentIDin;
+    }
+    paused = false;
+    QMetaObject::invokeMethod(this, "preload", Qt::QueuedConnection);
+}
+
+void PreloadWorker::pause()
+{
+    //Set this first: a render that checks it and carries on anyway
+    // is guaranteed to see the cancellation when it next claims a stage.
+    paused = true;
+    for (Preload &preload : preloads)
+    {
+        preload.params->cancelComputation();
+    }
+}
+
+Valid PreloadWorker::take(const QString imageID, ImagePipeline * pipeline)
+{
+    pause();
+    QMutexLocker locker(&preloadMutex);
+    for (Preload &preload : preloads)
+    {
+        if (preload.imageID != imageID)
+        {
+            continue;
+        }
+        //Re-read the params in case they were pasted over since the preload;
+        // this drops whatever stages that made stale.
+        preload.params->selectImage(imageID);
+        const Valid preloaded = preload.params->getValid();
+        if (preloaded == Valid::none)
+        {
+            return Valid::none;
+        }
+        cout << "PreloadWorker::take " << imageID.toStdString() << " valid: " << preloaded << endl;
+        pipeline->swapPipeline(preload.pipe);
+        //What we got back is whatever the pipeline had before, which is no use to us.
+        preload.params->setValid(Valid::none);
+        preload.imageID = "";
+        return preloaded;
+    }
+    return Valid::none;
+}
+
+void PreloadWorker::shutdown()
+{
+    pause();
+    thread.quit();
+    thread.wait();
+}
+
+void PreloadWorker::preload()
+{
+    QMutexLocker locker(&preloadMutex);
+    if (paused)
+    {
+        return;
+    }
+    QString searchID;
+    {
+        QMutexLocker currentLocker(&currentMutex);
+        searchID = currentID;
+    }
+    const QStringList upcoming = nextInQueue(searchID, PRELOAD_COUNT);
+
+    //Keep the preloads that are still coming up, and free the rest for the new ones.
+    for (Preload &preload : preloads)
+    {
+        if (!upcoming.contains(preload.imageID))
+        {
+            preload.imageID = "";
+        }
+    }
+
+    for (const QString &imageID : upcoming)
+    {
+        if (paused)
+        {
+            return;
+        }
+        if (liveBufferBytes() > ImagePipeline::getMemoryBudget()*PRELOAD_BUDGET_SHARE)
+        {
+            cout << "PreloadWorker::preload: stopping, memory is needed elsewhere" << endl;
+            return;
+        }
+
+        Preload * target = nullptr;
+        for (Preload &preload : preloads)
+        {
+            if (preload.imageID == imageID)
+            {
+                target = &preload;
+            }
+        }
+        for (Preload &preload : preloads)
+        {
+            if (target == nullptr && preload.imageID == "")
+            {
+                target = &preload;
+            }
+        }
+        if (target == nullptr)
+        {
+            return;
+        }
+        target->imageID = imageID;
+        //Selecting the same image again only drops stages whose params changed.
+        target->params->selectImage(imageID);
+        if (target->params->getValid() == Valid::filmlikecurve)
+        {
+            continue;
+        }
+
+        //Clear the change flag before checking for a pause; a pause after the check
+        // sets it again, and the pipeline gives up at its next claim.
+        target->params->markStartOfProcessing();
+        if (paused)
+        {
+            return;
+        }
+        struct timeval preloadTime;
+        gettimeofday(&preloadTime, nullptr);
+        Exiv2::ExifData exif;
+        target->pipe->processImage(target->params, &silentInterface, exif);
+        cout << "PreloadWorker::preload " << imageID.toStdString() << " time: " << timeDiff(preloadTime) << endl;
+    }
+}
+
+QStringList PreloadWorker::nextInQueue(const QString searchID, const int count)
+{
+    QStringList nextIDs;
+    if (searchID == "")
+    {
+        return nextIDs;
+    }
+    //Each thread needs a unique database connection
+    QSqlDatabase db = getDB();
+    QSqlQuery query(db);
+    query.prepare("SELECT QTsearchID FROM QueueTable "
+                  "WHERE QTsortedIndex > (SELECT QTsortedIndex FROM QueueTable WHERE QTsearchID = ?) "
+                  "ORDER BY QTsortedIndex LIMIT ?;");
+    query.bindValue(0, searchID);
+    query.bindValue(1, count);
+    query.exec();
+    while (query.next())
+    {
+        nextIDs.append(query.value(0).toString());
+    }
+    return nextIDs;
+}
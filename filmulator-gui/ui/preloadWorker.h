@@ -0,0 +1,71 @@
+#ifndef PRELOADWORKER_H
+#define PRELOADWORKER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <atomic>
+#include <vector>
+#include "../core/imagePipeline.h"
+#include "parameterManager.h"
+
+/*The PreloadWorker renders the next few images in the queue at full quality on its own
+ * thread, while nothing else is being rendered, so that stepping through the queue finds
+ * the full-size image already done.
+ *
+ * It only runs between start() and pause(). Anything interactive pauses it, which cancels
+ * the render it's on right away; the next start() picks up from wherever that got to.
+ * The full pipeline take()s a render when its image comes up.
+ */
+
+class PreloadWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PreloadWorker(QObject *parent = 0);
+    ~PreloadWorker();
+
+    //Starts preloading the images after this one in the queue. Safe to call from any thread.
+    void start(const QString currentID);
+
+    //If this image was preloaded, swaps its stages into the given pipeline and returns
+    // how far along they are; otherwise returns Valid::none and leaves the pipeline be.
+    Valid take(const QString imageID, ImagePipeline * pipeline);
+
+    //Stops the thread; for program exit.
+    void shutdown();
+
+public slots:
+    //Cancels the preload in progress. Safe to call from any thread, and cheap enough to
+    // call on every edit; connect it directly, since the worker thread may be busy.
+    void pause();
+
+protected slots:
+    void preload();
+
+protected:
+    //The next images in the queue after this one, in queue order.
+    QStringList nextInQueue(const QString searchID, const int count);
+
+    struct Preload {
+        ParameterManager * params;
+        ImagePipeline * pipe;
+        QString imageID;
+    };
+    std::vector<Preload> preloads;
+    //Progress and histograms of preloads go nowhere.
+    Interface silentInterface;
+
+    QThread thread;
+    //Held while preloading; take() waits on it after pausing.
+    QMutex preloadMutex;
+    QMutex currentMutex;
+    QString currentID;
+    std::atomic<bool> paused;
+};
+
+#endif // PRELOADWORKER_H
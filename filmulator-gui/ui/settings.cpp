@@ -6,6 +6,8 @@
 #include "../database/camconst.h"
 #include <QDir>
 #include <QStandardPaths>
+#include "../core/imagePipeline.h"
+#include "speculationWorker.h"
 
 using namespace std;
 
@@ -237,21 +239,81 @@ bool Settings::getMipmapView()
     return mipmapView;
 }
 
-void Settings::setLowMemMode(bool lowMemModeIn)
+void Settings::setMemoryBudget(int budgetIn)
 {
     QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
-    lowMemMode = lowMemModeIn;
-    settings.setValue("edit/lowMemMode", lowMemModeIn);
-    emit lowMemModeChanged();
+    memoryBudget = budgetIn;
+    settings.setValue("edit/memoryBudget", budgetIn);
+    ImagePipeline::setMemoryBudget(std::size_t(budgetIn)*1024*1024);
+    emit memoryBudgetChanged();
 }
 
-bool Settings::getLowMemMode()
+int Settings::getMemoryBudget()
 {
     QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
-    //Default: 0
-    lowMemMode = settings.value("edit/lowMemMode", 0).toBool();
-    emit lowMemModeChanged();
-    return lowMemMode;
+    //Default: 0, automatic
+    memoryBudget = settings.value("edit/memoryBudget", 0).toInt();
+    emit memoryBudgetChanged();
+    return memoryBudget;
+}
+
+int Settings::getPhysicalMemory()
+{
+    return int(physicalMemoryBytes()/(1024*1024));
+}
+
+void Settings::setCompactCache(bool compactCacheIn)
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    compactCache = compactCacheIn;
+    settings.setValue("edit/compactCache", compactCacheIn);
+    ImagePipeline::setCompactStages(compactCacheIn);
+    emit compactCacheChanged();
+}
+
+bool Settings::getCompactCache()
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    //Default: 1
+    compactCache = settings.value("edit/compactCache", 1).toBool();
+    emit compactCacheChanged();
+    return compactCache;
+}
+
+void Settings::setSpillToDisk(bool spillToDiskIn)
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    spillToDisk = spillToDiskIn;
+    settings.setValue("edit/spillToDisk", spillToDiskIn);
+    ImagePipeline::setSpillToDisk(spillToDiskIn);
+    emit spillToDiskChanged();
+}
+
+bool Settings::getSpillToDisk()
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    //Default: 1
+    spillToDisk = settings.value("edit/spillToDisk", 1).toBool();
+    emit spillToDiskChanged();
+    return spillToDisk;
+}
+
+void Settings::setDiskCacheSize(int sizeIn)
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    diskCacheSize = sizeIn;
+    settings.setValue("edit/diskCacheSize", sizeIn);
+    StageCache::setSizeLimit(std::size_t(sizeIn)*1024*1024*1024);
+    emit diskCacheSizeChanged();
+}
+
+int Settings::getDiskCacheSize()
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    //Default: 10 GiB
+    diskCacheSize = settings.value("edit/diskCacheSize", 10).toInt();
+    emit diskCacheSizeChanged();
+    return diskCacheSize;
 }
 
 void Settings::setQuickPreview(bool quickPreviewIn)
@@ -288,6 +350,24 @@ int Settings::getPreviewResolution()
     return previewResolution;
 }
 
+void Settings::setSpeculativePreview(bool speculativePreviewIn)
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    speculativePreview = speculativePreviewIn;
+    settings.setValue("edit/speculativePreview", speculativePreviewIn);
+    SpeculationWorker::setEnabled(speculativePreviewIn);
+    emit speculativePreviewChanged();
+}
+
+bool Settings::getSpeculativePreview()
+{
+    QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
+    //Default: 0
+    speculativePreview = settings.value("edit/speculativePreview", 0).toBool();
+    emit speculativePreviewChanged();
+    return speculativePreview;
+}
+
 void Settings::setUseSystemLanguage(bool useSystemLanguageIn)
 {
     QSettings settings(QSettings::UserScope, "Filmulator", "Filmulator");
@@ -21,9 +21,13 @@ class Settings : public QObject
     Q_PROPERTY(bool enqueue READ getEnqueue WRITE setEnqueue NOTIFY enqueueChanged)
     Q_PROPERTY(bool appendHash READ getAppendHash WRITE setAppendHash NOTIFY appendHashChanged)
     Q_PROPERTY(bool mipmapView READ getMipmapView WRITE setMipmapView NOTIFY mipmapViewChanged)
-    Q_PROPERTY(bool lowMemMode READ getLowMemMode WRITE setLowMemMode NOTIFY lowMemModeChanged)
+    Q_PROPERTY(int memoryBudget READ getMemoryBudget WRITE setMemoryBudget NOTIFY memoryBudgetChanged)
+    Q_PROPERTY(bool compactCache READ getCompactCache WRITE setCompactCache NOTIFY compactCacheChanged)
+    Q_PROPERTY(bool spillToDisk READ getSpillToDisk WRITE setSpillToDisk NOTIFY spillToDiskChanged)
+    Q_PROPERTY(int diskCacheSize READ getDiskCacheSize WRITE setDiskCacheSize NOTIFY diskCacheSizeChanged)
     Q_PROPERTY(bool quickPreview READ getQuickPreview WRITE setQuickPreview NOTIFY quickPreviewChanged)
     Q_PROPERTY(int previewResolution READ getPreviewResolution WRITE setPreviewResolution NOTIFY previewResolutionChanged)
+    Q_PROPERTY(bool speculativePreview READ getSpeculativePreview WRITE setSpeculativePreview NOTIFY speculativePreviewChanged)
     Q_PROPERTY(bool useSystemLanguage READ getUseSystemLanguage WRITE setUseSystemLanguage NOTIFY useSystemLanguageChanged)
 
     Q_PROPERTY(QString lensfunStatus READ getLensfunStatus NOTIFY lensfunStatusChanged)
@@ -46,9 +50,13 @@ public:
     void setEnqueue(bool enqueueIn);
     void setAppendHash(bool appendHashIn);
     void setMipmapView(bool mipmapViewIn);
-    void setLowMemMode(bool lowMemModeIn);
+    void setMemoryBudget(int budgetIn);
+    void setCompactCache(bool compactCacheIn);
+    void setSpillToDisk(bool spillToDiskIn);
+    void setDiskCacheSize(int sizeIn);
     void setQuickPreview(bool quickPreviewIn);
     void setPreviewResolution(int resolutionIn);
+    void setSpeculativePreview(bool speculativePreviewIn);
     void setUseSystemLanguage(bool useSystemLanguageIn);
 
     Q_INVOKABLE QString getPhotoStorageDir();
@@ -64,9 +72,15 @@ public:
     Q_INVOKABLE bool getEnqueue();
     Q_INVOKABLE bool getAppendHash();
     Q_INVOKABLE bool getMipmapView();
-    Q_INVOKABLE bool getLowMemMode();
+    Q_INVOKABLE int getMemoryBudget();
+    //Installed RAM in MiB, for the upper end of the budget slider.
+    Q_INVOKABLE int getPhysicalMemory();
+    Q_INVOKABLE bool getCompactCache();
+    Q_INVOKABLE bool getSpillToDisk();
+    Q_INVOKABLE int getDiskCacheSize();
     Q_INVOKABLE bool getQuickPreview();
     Q_INVOKABLE int getPreviewResolution();
+    Q_INVOKABLE bool getSpeculativePreview();
     Q_INVOKABLE bool getUseSystemLanguage();
 
     Q_INVOKABLE QString getLensfunStatus() {return lensfunStatus;}
@@ -91,9 +105,13 @@ protected:
     bool enqueue;
     bool appendHash;
     bool mipmapView;
-    bool lowMemMode;
+    int memoryBudget;//MiB; 0 means automatic
+    bool compactCache;
+    bool spillToDisk;
+    int diskCacheSize;//GiB; 0 turns it off
     bool quickPreview;
     int previewResolution;
+    bool speculativePreview;
     bool useSystemLanguage;
 
     QString lensfunStatus;
@@ -115,9 +133,13 @@ signals:
     void enqueueChanged();
     void appendHashChanged();
     void mipmapViewChanged();
-    void lowMemModeChanged();
+    void memoryBudgetChanged();
+    void compactCacheChanged();
+    void spillToDiskChanged();
+    void diskCacheSizeChanged();
     void quickPreviewChanged();
     void previewResolutionChanged();
+    void speculativePreviewChanged();
     void useSystemLanguageChanged();
 
     void lensfunStatusChanged();
@@ -0,0 +1,171 @@
+#include "speculationWorker.h"
+#include <iostream>
+using namespace std;
+
+//How many steps past the current value get filmulated.
+#define SPECULATION_STEPS 2
+
+std::atomic<bool> SpeculationWorker::enabled(false);
+
+//The film sliders whose steps can be extrapolated.
+static float FilmParams::* const filmSliders[] = {
+    &FilmParams::initialDeveloperConcentration,
+    &FilmParams::reservoirThickness,
+    &FilmParams::activeLayerThickness,
+    &FilmParams::crystalsPerPixel,
+    &FilmParams::initialCrystalRadius,
+    &FilmParams::initialSilverSaltDensity,
+    &FilmParams::developerConsumptionConst,
+    &FilmParams::crystalGrowthConst,
+    &FilmParams::silverSaltConsumptionConst,
+    &FilmParams::totalDevelopmentTime,
+    &FilmParams::filmArea,
+    &FilmParams::sigmaConst,
+    &FilmParams::layerMixConst,
+    &FilmParams::layerTimeDivisor,
+    &FilmParams::rolloffBoundary,
+    &FilmParams::toeBoundary
+};
+
+SpeculationWorker::SpeculationWorker(ImagePipeline * targetIn, QObject *parent) :
+    QObject(parent),
+    pipe(NoCache, NoHisto, PreviewQuality, "speculation")
+{
+    target = targetIn;
+    params = new ParameterManager;
+    paused = true;
+    moveToThread(&thread);
+    thread.start(QThread::LowPriority);
+}
+
+SpeculationWorker::~SpeculationWorker()
+{
+    delete params;
+}
+
+void SpeculationWorker::setEnabled(bool enabledIn)
+{
+    enabled = enabledIn;
+}
+
+void SpeculationWorker::speculate(std::shared_ptr<const ParamSnapshot> previous,
+                                  std::shared_ptr<const ParamSnapshot> current)
+{
+    if (!enabled || !previous || !current)
+    {
+        return;
+    }
+    {
+        QMutexLocker locker(&requestMutex);
+        previousSnap = previous;
+        currentSnap = current;
+        generation++;
+    }
+    paused = false;
+    QMetaObject::invokeMethod(this, "run", Qt::QueuedConnection);
+}
+
+void SpeculationWorker::pause()
+{
+    //Set this first, like the preloader: a guess that checks it and carries on anyway
+    // sees the cancellation at its next abort check.
+    paused = true;
+    params->cancelComputation();
+}
+
+void SpeculationWorker::shutdown()
+{
+    pause();
+    thread.quit();
+    thread.wait();
+}
+
+void SpeculationWorker::run()
+{
+    unsigned long thisGeneration;
+    std::shared_ptr<const ParamSnapshot> previous;
+    std::shared_ptr<const ParamSnapshot> current;
+    {
+        QMutexLocker locker(&requestMutex);
+        //Several requests may have queued up while we were busy; only the last one counts.
+        if (generation == generationDone)
+        {
+            return;
+        }
+        thisGeneration = generation;
+        generationDone = generation;
+        previous = previousSnap;
+        current = currentSnap;
+    }
+
+    int kept = 0;
+    for (const std::shared_ptr<const ParamSnapshot> &guess : guesses(*previous, *current))
+    {
+        if (paused || generation != thisGeneration)
+        {
+            break;
+        }
+        //Guesses are only worth it if they don't push out anything real.
+        if (liveBufferBytes() > ImagePipeline::getMemoryBudget())
+        {
+            cout << "SpeculationWorker::run: stopping, memory is needed elsewhere" << endl;
+            break;
+        }
+        params->useSnapshot(guess, Valid::prefilmulation);
+        //Clear the change flag before checking for a pause; a pause after the check
+        // sets it again, and filmulation gives up at its next abort check.
+        params->markStartOfProcessing();
+        if (paused)
+        {
+            break;
+        }
+        if (!pipe.speculateFilmulation(target, params, &silentInterface))
+        {
+            break;
+        }
+        kept++;
+    }
+    if (kept > 0)
+    {
+        cout << "SpeculationWorker::run: filmulated " << kept << " guesses ahead" << endl;
+    }
+}
+
+std::vector<std::shared_ptr<const ParamSnapshot>> SpeculationWorker::guesses(const ParamSnapshot &previous,
+                                                                               const ParamSnapshot &current)
+{
+    std::vector<std::shared_ptr<const ParamSnapshot>> guessList;
+    //Anything changed upstream of filmulation means this wasn't a film slider drag.
+    if (previous.changed[Valid::partprefilmulation/2] != current.changed[Valid::partprefilmulation/2] ||
+        previous.film.agitateCount != current.film.agitateCount ||
+        previous.film.developmentSteps != current.film.developmentSteps)
+    {
+        return guessList;
+    }
+    float FilmParams::* slider = nullptr;
+    for (float FilmParams::* candidate : filmSliders)
+    {
+        if (previous.film.*candidate == current.film.*candidate)
+        {
+            continue;
+        }
+        if (slider != nullptr)
+        {
+            return guessList;//more than one moved
+        }
+        slider = candidate;
+    }
+    if (slider == nullptr)
+    {
+        return guessList;
+    }
+
+    const float step = current.film.*slider - previous.film.*slider;
+    for (int i = 1; i <= SPECULATION_STEPS; i++)
+    {
+        std::shared_ptr<ParamSnapshot> guess = std::make_shared<ParamSnapshot>(current);
+        guess->film.*slider = current.film.*slider + i*step;
+        guessList.push_back(guess);
+    }
+    return guessList;
+}
@@ -0,0 +1,74 @@
+#ifndef SPECULATIONWORKER_H
+#define SPECULATIONWORKER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include "../core/imagePipeline.h"
+#include "parameterManager.h"
+
+/*The SpeculationWorker guesses where a film slider is being dragged and filmulates the
+ * quick preview's next few values ahead of time, on whatever cores the drag leaves idle.
+ *
+ * After each preview render, speculate() gets the params that were rendered before and
+ * the ones rendered now. If exactly one film parameter moved, the same step is taken a
+ * few more times and each result goes into the preview pipeline's speculative history,
+ * where the next render looks for it before filmulating. Guesses that don't pan out
+ * just age out of that history.
+ */
+
+class SpeculationWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    //Results go into the target pipeline, which must outlive this.
+    explicit SpeculationWorker(ImagePipeline * target, QObject *parent = 0);
+    ~SpeculationWorker();
+
+    //Off by default; it costs power and memory for a payoff only on steady drags.
+    static void setEnabled(bool enabledIn);
+    static bool isEnabled() {return enabled.load();}
+
+    //Starts guessing from the step between these two. Safe to call from any thread;
+    // replaces whatever guesses haven't been started yet.
+    void speculate(std::shared_ptr<const ParamSnapshot> previous,
+                   std::shared_ptr<const ParamSnapshot> current);
+
+    //Stops the thread; for program exit.
+    void shutdown();
+
+public slots:
+    //Cancels the guess in progress. Safe to call from any thread.
+    void pause();
+
+protected slots:
+    void run();
+
+protected:
+    //The guesses, or none if the step between these isn't one film slider moving.
+    std::vector<std::shared_ptr<const ParamSnapshot>> guesses(const ParamSnapshot &previous,
+                                                              const ParamSnapshot &current);
+
+    ImagePipeline * target;
+    ImagePipeline pipe;
+    ParameterManager * params;
+    //Progress of guesses goes nowhere.
+    Interface silentInterface;
+
+    QThread thread;
+    //snapshots and generation are only touched with this held.
+    QMutex requestMutex;
+    std::shared_ptr<const ParamSnapshot> previousSnap;
+    std::shared_ptr<const ParamSnapshot> currentSnap;
+    unsigned long generation = 0;
+    unsigned long generationDone = 0;
+    std::atomic<bool> paused;
+
+    static std::atomic<bool> enabled;
+};
+
+#endif // SPECULATIONWORKER_H
@@ -1,4 +1,5 @@
 #include "thumbWriteWorker.h"
+#include "paramWriteWorker.h"
 #include <QDir>
 #include <iostream>
 #include "../database/database.hpp"
@@ -20,6 +21,10 @@ void ThumbWriteWorker::setImage(matrix<unsigned short> imageIn,
 //writeThumb writes the thumb if the image is non-zero sized.
 bool ThumbWriteWorker::writeThumb(QString searchID)
 {
+    BufferTagScope bufferScope("thumbWriter", "thumbnail");
+    ThreadBudgetScope threadScope(WorkClass::background);
+    //A late parameter write would mark this thumbnail as stale again.
+    ParamWriteWorker::instance()->flush(searchID);
     dataMutex.lock();
     int rows = image.nr();
     int cols = image.nc();
@@ -43,10 +48,13 @@ bool ThumbWriteWorker::writeThumb(QString searchID)
     matrix<unsigned short> gammaCurved;
 
     //We need to linearize the brightness before scaling.
-
-    sRGB_linearize(image, linear);
+    //To avoid holding a full-size float copy, we box-average by the largest integer
+    // factor that keeps us above the thumbnail size while linearizing, and let
+    // downscale_and_crop handle the remaining fractional scale.
+    const int boxFactor = max(1, int(floor(max((cols/3)/600.0, rows/600.0))));
+    sRGB_linearize_downscale(image, linear, boxFactor);
     dataMutex.unlock();
-    downscale_and_crop(linear, small, 0, 0, (cols/3 -1), rows-1, 600, 600);
+    downscale_and_crop(linear, small, 0, 0, (linear.nc()/3 -1), linear.nr()-1, 600, 600);
     //Then we put it back to the sRGB curve.
     sRGB_gammacurve(small, gammaCurved);
 